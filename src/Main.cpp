@@ -1,9 +1,42 @@
+#include "anytime.hpp"
+#include "autotune.hpp"
 #include "blockage.hpp"
+#include "cluster.hpp"
 #include "dme.hpp"
+#include "eco.hpp"
+#include "greedydme.hpp"
+#include "hierarchical.hpp"
+#include "htree.hpp"
+#include "localsearch.hpp"
 #include "parser.hpp"
+#include "router.hpp"
+#include "sinkorder.hpp"
+#include "sweep.hpp"
+#include "topofile.hpp"
 #include "topology.hpp"
 #include <argparse/argparse.hpp>
 
+// Parses a byte count with an optional K, M or G suffix (powers of 1024).
+inline int64_t parseByteSize(const std::string &text) {
+  size_t pos = 0;
+  auto value = std::stoll(text, &pos);
+  auto suffix = text.substr(pos);
+  if (suffix.empty()) {
+    return value;
+  }
+  if (suffix.size() == 1) {
+    switch (std::toupper(suffix[0])) {
+    case 'K':
+      return value << 10;
+    case 'M':
+      return value << 20;
+    case 'G':
+      return value << 30;
+    }
+  }
+  throw std::invalid_argument(text);
+}
+
 int main(int argc, char **argv) {
   argparse::ArgumentParser program("main");
   program.add_argument("--input").required().help(
@@ -11,6 +44,131 @@ int main(int argc, char **argv) {
 
   program.add_argument("--output").required().help("file to write output to");
 
+  program.add_argument("--buffered")
+      .default_value(false)
+      .implicit_value(true)
+      .help("insert buffers while merging to keep subtree loads in budget");
+
+  program.add_argument("--cap-budget")
+      .default_value(0.9)
+      .scan<'g', double>()
+      .help("fraction of the cap limit a subtree may drive unbuffered");
+
+  program.add_argument("--wire-type")
+      .default_value(-1)
+      .scan<'i', int>()
+      .help("wire library index used for every edge, -1 selects per edge");
+
+  program.add_argument("--wire-cap-weight")
+      .default_value(1000.0)
+      .scan<'g', double>()
+      .help("delay (fs) traded per fF of capacitance when selecting wires");
+
+  program.add_argument("--topology")
+      .default_value(std::string("dnna"))
+      .help("topology algorithm: dnna, nna, mmm or matching");
+
+  program.add_argument("--max-pair-mem")
+      .default_value(std::string("0"))
+      .help("memory cap for NNA/DNNA merge candidates, e.g. 2G, 0 means "
+            "unlimited");
+
+  program.add_argument("--pair-seeding")
+      .default_value(std::string("exact"))
+      .help("NNA/DNNA merge candidates: exact, or morton for neighbours "
+            "along shifted Morton curves");
+
+  program.add_argument("--greedy-dme")
+      .default_value(false)
+      .implicit_value(true)
+      .help("build topology and embedding in one Greedy-DME pass");
+
+  program.add_argument("--cluster-size")
+      .default_value(0)
+      .scan<'i', int>()
+      .help("synthesise clusters of at most this many sinks separately and "
+            "stitch them, 0 disables");
+
+  program.add_argument("--htree-depth")
+      .default_value(0)
+      .scan<'i', int>()
+      .help("levels of a symmetric H-tree trunk over the floorplan with local "
+            "DME per leaf region, 0 disables");
+
+  program.add_argument("--sweep")
+      .default_value(std::string(""))
+      .help("grid of topology settings to synthesise and score, e.g. "
+            "\"algo=dnna;alpha=0.1,0.2;gamma=0.25,0.5\"; writes the best tree");
+
+  program.add_argument("--sweep-csv")
+      .default_value(std::string(""))
+      .help("ranked sweep results, defaults to <output>.sweep.csv");
+
+  program.add_argument("--autotune")
+      .default_value(0.0)
+      .scan<'g', double>()
+      .help("seconds to spend tuning the topology weights for this design, "
+            "0 disables; writes the best settings to <output>.settings");
+
+  program.add_argument("--autotune-candidates")
+      .default_value(32)
+      .scan<'i', int>()
+      .help("candidate settings entering the first autotune rung");
+
+  program.add_argument("--time-budget")
+      .default_value(0.0)
+      .scan<'g', double>()
+      .help("seconds for anytime synthesis, 0 disables; the best tree so "
+            "far is kept in the output files while it runs");
+
+  program.add_argument("--eco")
+      .default_value(std::string(""))
+      .help("sink changes to apply to --eco-base, one per line: "
+            "add <id> <x> <y> <cap>, remove <id> or move <id> <x> <y>");
+
+  program.add_argument("--eco-base")
+      .default_value(std::string(""))
+      .help("tree written by an earlier run on --input, re-embedded "
+            "incrementally with the --eco changes");
+
+  program.add_argument("--save-topology")
+      .default_value(std::string(""))
+      .help("write the topology to this binary checkpoint file");
+
+  program.add_argument("--load-topology")
+      .default_value(std::string(""))
+      .help("embed the topology from a --save-topology checkpoint instead "
+            "of synthesising one");
+
+  program.add_argument("--sink-radius")
+      .default_value(0)
+      .scan<'i', int>()
+      .help("build sinks closer than this (dbu) into local subtrees before "
+            "topology generation, 0 disables");
+
+  program.add_argument("--local-search")
+      .default_value(0)
+      .scan<'i', int>()
+      .help("rounds of topology rotations and swaps after synthesis, 0 "
+            "disables");
+
+  program.add_argument("--sink-order")
+      .default_value(std::string("input"))
+      .help("order of the sink table during synthesis: input, hilbert or "
+            "morton; outputs keep the input numbering");
+
+  program.add_argument("--route")
+      .default_value(false)
+      .implicit_value(true)
+      .help("route the tree edges around blockages and rebalance the "
+            "delays for the detours");
+
+  program.add_argument("--threads")
+      .default_value(1)
+      .scan<'i', int>()
+      .help("worker threads used by MMM, the embedding stage and the "
+            "hierarchical flows");
+
   try {
     program.parse_args(argc, argv);
   } catch (const std::runtime_error &err) {
@@ -19,34 +177,292 @@ int main(int argc, char **argv) {
     std::exit(1);
   }
 
+  // Checkpoints, sink clustering and local search act on the topology of
+  // the default flow only, the other flows build their own trees.
+  const std::pair<const char *, bool> flows[] = {
+      {"--eco", !program.get<std::string>("--eco").empty()},
+      {"--greedy-dme", program.get<bool>("--greedy-dme")},
+      {"--sweep", !program.get<std::string>("--sweep").empty()},
+      {"--time-budget", program.get<double>("--time-budget") > 0},
+      {"--autotune", program.get<double>("--autotune") > 0},
+      {"--htree-depth", program.get<int>("--htree-depth") > 0},
+      {"--cluster-size", program.get<int>("--cluster-size") > 0}};
+  auto defaultFlowOnly = [&](const char *option, bool set) {
+    for (const auto &[flag, used] : flows) {
+      if (set && used) {
+        std::cerr << option << " does not work with " << flag << std::endl;
+        std::exit(1);
+      }
+    }
+  };
+  auto loadPath = program.get<std::string>("--load-topology");
+  auto sinkRadius = program.get<int>("--sink-radius");
+  defaultFlowOnly("--save-topology",
+                  !program.get<std::string>("--save-topology").empty());
+  defaultFlowOnly("--load-topology", !loadPath.empty());
+  defaultFlowOnly("--sink-radius", sinkRadius > 0);
+  defaultFlowOnly("--local-search", program.get<int>("--local-search") > 0);
+  // An ECO edits the base tree in place, in input order and unrouted.
+  if (!program.get<std::string>("--eco").empty()) {
+    const std::pair<const char *, bool> ignored[] = {
+        {"--sink-order", program.get<std::string>("--sink-order") != "input"},
+        {"--route", program.get<bool>("--route")}};
+    for (const auto &[option, set] : ignored) {
+      if (set) {
+        std::cerr << option << " does not work with --eco" << std::endl;
+        std::exit(1);
+      }
+    }
+  }
+  if (sinkRadius > 0 && !loadPath.empty()) {
+    std::cerr << "--sink-radius does not work with --load-topology"
+              << std::endl;
+    std::exit(1);
+  }
+
   auto inputFile = program.get<std::string>("--input");
   auto outputFile = program.get<std::string>("--output");
 
   auto inp = parse(inputFile);
-  /*
-  auto syn = clksyn::TreeSynthesis(
-    inp,
-    clksyn::TreeSynthesisSettings {
-      .Algo = clksyn::TopologyAlgorithm::NNA,
-      .Alpha = 0, .Beta = 0, .Gamma = 0, .Delta = 0.5
+
+  auto embSett = dme::EmbeddingSettings{
+      .Buffered = program.get<bool>("--buffered"),
+      .CapBudget = program.get<double>("--cap-budget"),
+      .WireType = program.get<int>("--wire-type"),
+      .WireCapWeight = program.get<double>("--wire-cap-weight"),
+      .Threads = program.get<int>("--threads")};
+
+  if (auto changes = program.get<std::string>("--eco"); !changes.empty()) {
+    auto base = program.get<std::string>("--eco-base");
+    if (base.empty()) {
+      std::cerr << "--eco needs --eco-base" << std::endl;
+      std::exit(1);
     }
-  );
-  */
+    try {
+      std::ifstream in(changes);
+      auto session = dme::EcoSession(
+          inp, dme::topologyFromOutput(inp, parse_output(base)), embSett);
+      session.apply(dme::parseEcoChanges(in));
+      auto res = session.result();
+      LogInfo("ECO merged " + std::to_string(session.stats().Merges) +
+              " and placed " + std::to_string(session.stats().Placements) +
+              " nodes.");
+      print_output(outputFile, res.Tree.Topology.toOutParam(inp));
+      print_output(outputFile + ".embedding", res.Tree.toOutParam(inp));
+    } catch (const std::exception &err) {
+      std::cerr << "ECO failed: " << err.what() << std::endl;
+      std::exit(1);
+    }
+    return 0;
+  }
+
+  // Synthesis runs on the reordered sinks, trees are written back in input
+  // numbering.
+  auto design = inp;
+  std::vector<int32_t> order;
+  if (auto name = program.get<std::string>("--sink-order");
+      auto parsed = dme::sinkOrderFromName(name)) {
+    order = dme::sinkOrder(design, *parsed);
+  } else {
+    std::cerr << "unknown sink order: " << name << std::endl;
+    std::exit(1);
+  }
+  inp = dme::reorderSinks(design, order);
+  auto route = program.get<bool>("--route");
+  auto routeTree = [&](dme::EmbeddingResult &tree) {
+    if (!route) {
+      return;
+    }
+    auto stats = dme::routeEdges(
+        inp, tree, dme::RouterSettings{.Threads = embSett.Threads});
+    LogInfo("Routed " + std::to_string(stats.Bent) + " of " +
+            std::to_string(stats.Edges) + " edges around blockages (" +
+            std::to_string(stats.Escaped) + " out of one), " +
+            std::to_string(stats.Moved) + " points moved out of blockages, " +
+            std::to_string(stats.Detour) + " dbu of detours and " +
+            std::to_string(stats.Rebalanced) + " dbu to rebalance.");
+  };
+  auto writeTree = [&](clksyn::TopologyResult top, dme::EmbeddingResult tree) {
+    routeTree(tree);
+    dme::renumberSinks(top, order);
+    dme::renumberSinks(tree, order);
+    print_output(outputFile, top.toOutParam(design));
+    print_output(outputFile + ".embedding", tree.toOutParam(design));
+  };
 
-  auto syn = clksyn::TreeSynthesis(
-      inp,
+  if (program.get<bool>("--greedy-dme")) {
+    auto emres = dme::GreedyDME(inp, embSett).computeEmbedding();
+    writeTree(emres.Topology, emres);
+    return 0;
+  }
+
+  auto algo = program.get<std::string>("--topology");
+  auto synSett =
       clksyn::TreeSynthesisSettings{.Algo = clksyn::TopologyAlgorithm::DNNA,
                                     .Alpha = 0.2,
                                     .Beta = 1.0,
                                     .Gamma = 0.5,
-                                    .Delta = 2.5});
+                                    .Delta = 2.5,
+                                    .Threads = program.get<int>("--threads")};
+  auto maxPairMem = program.get<std::string>("--max-pair-mem");
+  try {
+    synSett.MaxPairMem = parseByteSize(maxPairMem);
+  } catch (const std::exception &) {
+    std::cerr << "invalid --max-pair-mem: " << maxPairMem << std::endl;
+    std::exit(1);
+  }
+  if (auto seeding = program.get<std::string>("--pair-seeding");
+      auto parsed = clksyn::pairSeedingFromName(seeding)) {
+    synSett.Seeding = *parsed;
+  } else {
+    std::cerr << "unknown pair seeding: " << seeding << std::endl;
+    std::exit(1);
+  }
+  if (auto parsed = clksyn::topologyAlgorithmFromName(algo)) {
+    synSett.Algo = *parsed;
+  } else {
+    std::cerr << "unknown topology algorithm: " << algo << std::endl;
+    std::exit(1);
+  }
+  if (synSett.Algo == clksyn::TopologyAlgorithm::NNA) {
+    synSett.Delta = 0.5;
+  }
+  // Too small a cap throws in getTopology, which the flows below run on
+  // pool workers where nothing catches it. Any of them may cover all the
+  // sinks with NNA or DNNA, so the cap must hold one candidate per sink.
+  if (auto least = clksyn::minPairMem(inp.sinks.size(), synSett.Seeding);
+      synSett.MaxPairMem > 0 && synSett.MaxPairMem < least) {
+    std::cerr << "--max-pair-mem must be at least " << least << " bytes for "
+              << inp.sinks.size() << " sinks" << std::endl;
+    std::exit(1);
+  }
+
+  if (auto spec = program.get<std::string>("--sweep"); !spec.empty()) {
+    std::vector<clksyn::TreeSynthesisSettings> grid;
+    try {
+      grid = dme::parseSweepGrid(spec, synSett);
+    } catch (const std::exception &err) {
+      std::cerr << "invalid --sweep: " << err.what() << std::endl;
+      std::exit(1);
+    }
+    auto sweep = dme::runSweep(
+        inp, grid,
+        dme::SweepSettings{.Embedding = embSett, .Threads = synSett.Threads});
+    auto csv = program.get<std::string>("--sweep-csv");
+    dme::writeSweepCsv(csv.empty() ? outputFile + ".sweep.csv" : csv,
+                       sweep.Points);
+    writeTree(sweep.Best.Topology, sweep.Best);
+    return 0;
+  }
+
+  if (auto budget = program.get<double>("--time-budget"); budget > 0) {
+    auto res = dme::anytimeSynthesis(
+        inp,
+        dme::AnytimeSettings{
+            .Topology = synSett,
+            .Sweep = {.Embedding = embSett, .Threads = synSett.Threads},
+            .TimeBudget = budget,
+            .Candidates = program.get<int>("--autotune-candidates")},
+        [&](const dme::AnytimeResult &best) {
+          LogInfo("Checkpoint from " + best.Stage + ", objective " +
+                  std::to_string(best.Best.Objective));
+          auto tree = best.Tree;
+          routeTree(tree);
+          dme::renumberSinks(tree, order);
+          dme::writeTreeAtomically(design, outputFile, tree);
+        });
+    std::cout << "best tree: " << res.Stage << ", "
+              << dme::sweepSpec(res.Best.Settings) << " ("
+              << res.Improvements << " checkpoints)" << std::endl;
+    return 0;
+  }
+
+  if (auto budget = program.get<double>("--autotune"); budget > 0) {
+    auto tuned = dme::autotune(
+        inp, dme::AutotuneSettings{
+                 .Base = synSett,
+                 .Sweep = {.Embedding = embSett, .Threads = synSett.Threads},
+                 .Candidates = program.get<int>("--autotune-candidates"),
+                 .TimeBudget = budget,
+                 .OnImprove = {}});
+    auto spec = dme::sweepSpec(tuned.Best.Settings);
+    std::cout << "best settings: " << spec << " (" << tuned.Evaluations
+              << " evaluations, " << tuned.CacheHits << " cached"
+              << (tuned.TimedOut ? ", budget exhausted" : "") << ")"
+              << std::endl;
+    std::ofstream(outputFile + ".settings") << spec << std::endl;
+    writeTree(tuned.Tree.Topology, tuned.Tree);
+    return 0;
+  }
+
+  if (auto depth = program.get<int>("--htree-depth"); depth > 0) {
+    auto emres = dme::HTreeSynthesis(
+                     inp, dme::HTreeSettings{.Topology = synSett,
+                                             .Embedding = embSett,
+                                             .Depth = depth,
+                                             .Threads = synSett.Threads})
+                     .computeEmbedding();
+    writeTree(emres.Topology, emres);
+    return 0;
+  }
+
+  if (auto clusterSize = program.get<int>("--cluster-size");
+      clusterSize > 0) {
+    auto emres =
+        dme::HierarchicalSynthesis(
+            inp, dme::HierarchicalSettings{.Topology = synSett,
+                                           .Embedding = embSett,
+                                           .ClusterSize = clusterSize,
+                                           .Threads = synSett.Threads})
+            .computeEmbedding();
+    writeTree(emres.Topology, emres);
+    return 0;
+  }
+
+  clksyn::TopologyResult top;
+  try {
+    if (auto path = program.get<std::string>("--load-topology");
+        !path.empty()) {
+      top = clksyn::loadTopology(path, design);
+      dme::renumberSinks(top, dme::inverseOrder(order));
+    } else if (auto radius = program.get<int>("--sink-radius"); radius > 0) {
+      clksyn::SinkClusters clusters;
+      top = clksyn::clusteredTopology(
+          inp, synSett, clksyn::SinkClusterSettings{.Radius = radius},
+          &clusters);
+      LogInfo("Topology over " + std::to_string(clusters.Groups.size()) +
+              " sink groups.");
+    } else {
+      top = clksyn::TreeSynthesis(inp, synSett).getTopology();
+    }
+    if (auto rounds = program.get<int>("--local-search"); rounds > 0) {
+      dme::LocalSearchStats stats;
+      top = dme::optimizeTopology(
+          inp, std::move(top),
+          dme::LocalSearchSettings{.Embedding = embSett,
+                                   .Rounds = rounds,
+                                   .Threads = synSett.Threads},
+          &stats);
+      LogInfo("Local search committed " + std::to_string(stats.Committed) +
+              " of " + std::to_string(stats.Evaluated) + " moves, " +
+              std::to_string(stats.CapBefore) + " -> " +
+              std::to_string(stats.CapAfter) + " fF.");
+    }
+    if (auto path = program.get<std::string>("--save-topology");
+        !path.empty()) {
+      auto saved = top;
+      dme::renumberSinks(saved, order);
+      clksyn::saveTopology(path, saved, design);
+    }
+  } catch (const std::exception &err) {
+    std::cerr << err.what() << std::endl;
+    std::exit(1);
+  }
 
-  auto top = syn.getTopology();
-  auto em = dme::EmbeddingManager(inp, top);
+  auto em = dme::EmbeddingManager(inp, top, embSett);
   auto emres = em.computeEmbedding();
 
-  print_output(outputFile, top.toOutParam());
-  print_output(outputFile + ".embedding", emres.toOutParam());
+  writeTree(top, emres);
 
   /*
   auto alpha = clksyn::BlockageManager();
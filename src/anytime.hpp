@@ -0,0 +1,137 @@
+#pragma once
+
+#include "autotune.hpp"
+#include "localsearch.hpp"
+#include "parser.hpp"
+#include "sweep.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+
+namespace dme {
+
+// Settings for synthesis under a fixed wall-clock slot.
+struct AnytimeSettings {
+  // Weights the refinement starts from, the algorithm is set per stage.
+  clksyn::TreeSynthesisSettings Topology;
+  // Embedding, worker threads and the ranking objective.
+  SweepSettings Sweep;
+  // Seconds from the call until the last improvement may start.
+  double TimeBudget = 60;
+  // Candidates per bracket of the weight search.
+  int32_t Candidates = 32;
+};
+
+struct AnytimeResult {
+  SweepPoint Best;
+  EmbeddingResult Tree;
+  // Stage that produced the best tree, and how often the best changed.
+  std::string Stage;
+  int32_t Improvements = 0;
+};
+
+// Writes the tree to `output` and `output`.embedding the way Main does,
+// each through a temporary file renamed over the old one, so a reader or
+// a killed job never sees a partial file. The embedding is renamed first.
+inline bool writeTreeAtomically(const inparams &inp,
+                                const std::string &output,
+                                const EmbeddingResult &tree) {
+  auto replace = [](const std::string &path, const outparams &out) {
+    auto tmp = path + ".tmp";
+    print_output(tmp, out);
+    std::error_code err;
+    std::filesystem::rename(tmp, path, err);
+    if (err) {
+      LogWarn("Checkpoint of " + path + " failed: " + err.message());
+      return false;
+    }
+    return true;
+  };
+  return replace(output + ".embedding", tree.toOutParam(inp)) &&
+         replace(output, tree.Topology.toOutParam(inp));
+}
+
+// Produces a valid tree as early as possible and keeps improving it until
+// the budget is spent. Stages run from cheap to expensive: median
+// bipartition (MMM), NNA, local rotations of the best tree so far, DNNA
+// with the given weights, then the weight search of `autotune` for
+// whatever time is left. Every tree is scored with `evaluate` and
+// `checkpoint` is called whenever the best one changes, the MMM tree
+// always.
+//
+// A stage that has started runs to completion, so the deadline can be
+// overshot by one synthesis (the MMM tree is produced regardless).
+inline AnytimeResult
+anytimeSynthesis(const inparams &inp, const AnytimeSettings &sett,
+                 const std::function<void(const AnytimeResult &)> &checkpoint) {
+  using Clock = std::chrono::steady_clock;
+  auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                     std::chrono::duration<double>(
+                                         std::max(sett.TimeBudget, 0.)));
+  auto remaining = [&] {
+    return std::chrono::duration<double>(deadline - Clock::now()).count();
+  };
+
+  AnytimeResult res;
+  auto offer = [&](const std::string &stage, const SweepPoint &point,
+                   const EmbeddingResult &tree) {
+    if (res.Improvements > 0 && point.Objective >= res.Best.Objective) {
+      return;
+    }
+    res.Best = point;
+    res.Tree = tree;
+    res.Stage = stage;
+    ++res.Improvements;
+    if (checkpoint) {
+      checkpoint(res);
+    }
+  };
+
+  auto mmm = sett.Topology;
+  mmm.Algo = clksyn::TopologyAlgorithm::MMM;
+  auto full = clksyn::TreeSynthesis(inp, mmm);
+  EmbeddingResult tree;
+  auto point = scorePoint(full, inp, mmm, sett.Sweep, &tree);
+  offer("mmm", point, tree);
+
+  if (remaining() > 0) {
+    auto nna = sett.Topology;
+    nna.Algo = clksyn::TopologyAlgorithm::NNA;
+    nna.Delta = 0.5;
+    point = scorePoint(full, inp, nna, sett.Sweep, &tree);
+    offer("nna", point, tree);
+  }
+
+  if (remaining() > 0) {
+    auto rotated = optimizeTopology(
+        inp, res.Tree.Topology,
+        LocalSearchSettings{.Embedding = sett.Sweep.Embedding,
+                            .Threads = sett.Sweep.Threads});
+    tree = EmbeddingManager(inp, std::move(rotated), sett.Sweep.Embedding)
+               .computeEmbedding();
+    point.Settings = res.Best.Settings;
+    point.Score = evaluate(inp, tree);
+    point.Objective = sweepObjective(point.Score, sett.Sweep);
+    offer("rotations", point, tree);
+  }
+
+  if (auto left = remaining(); left > 0) {
+    auto dnna = sett.Topology;
+    dnna.Algo = clksyn::TopologyAlgorithm::DNNA;
+    auto stage = std::string("dnna");
+    autotune(inp, AutotuneSettings{
+                      .Base = dnna,
+                      .Sweep = sett.Sweep,
+                      .Candidates = sett.Candidates,
+                      .TimeBudget = left,
+                      .OnImprove =
+                          [&](const SweepPoint &p, const EmbeddingResult &t) {
+                            offer(stage, p, t);
+                            stage = "autotune";
+                          }});
+  }
+  return res;
+}
+
+} // namespace dme
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "hierarchical.hpp"
+#include "sweep.hpp"
+
+#include <chrono>
+#include <functional>
+#include <random>
+
+namespace dme {
+
+// Settings for tuning the DNNA weights of one design.
+struct AutotuneSettings {
+  // Algorithm and the weights the first candidate starts from.
+  clksyn::TreeSynthesisSettings Base;
+  // Embedding, worker threads and the ranking objective.
+  SweepSettings Sweep;
+  // Candidates entering the first rung, halved every rung.
+  int32_t Candidates = 32;
+  // Sinks sampled for the first rung, doubled every rung until the last
+  // one sees the whole design.
+  int32_t MinSample = 128;
+  // Wall-clock budget in seconds for the whole run. Brackets of fresh
+  // candidates are run until it is spent, or `Brackets` of them if that
+  // is positive.
+  double TimeBudget = 60;
+  int32_t Brackets = 0;
+  uint32_t Seed = 1;
+  // Called with every new best full-design tree, the base one included.
+  // Runs on the worker that found it, one call at a time.
+  std::function<void(const SweepPoint &, const EmbeddingResult &)> OnImprove;
+};
+
+struct AutotuneResult {
+  SweepPoint Best;
+  EmbeddingResult Tree;
+  // Candidate evaluations run, and those answered from the cache.
+  int32_t Evaluations = 0;
+  int32_t CacheHits = 0;
+  bool TimedOut = false;
+};
+
+// Successive halving over Alpha, Beta, Gamma and Delta. Every rung
+// synthesises and scores the surviving candidates on a nested random
+// sample of the sinks and keeps the better half; the sample doubles, so
+// the survivors of the last rung are compared on the full design. Weights
+// are drawn on a coarse logarithmic grid and scores cached per setting
+// and sample, so candidates that coincide are evaluated once.
+//
+// The base settings are scored on the full design first, and every new
+// bracket starts from the best settings so far. The run stops as soon as
+// the budget is spent and always returns the best full-design tree found,
+// at worst the one of the base settings.
+inline AutotuneResult autotune(const inparams &inp,
+                               const AutotuneSettings &sett) {
+  using Clock = std::chrono::steady_clock;
+  auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                     std::chrono::duration<double>(
+                                         std::max(sett.TimeBudget, 0.)));
+  auto expired = [&] { return Clock::now() >= deadline; };
+
+  AutotuneResult res;
+  auto full = clksyn::TreeSynthesis(inp, sett.Base);
+  res.Best = scorePoint(full, inp, sett.Base, sett.Sweep, &res.Tree);
+  ++res.Evaluations;
+  if (sett.OnImprove) {
+    sett.OnImprove(res.Best, res.Tree);
+  }
+
+  // Four steps per octave between 1/16 and 8 for the weights, tenths
+  // for Delta.
+  std::mt19937 rng(sett.Seed);
+  auto logWeight = [&] {
+    auto step = std::uniform_int_distribution<int32_t>(-16, 12)(rng);
+    return std::pow(2., step / 4.);
+  };
+  auto delta = [&] {
+    return std::uniform_int_distribution<int32_t>(11, 40)(rng) / 10.;
+  };
+  // Rungs run from the smallest sample that still leaves at least one
+  // candidate for the full design.
+  auto numSinks = static_cast<int32_t>(inp.sinks.size());
+  int32_t rungs = 1;
+  while ((1 << rungs) <= std::max(sett.Candidates, 1) &&
+         (numSinks >> rungs) >= std::max(sett.MinSample, 2)) {
+    ++rungs;
+  }
+  std::vector<int32_t> order(numSinks);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), rng);
+
+  std::unique_ptr<clksyn::ThreadPool> pool;
+  if (sett.Sweep.Threads > 1) {
+    pool = std::make_unique<clksyn::ThreadPool>(sett.Sweep.Threads);
+  }
+  using Key = std::tuple<double, double, double, double, int32_t>;
+  std::map<Key, double> cache;
+  auto keyOf = [](const clksyn::TreeSynthesisSettings &s, int32_t sample) {
+    return Key{s.Alpha, s.Beta, s.Gamma, s.Delta, sample};
+  };
+  cache[keyOf(sett.Base, numSinks)] = res.Best.Objective;
+
+  // One bracket of successive halving, the first rung on the smallest
+  // sample.
+  auto runBracket = [&](std::vector<clksyn::TreeSynthesisSettings> live) {
+    for (int32_t rung = 0; rung < rungs && !live.empty(); ++rung) {
+      auto sample = rung + 1 == rungs ? numSinks
+                                      : numSinks >> (rungs - 1 - rung);
+      std::vector<int32_t> picked(order.begin(), order.begin() + sample);
+      std::sort(picked.begin(), picked.end());
+      auto sub = subsetSinks(inp, picked);
+      auto base = sample == numSinks ? full.withSettings(sett.Base)
+                                     : clksyn::TreeSynthesis(sub, sett.Base);
+
+      // score each distinct setting once
+      std::vector<Key> keys;
+      std::map<Key, int32_t> firstOf;
+      std::vector<int32_t> todo;
+      for (size_t i = 0; i < live.size(); ++i) {
+        keys.push_back(keyOf(live[i], sample));
+        if (cache.count(keys[i]) || firstOf.count(keys[i])) {
+          ++res.CacheHits;
+          continue;
+        }
+        firstOf[keys[i]] = i;
+        todo.push_back(i);
+      }
+
+      std::mutex mtx;
+      auto lastRung = sample == numSinks;
+      clksyn::parallelFor(
+          pool.get(), static_cast<int32_t>(todo.size()), [&](int32_t t) {
+            if (expired()) {
+              return;
+            }
+            auto i = todo[t];
+            EmbeddingResult tree;
+            auto point = scorePoint(base, sub, live[i], sett.Sweep,
+                                    lastRung ? &tree : nullptr);
+            std::lock_guard<std::mutex> lock(mtx);
+            ++res.Evaluations;
+            cache[keys[i]] = point.Objective;
+            if (lastRung && point.Objective < res.Best.Objective) {
+              res.Best = point;
+              res.Tree = std::move(tree);
+              if (sett.OnImprove) {
+                sett.OnImprove(res.Best, res.Tree);
+              }
+            }
+          });
+      if (expired()) {
+        res.TimedOut = true;
+        return;
+      }
+
+      // keep the better half, ties by candidate order
+      std::vector<int32_t> rank(live.size());
+      std::iota(rank.begin(), rank.end(), 0);
+      std::stable_sort(rank.begin(), rank.end(), [&](auto &&a, auto &&b) {
+        return cache.at(keys[a]) < cache.at(keys[b]);
+      });
+      std::vector<clksyn::TreeSynthesisSettings> next;
+      for (size_t r = 0; r < std::max<size_t>(live.size() / 2, 1); ++r) {
+        next.push_back(live[rank[r]]);
+      }
+      live = std::move(next);
+    }
+  };
+
+  for (int32_t bracket = 0;
+       !res.TimedOut && (sett.Brackets <= 0 || bracket < sett.Brackets);
+       ++bracket) {
+    std::vector<clksyn::TreeSynthesisSettings> live{res.Best.Settings};
+    for (int32_t i = 1; i < sett.Candidates; ++i) {
+      auto cand = sett.Base;
+      cand.Alpha = logWeight();
+      cand.Beta = logWeight();
+      cand.Gamma = logWeight();
+      cand.Delta = delta();
+      live.push_back(cand);
+    }
+    runBracket(std::move(live));
+  }
+  return res;
+}
+
+} // namespace dme
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <limits>
 #include <map>
 #include <set>
 #include <vector>
@@ -13,9 +14,11 @@ constexpr const auto MAX_BOUND = std::numeric_limits<int64_t>::max();
 struct BlockageManager {
   BlockageManager() {}
 
-  void printStructure();
+  void printStructure() const;
   void insertBlockage(int64_t x1, int64_t y1, int64_t x2, int64_t y2);
-  int64_t getOverlapPerimeter(int64_t x1, int64_t y1, int64_t x2, int64_t y2);
+  // Read only, safe to call concurrently once all blockages are inserted.
+  int64_t getOverlapPerimeter(int64_t x1, int64_t y1, int64_t x2,
+                              int64_t y2) const;
 
 private:
   using interval_t = std::pair<int64_t, int64_t>;
@@ -24,7 +27,8 @@ private:
 };
 
 inline int64_t BlockageManager::getOverlapPerimeter(int64_t x1, int64_t y1,
-                                                    int64_t x2, int64_t y2) {
+                                                    int64_t x2,
+                                                    int64_t y2) const {
   // find the interval just larger than
   auto it = intervalsX_.upper_bound({x1, MAX_BOUND});
   if (it != intervalsX_.begin()) {
@@ -35,7 +39,7 @@ inline int64_t BlockageManager::getOverlapPerimeter(int64_t x1, int64_t y1,
 
   while (it != intervalsX_.end() && it->first <= x2) {
     auto [x1ref, x2ref] = *it;
-    auto &iY = intervalsXToY_[*(it++)];
+    const auto &iY = intervalsXToY_.at(*(it++));
     if (x2ref < x1) {
       continue;
     }
@@ -83,7 +87,7 @@ inline int64_t BlockageManager::getOverlapPerimeter(int64_t x1, int64_t y1,
   return res;
 }
 
-inline void BlockageManager::printStructure() {
+inline void BlockageManager::printStructure() const {
   for (auto [rxx, ryy] : intervalsXToY_) {
     std::cout << "(" << rxx.first << " " << rxx.second << ") -> ";
     for (auto yy : ryy) {
@@ -102,8 +106,6 @@ inline void BlockageManager::insertBlockage(int64_t x1, int64_t y1, int64_t x2,
     // overall and we need not do other reorganisation
     intervalsX_.insert({x1, x2});
     intervalsXToY_[{x1, x2}] = {{y1, y2}};
-    // @FIXME: remove this printout
-    printStructure();
     return;
   }
 
@@ -180,9 +182,6 @@ inline void BlockageManager::insertBlockage(int64_t x1, int64_t y1, int64_t x2,
     intervalsXToY_[rxx] = ryy;
     intervalsX_.insert(rxx);
   }
-
-  // @FIXME: remove this printout
-  printStructure();
 }
 
 } // end namespace clksyn
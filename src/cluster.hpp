@@ -0,0 +1,199 @@
+#pragma once
+
+#include "topology.hpp"
+
+#include <unordered_map>
+
+namespace clksyn {
+
+// Settings for grouping sinks that sit almost on top of each other.
+struct SinkClusterSettings {
+  // Sinks within this Manhattan distance (dbu) of the first sink of a
+  // group join it, so a group spans at most twice the radius. 0 leaves
+  // every sink on its own.
+  int64_t Radius = 0;
+  // Upper bound on the sinks per group.
+  int32_t MaxGroupSize = 16;
+};
+
+// Sinks grouped for topology generation. Each group gets a small local
+// subtree up front, and only one representative sink per group goes into
+// `getTopology`.
+struct SinkClusters {
+  // Positions into `inparams::sinks`, one vector per group.
+  std::vector<std::vector<int32_t>> Groups;
+  // Node that stands for each group: the sink itself for a group of one,
+  // the root of its local subtree otherwise.
+  std::vector<TreeNode> Roots;
+  // The local subtrees over the full design numbering: sink i is node
+  // i + 1, their internal nodes follow the sinks.
+  std::vector<TreeNode> Nodes;
+  std::vector<std::pair<int32_t, int32_t>> Edges;
+  // The design with sink g + 1 standing for group g, at the root of the
+  // group with its load.
+  inparams Reduced;
+};
+
+// Groups the sinks in input order on a hash grid with cells of `Radius`:
+// a sink joins the closest group seed within the radius that has room,
+// otherwise it seeds a group of its own. The sinks of a group are paired
+// closest first into a binary subtree, the same merge `getTopology` does,
+// so DME later embeds it zero skew like the rest of the tree.
+inline SinkClusters clusterSinks(const inparams &inp,
+                                 const SinkClusterSettings &sett) {
+  SinkClusters res;
+  auto numSinks = static_cast<int32_t>(inp.sinks.size());
+  auto radius = std::max<int64_t>(sett.Radius, 0);
+  auto cell = std::max<int64_t>(radius, 1);
+  auto cellOf = [&](int64_t v) {
+    return v >= 0 ? v / cell : -((cell - 1 - v) / cell);
+  };
+  auto key = [](int64_t cx, int64_t cy) {
+    return (cx << 32) ^ (cy & 0xffffffff);
+  };
+
+  // group seeds by cell
+  std::unordered_map<int64_t, std::vector<int32_t>> seeds;
+  for (int32_t i = 0; i < numSinks; ++i) {
+    const auto &pt = inp.sinks[i].cord;
+    auto cx = cellOf(pt.x), cy = cellOf(pt.y);
+    int32_t best = -1;
+    int64_t bestDist = radius + 1;
+    for (auto x = cx - 1; radius > 0 && x <= cx + 1; ++x) {
+      for (auto y = cy - 1; y <= cy + 1; ++y) {
+        auto it = seeds.find(key(x, y));
+        if (it == seeds.end()) {
+          continue;
+        }
+        for (auto g : it->second) {
+          const auto &seed = inp.sinks[res.Groups[g].front()].cord;
+          auto d = std::abs(seed.x - pt.x) + std::abs(seed.y - pt.y);
+          if (d < bestDist && static_cast<int32_t>(res.Groups[g].size()) <
+                                  std::max(sett.MaxGroupSize, 1)) {
+            best = g;
+            bestDist = d;
+          }
+        }
+      }
+    }
+    if (best == -1) {
+      best = static_cast<int32_t>(res.Groups.size());
+      res.Groups.emplace_back();
+      seeds[key(cx, cy)].push_back(best);
+    }
+    res.Groups[best].push_back(i);
+  }
+
+  double wireCap = 0;
+  if (!inp.wires.empty()) {
+    wireCap = std::min_element(inp.wires.begin(), inp.wires.end(),
+                               [](auto &&l, auto &&r) {
+                                 return l.cap < r.cap;
+                               })->cap;
+  }
+  for (int32_t i = 0; i < numSinks; ++i) {
+    const auto &s = inp.sinks[i];
+    res.Nodes.push_back(TreeNode{.Kind = TreeNode::SINK,
+                                 .Idx = i + 1,
+                                 .x = s.cord.x,
+                                 .y = s.cord.y,
+                                 .LdCap = static_cast<double>(s.cap)});
+  }
+
+  // closest pair first within every group, groups are small
+  auto nextIdx = numSinks + 1;
+  std::vector<TreeNode> active;
+  res.Reduced = inp;
+  res.Reduced.sinks.clear();
+  for (const auto &group : res.Groups) {
+    active.clear();
+    for (auto pos : group) {
+      active.push_back(res.Nodes[pos]);
+    }
+    while (active.size() > 1) {
+      size_t a = 0, b = 1;
+      auto bestDist = std::numeric_limits<int64_t>::max();
+      for (size_t i = 0; i < active.size(); ++i) {
+        for (auto j = i + 1; j < active.size(); ++j) {
+          auto d = std::abs(active[i].x - active[j].x) +
+                   std::abs(active[i].y - active[j].y);
+          if (d < bestDist) {
+            std::tie(a, b, bestDist) = std::tuple{i, j, d};
+          }
+        }
+      }
+      auto merged = NodePair{.Cost = 0, .A = active[a], .B = active[b]}
+                        .simpleMerge(nextIdx++, wireCap);
+      res.Nodes.push_back(merged);
+      res.Edges.push_back({merged.Idx, active[a].Idx});
+      res.Edges.push_back({merged.Idx, active[b].Idx});
+      active[a] = merged;
+      active.erase(active.begin() + b);
+    }
+    const auto &root = active.front();
+    res.Roots.push_back(root);
+    res.Reduced.sinks.push_back(
+        sink{.id = inp.sinks[group.front()].id,
+             .cord = point{.x = root.x, .y = root.y},
+             .cap = static_cast<int64_t>(std::llround(root.LdCap))});
+  }
+  return res;
+}
+
+// Topology over the full design from one over `clusters.Reduced`: every
+// representative sink is replaced by its group's subtree. Sinks keep their
+// input numbering, internal nodes of the groups come next, then those of
+// `reduced`.
+inline TopologyResult expandClusters(const inparams &inp,
+                                     const SinkClusters &clusters,
+                                     const TopologyResult &reduced) {
+  auto numGroups = static_cast<int32_t>(clusters.Groups.size());
+  auto offset = static_cast<int32_t>(clusters.Nodes.size()) - numGroups;
+  auto global = [&](int32_t idx) {
+    if (idx == 0) {
+      return 0;
+    }
+    return idx <= numGroups ? clusters.Roots[idx - 1].Idx : idx + offset;
+  };
+
+  TopologyResult res;
+  res.Nodes = clusters.Nodes;
+  res.Edges = clusters.Edges;
+  for (auto node : reduced.Nodes) {
+    if (node.Kind == TreeNode::INTERNAL) {
+      node.Idx = global(node.Idx);
+      res.Nodes.push_back(node);
+    } else if (node.Kind == TreeNode::SOURCE) {
+      res.Nodes.push_back(node);
+    }
+  }
+  for (const auto &[from, to] : reduced.Edges) {
+    res.Edges.push_back({global(from), global(to)});
+  }
+
+  for (size_t i = 0; i < inp.sinks.size(); ++i) {
+    res.Tags[static_cast<int32_t>(i + 1)] = inp.sinks[i].id;
+  }
+  if (auto it = reduced.Tags.find(0); it != reduced.Tags.end()) {
+    res.Tags[0] = it->second;
+  }
+  return res;
+}
+
+// `getTopology` on the group representatives only, expanded back to every
+// sink. On designs with dense clumps of sinks this cuts the nodes the
+// topology algorithm sees by the average group size.
+inline TopologyResult clusteredTopology(const inparams &inp,
+                                        const TreeSynthesisSettings &sett,
+                                        const SinkClusterSettings &clusterSett,
+                                        SinkClusters *clustersOut = nullptr) {
+  auto clusters = clusterSinks(inp, clusterSett);
+  auto reduced = TreeSynthesis(clusters.Reduced, sett).getTopology();
+  auto res = expandClusters(inp, clusters, reduced);
+  if (clustersOut != nullptr) {
+    *clustersOut = std::move(clusters);
+  }
+  return res;
+}
+
+} // end namespace clksyn
@@ -1,11 +1,18 @@
+#pragma once
+
 #include "parser.hpp"
+#include "threadpool.hpp"
 #include "topology.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
 #include <optional>
-#include <variant>
 #include <vector>
 
 namespace dme {
@@ -71,84 +78,131 @@ inline int64_t manhattanDistance(pt_t a, pt_t b) {
   return abs(a.x - b.x) + abs(a.y - b.y);
 }
 
-inline int64_t manhattanDistance(pt_t a, seg_t b) {
-  auto dx = b.first.x - b.second.x;
-  auto dy = b.first.y - b.second.y;
-  if (dx == 0 && dy == 0) {
-    return manhattanDistance(a, b.first);
+// Closest point to `src` on the segment from `a` to `b`. DME only produces
+// Manhattan arcs and axis-parallel segments, which are walked in unit
+// lattice steps. The distance along such a segment is convex and piecewise
+// linear, so the optimum is at an end or where the segment crosses the
+// horizontal or vertical line through `src`. Ties go to the step nearest
+// `a`.
+inline pt_t closestOnSegment(pt_t src, pt_t a, pt_t b) {
+  auto dx = b.x - a.x, dy = b.y - a.y;
+  auto n = std::max(std::abs(dx), std::abs(dy));
+  if (n == 0) {
+    return a;
   }
-  auto slopePt = pt_t{.x = 1, .y = dy / dx};
-
-  // @FIXME: brute forcing for now
-  // really bored of this and moving on
-  auto ans = std::numeric_limits<int64_t>::max();
-  for (pt_t x = b.first; x <= b.second; x = x + slopePt) {
-    ans = std::min(ans, manhattanDistance(a, x));
+  auto sx = dx / n, sy = dy / n;
+
+  const int64_t candidates[] = {0, n, (src.x - a.x) * sx, (src.y - a.y) * sy};
+  auto bestStep = n;
+  auto bestDist = std::numeric_limits<int64_t>::max();
+  for (auto step : candidates) {
+    step = std::clamp<int64_t>(step, 0, n);
+    auto dist = manhattanDistance(
+        src, pt_t{.x = a.x + step * sx, .y = a.y + step * sy});
+    if (dist < bestDist || (dist == bestDist && step < bestStep)) {
+      bestDist = dist;
+      bestStep = step;
+    }
   }
+  return pt_t{.x = a.x + bestStep * sx, .y = a.y + bestStep * sy};
+}
 
-  return ans;
+inline pt_t closestOnSegment(pt_t src, seg_t target) {
+  return closestOnSegment(src, target.first, target.second);
 }
 
-inline int64_t manhattanDistance(seg_t a, seg_t b) {
-  auto ans = std::numeric_limits<int64_t>::max();
-  ans = std::min(ans, manhattanDistance(a.first, b));
-  ans = std::min(ans, manhattanDistance(a.second, b));
-  ans = std::min(ans, manhattanDistance(b.first, a));
-  ans = std::min(ans, manhattanDistance(b.second, a));
-  return ans;
+inline int64_t manhattanDistance(pt_t a, seg_t b) {
+  return manhattanDistance(a, closestOnSegment(a, b));
 }
 
-// @FIXME: brute forcing here as well
-inline pt_t closestOnSegment(pt_t src, seg_t target) {
-  auto slope = target.getSlope();
-  if (slope != 1 && slope != -1) {
-    LogError("closestOnSegment function is only available for Manhattan Arcs");
-    return target.first;
-  }
-  auto slopePt = pt_t{.x = 1, .y = static_cast<int64_t>(slope)};
-  auto mnDist = std::numeric_limits<int64_t>::max();
-  pt_t retAns;
-  for (pt_t x = target.first; x <= target.second; x = x + slopePt) {
-    auto dist = manhattanDistance(src, x);
-    if (dist < mnDist) {
-      mnDist = dist;
-      retAns = x;
-    }
-  }
-  return retAns;
+inline int64_t manhattanDistance(seg_t a, seg_t b) {
+  return std::min(
+      {manhattanDistance(a.first, b), manhattanDistance(a.second, b),
+       manhattanDistance(b.first, a), manhattanDistance(b.second, a)});
 }
 
+// Merging segment of a DME node: a Manhattan arc, with a point being the
+// degenerate arc whose ends coincide. Ends are kept ordered so equal cores
+// compare equal. Plain data, nodes store it inline.
 struct DMECore {
-  enum { POINT, SEGMENT } Kind;
-  std::variant<pt_t, seg_t> Loc;
-
-  auto operator==(const DMECore &rhs) const {
-    if (Kind != rhs.Kind)
-      return false;
-    if (Kind == DMECore::POINT) {
-      return std::get<pt_t>(Loc) == std::get<pt_t>(rhs.Loc);
-    } else {
-      return std::get<seg_t>(Loc) == std::get<seg_t>(rhs.Loc);
-    }
-  }
+  pt_t First, Second;
+
+  auto operator<=>(const DMECore &) const = default;
+
+  bool isPoint() const { return First == Second; }
 
   std::string str() const {
-    return Kind == POINT ? ("Core={" + std::get<pt_t>(Loc).str() + "}")
-                         : ("Core={" + std::get<seg_t>(Loc).str() + "}");
+    return isPoint() ? ("Core={" + First.str() + "}")
+                     : ("Core={" + seg_t(First, Second).str() + "}");
   }
 };
 
-inline int64_t coreDistance(DMECore lhs, DMECore rhs) {
-  if (lhs.Kind == DMECore::POINT && rhs.Kind == DMECore::POINT) {
-    return manhattanDistance(std::get<pt_t>(lhs.Loc), std::get<pt_t>(rhs.Loc));
-  } else if (lhs.Kind == DMECore::POINT && rhs.Kind == DMECore::SEGMENT) {
-    return manhattanDistance(std::get<pt_t>(lhs.Loc), std::get<seg_t>(rhs.Loc));
-  } else if (lhs.Kind == DMECore::SEGMENT && rhs.Kind == DMECore::POINT) {
-    return manhattanDistance(std::get<pt_t>(rhs.Loc), std::get<seg_t>(lhs.Loc));
-  } else {
-    return manhattanDistance(std::get<seg_t>(lhs.Loc),
-                             std::get<seg_t>(rhs.Loc));
+inline DMECore makeCore(pt_t a, pt_t b) {
+  if (b < a) {
+    std::swap(a, b);
   }
+  return DMECore{.First = a, .Second = b};
+}
+
+inline DMECore makeCore(pt_t pt) { return DMECore{.First = pt, .Second = pt}; }
+
+inline pt_t closestOnSegment(pt_t src, const DMECore &core) {
+  return closestOnSegment(src, core.First, core.Second);
+}
+
+inline int64_t manhattanDistance(pt_t a, const DMECore &b) {
+  return manhattanDistance(a, closestOnSegment(a, b));
+}
+
+// Arcs of opposite slope can cross each other, possibly between lattice
+// points. Only proper crossings count, touching cores are at distance zero
+// through their end points anyway.
+inline bool coresCross(const DMECore &a, const DMECore &b) {
+  auto orient = [](pt_t p, pt_t q, pt_t r) {
+    auto v = (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x);
+    return (v > 0) - (v < 0);
+  };
+  return orient(a.First, a.Second, b.First) *
+                 orient(a.First, a.Second, b.Second) <
+             0 &&
+         orient(b.First, b.Second, a.First) *
+                 orient(b.First, b.Second, a.Second) <
+             0;
+}
+
+// Lattice point of `from` closest to `to`. The distance to a convex set is
+// convex along a segment, so a binary search over the steps finds it.
+inline pt_t closestToCore(const DMECore &from, const DMECore &to) {
+  auto dx = from.Second.x - from.First.x, dy = from.Second.y - from.First.y;
+  auto n = std::max(std::abs(dx), std::abs(dy));
+  if (n == 0) {
+    return from.First;
+  }
+  auto at = [&](int64_t step) {
+    return pt_t{.x = from.First.x + step * (dx / n),
+                .y = from.First.y + step * (dy / n)};
+  };
+  int64_t lo = 0, hi = n;
+  while (lo < hi) {
+    auto mid = lo + (hi - lo) / 2;
+    if (manhattanDistance(at(mid + 1), to) < manhattanDistance(at(mid), to)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return at(lo);
+}
+
+// Points need no special casing, both ends of a point core are the point.
+// Apart from crossings the minimum is attained at one of the end points.
+inline int64_t coreDistance(const DMECore &lhs, const DMECore &rhs) {
+  if (coresCross(lhs, rhs)) {
+    return manhattanDistance(closestToCore(lhs, rhs), rhs);
+  }
+  return std::min(
+      {manhattanDistance(lhs.First, rhs), manhattanDistance(lhs.Second, rhs),
+       manhattanDistance(rhs.First, lhs), manhattanDistance(rhs.Second, lhs)});
 }
 
 struct DMETiledRegion {
@@ -164,19 +218,11 @@ inline DMETiledRegion::DMETiledRegion(DMECore core, int64_t dist)
   auto moveY = pt_t{.x = 0, .y = dist};
   auto moveX = pt_t{.x = dist, .y = 0};
 
-  if (Core.Kind == DMECore::POINT) {
-    auto pt = std::get<pt_t>(Core.Loc);
-    Right = pt + moveX;
-    Left = pt - moveX;
-    Up = pt + moveY;
-    Down = pt - moveY;
-  } else {
-    auto [ptA, ptB] = std::get<seg_t>(Core.Loc);
-    Up = (ptA.y > ptB.y ? ptA : ptB) + moveY;
-    Down = (ptA.y < ptB.y ? ptA : ptB) - moveY;
-    Right = (ptA.x > ptB.x ? ptA : ptB) + moveX;
-    Left = (ptA.x < ptB.x ? ptA : ptB) - moveX;
-  }
+  auto ptA = Core.First, ptB = Core.Second;
+  Up = (ptA.y > ptB.y ? ptA : ptB) + moveY;
+  Down = (ptA.y < ptB.y ? ptA : ptB) - moveY;
+  Right = (ptA.x > ptB.x ? ptA : ptB) + moveX;
+  Left = (ptA.x < ptB.x ? ptA : ptB) - moveX;
 }
 
 inline std::optional<DMECore> getTRRIntersection(DMETiledRegion regA,
@@ -257,17 +303,7 @@ inline std::optional<DMECore> getTRRIntersection(DMETiledRegion regA,
         continue;
       }
       auto resVal = res.value();
-      if (resVal.first == resVal.second) {
-        return {DMECore{
-            .Kind = DMECore::POINT,
-            .Loc = resVal.first,
-        }};
-      } else {
-        return {DMECore{
-            .Kind = DMECore::SEGMENT,
-            .Loc = resVal,
-        }};
-      }
+      return makeCore(resVal.first, resVal.second);
     }
   }
   return {};
@@ -277,6 +313,14 @@ struct DMENode {
   DMECore Core;
   double LdCap = 0;
   double Delay = 0;
+  // Buffer cells driving this subtree from its tap point. LdCap and Delay
+  // are as seen at the input of the first cell.
+  int32_t Buffers = 0;
+  // Wire from the cells down to the subtree when no point of the merging
+  // segment was clear of blockages for them. Core is then the position of
+  // the cells and `Below` the tap point of the subtree.
+  int64_t Stub = 0;
+  pt_t Below{};
 
   std::string str() const;
 };
@@ -285,32 +329,131 @@ inline std::string DMENode::str() const {
   std::ostringstream oss;
   oss << "DMENode=[" << Core.str() << ", "
       << "LdCap=" << LdCap << ", "
-      << "Delay=" << Delay << "]";
+      << "Delay=" << Delay << ", "
+      << "Buffers=" << Buffers << ", "
+      << "Stub=" << Stub << "]";
   return oss.str();
 }
 
-inline DMENode merge(const DMENode &lhs, const DMENode &rhs, wire wr) {
-  auto d = coreDistance(lhs.Core, rhs.Core);
-  LogInfo("Merging: " + lhs.str() + " " + rhs.str());
-  if (d == 0) {
-    LogError("Intersecting cores. This won't end well!");
+// Library buffers are inverters, so a stage that keeps sink polarity
+// intact needs two of them.
+inline int32_t stageCells(const buffer &buf) { return buf.inverted ? 2 : 1; }
+
+// Drives a subtree through one buffer stage placed on its merging segment.
+// The stage delay and input capacitance are folded into the node, so merges
+// further up balance against the buffered delay.
+inline DMENode insertBuffer(const DMENode &node, const buffer &buf) {
+  auto cells = stageCells(buf);
+  auto delay = node.Delay + buf.resistance * (buf.out_cap + node.LdCap);
+  for (int32_t i = 1; i < cells; ++i) {
+    delay += buf.resistance * (buf.out_cap + buf.in_cap);
   }
+  return DMENode{.Core = node.Core,
+                 .LdCap = buf.in_cap,
+                 .Delay = delay,
+                 .Buffers = node.Buffers + cells};
+}
+
+// Elmore coefficients of a wire type. A wire of length L driving load C
+// has delay L * (R * C + HalfRC * L). Computed once per library entry so
+// comparing wire types during a merge is plain arithmetic.
+struct WireModel {
+  double R, C, HalfRC;
+
+  double delay(double len, double load) const {
+    return len * (R * load + HalfRC * len);
+  }
+};
 
+inline WireModel makeWireModel(const wire &wr) {
+  return WireModel{.R = wr.resistance,
+                   .C = wr.cap,
+                   .HalfRC = (double)wr.resistance * wr.cap / 2};
+}
+
+inline std::vector<WireModel> makeWireTable(const std::vector<wire> &wires) {
+  std::vector<WireModel> table;
+  std::transform(wires.begin(), wires.end(), std::back_inserter(table),
+                 makeWireModel);
+  return table;
+}
+
+// Zero-skew split of the wire between two subtrees: lengths of the wires
+// from the merge point to either side, and the resulting load and delay.
+// LenA + LenB exceeds the core distance when a side has to be snaked.
+struct MergeSplit {
+  int64_t LenA, LenB;
+  double LdCap, Delay;
+};
+
+// Length of wire that brings a subtree of delay `delay` and load `load` up
+// to `target` delay, i.e. the positive root of
+// HalfRC * L^2 + R * load * L - (target - delay) = 0.
+inline double balancingLength(double delay, double load, double target,
+                              const WireModel &wm) {
+  auto slack = std::max(target - delay, 0.);
+  if (wm.HalfRC == 0) {
+    return slack / (wm.R * load);
+  }
+  auto b = wm.R * load;
+  return (std::sqrt(b * b + 4 * wm.HalfRC * slack) - b) / (2 * wm.HalfRC);
+}
+
+inline MergeSplit splitMerge(const DMENode &lhs, const DMENode &rhs,
+                             int64_t d, const WireModel &wm) {
   auto del1 = lhs.Delay, del2 = rhs.Delay, c1 = lhs.LdCap, c2 = rhs.LdCap;
 
-  double eaDbl =
-      (double)((del2 - del1) + (double)(d * d * wr.resistance * wr.cap) / 2 +
-               d * wr.resistance * c2) /
-      (wr.resistance * ((double)c1 + c2 + d * wr.cap));
+  double eaDbl = ((del2 - del1) + wm.HalfRC * d * d + d * wm.R * c2) /
+                 (wm.R * (c1 + c2 + d * wm.C));
+
+  // The split point falls outside the two cores when one side is too slow
+  // for the direct wire to balance. Merge right at the slow side and snake
+  // the wire to the fast side until it catches up.
+  int64_t ea, eb;
+  if (eaDbl > d) {
+    ea = std::max<int64_t>(
+        d, std::llround(balancingLength(del1, c1, del2, wm)));
+    eb = 0;
+  } else if (eaDbl < 0) {
+    ea = 0;
+    eb = std::max<int64_t>(
+        d, std::llround(balancingLength(del2, c2, del1, wm)));
+  } else {
+    ea = static_cast<int64_t>(eaDbl);
+    eb = d - ea;
+  }
+
+  auto delay1 = del1 + wm.delay(ea, c1);
+  auto delay2 = del2 + wm.delay(eb, c2);
+
+  return MergeSplit{.LenA = ea,
+                    .LenB = eb,
+                    .LdCap = c1 + c2 + (ea + eb) * wm.C,
+                    .Delay = std::max(delay1, delay2)};
+}
 
-  eaDbl = std::max(eaDbl, 0.);
-  eaDbl = std::min(eaDbl, (double)d);
+inline DMENode merge(const DMENode &lhs, const DMENode &rhs,
+                     const MergeSplit &split) {
+  if (split.LenA + split.LenB == 0) {
+    LogError("Intersecting cores. This won't end well!");
+  }
 
-  int64_t ea = static_cast<int64_t>(eaDbl);
-  auto eb = d - ea;
+  // Snaked wire does not move the merge point, the TRRs only cover the
+  // part of each edge that spans the core distance.
+  auto d = coreDistance(lhs.Core, rhs.Core);
 
-  auto trrLhs = DMETiledRegion(lhs.Core, ea);
-  auto trrRhs = DMETiledRegion(rhs.Core, eb);
+  // Crossing cores are at most one step apart, which leaves the TRR
+  // boundaries without an overlap to intersect. Merge at the crossing.
+  if (coresCross(lhs.Core, rhs.Core)) {
+    auto onLhs = closestToCore(lhs.Core, rhs.Core);
+    auto tap = std::min(split.LenA, d) == 0
+                   ? onLhs
+                   : closestOnSegment(onLhs, rhs.Core);
+    return DMENode{
+        .Core = makeCore(tap), .LdCap = split.LdCap, .Delay = split.Delay};
+  }
+  auto trrLhs = DMETiledRegion(lhs.Core, std::min(split.LenA, d));
+  auto trrRhs = DMETiledRegion(rhs.Core, std::min(split.LenB, d));
 
   auto intersection = getTRRIntersection(trrLhs, trrRhs);
   if (!intersection.has_value()) {
@@ -319,132 +462,724 @@ inline DMENode merge(const DMENode &lhs, const DMENode &rhs, wire wr) {
     std::terminate();
   }
 
-  auto delay1 = del1 + ea * wr.resistance * ((double)ea * wr.cap / 2 + c1);
-  auto delay2 = del2 + eb * wr.resistance * ((double)eb * wr.cap / 2 + c2);
-
   return DMENode{.Core = intersection.value(),
-                 .Delay = std::max(delay1, delay2),
-                 .LdCap = lhs.LdCap + rhs.LdCap + d * wr.cap};
+                 .LdCap = split.LdCap,
+                 .Delay = split.Delay};
+}
+
+inline DMENode merge(const DMENode &lhs, const DMENode &rhs, wire wr) {
+  auto d = coreDistance(lhs.Core, rhs.Core);
+  return merge(lhs, rhs, splitMerge(lhs, rhs, d, makeWireModel(wr)));
+}
+
+// Picks the wire type for both edges of a merge by minimising
+// `Delay + capWeight * LdCap` of the merged node. Low-RC wire wins on long,
+// heavily loaded trunk edges where the delay term dominates; the lowest-cap
+// wire wins near the leaves.
+inline int32_t selectWire(const DMENode &lhs, const DMENode &rhs,
+                          const std::vector<WireModel> &table,
+                          double capWeight) {
+  auto d = coreDistance(lhs.Core, rhs.Core);
+  int32_t best = 0;
+  auto bestCost = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < table.size(); ++i) {
+    auto split = splitMerge(lhs, rhs, d, table[i]);
+    auto cost = split.Delay + capWeight * split.LdCap;
+    if (cost < bestCost) {
+      bestCost = cost;
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Whether a cell at `pt` overlaps a blockage. The contest checker counts
+// the sides of a blockage as part of it.
+inline bool onBlockage(pt_t pt, const std::vector<Blockage> &blockages) {
+  return std::any_of(blockages.begin(), blockages.end(), [&](auto &&b) {
+    return b.x1 <= pt.x && pt.x <= b.x2 && b.y1 <= pt.y && pt.y <= b.y2;
+  });
+}
+
+// The run of lattice points of `core` clear of blockages that is nearest
+// the middle of the core, if there is one.
+inline std::optional<DMECore>
+clearCore(const DMECore &core, const std::vector<Blockage> &blockages) {
+  auto dx = core.Second.x - core.First.x, dy = core.Second.y - core.First.y;
+  auto n = std::max(std::abs(dx), std::abs(dy));
+  auto sx = n == 0 ? 0 : dx / n, sy = n == 0 ? 0 : dy / n;
+  auto at = [&](int64_t step) {
+    return pt_t{.x = core.First.x + step * sx, .y = core.First.y + step * sy};
+  };
+  // steps with the coordinate in [lo, hi], the step sign is at most 1
+  auto steps = [&](int64_t from, int64_t sign, int64_t lo, int64_t hi) {
+    if (sign == 0) {
+      return lo <= from && from <= hi ? std::pair<int64_t, int64_t>{0, n}
+                                      : std::pair<int64_t, int64_t>{1, 0};
+    }
+    auto a = (lo - from) * sign, b = (hi - from) * sign;
+    return std::pair{std::min(a, b), std::max(a, b)};
+  };
+
+  std::vector<std::pair<int64_t, int64_t>> blocked;
+  for (const auto &b : blockages) {
+    auto [xLo, xHi] = steps(core.First.x, sx, b.x1, b.x2);
+    auto [yLo, yHi] = steps(core.First.y, sy, b.y1, b.y2);
+    auto lo = std::max({xLo, yLo, int64_t{0}});
+    auto hi = std::min({xHi, yHi, n});
+    if (lo <= hi) {
+      blocked.push_back({lo, hi});
+    }
+  }
+  std::sort(blocked.begin(), blocked.end());
+
+  auto mid = n / 2;
+  std::optional<std::pair<int64_t, int64_t>> best;
+  auto bestDist = std::numeric_limits<int64_t>::max();
+  auto offer = [&](int64_t lo, int64_t hi) {
+    if (lo > hi) {
+      return;
+    }
+    auto dist = mid < lo ? lo - mid : (mid > hi ? mid - hi : 0);
+    if (dist < bestDist) {
+      bestDist = dist;
+      best = {lo, hi};
+    }
+  };
+  int64_t next = 0;
+  for (auto [lo, hi] : blocked) {
+    offer(next, lo - 1);
+    next = std::max(next, hi + 1);
+  }
+  offer(next, n);
+  if (!best) {
+    return std::nullopt;
+  }
+  return makeCore(at(best->first), at(best->second));
+}
+
+// Point clear of blockages closest to `pt`, among those just outside a
+// blockage side in line with `pt` and just outside blockage corners.
+// `pt` itself if it is clear or no such point is.
+inline pt_t clearPoint(pt_t pt, const std::vector<Blockage> &blockages) {
+  if (!onBlockage(pt, blockages)) {
+    return pt;
+  }
+  auto best = pt;
+  auto bestDist = std::numeric_limits<int64_t>::max();
+  auto offer = [&](int64_t x, int64_t y) {
+    auto cand = pt_t{.x = x, .y = y};
+    auto dist = manhattanDistance(pt, cand);
+    if (dist < bestDist && !onBlockage(cand, blockages)) {
+      bestDist = dist;
+      best = cand;
+    }
+  };
+  for (const auto &b : blockages) {
+    offer(b.x1 - 1, pt.y);
+    offer(b.x2 + 1, pt.y);
+    offer(pt.x, b.y1 - 1);
+    offer(pt.x, b.y2 + 1);
+    for (auto x : {b.x1 - 1, b.x2 + 1}) {
+      for (auto y : {b.y1 - 1, b.y2 + 1}) {
+        offer(x, y);
+      }
+    }
+  }
+  return best;
 }
 
-using EmbeddingResult = clksyn::TopologyResult;
+// `insertBuffer` with the cells clear of `blockages`: on the clear part of
+// the merging segment nearest its middle, or, when the whole segment is
+// blocked, on the clear point nearest to it with a stub of wire `wr` down
+// to the segment. The stub's delay and load are folded in with the stage.
+inline DMENode insertBuffer(const DMENode &node, const buffer &buf,
+                            const wire &wr,
+                            const std::vector<Blockage> &blockages) {
+  if (auto clear = clearCore(node.Core, blockages)) {
+    auto res = insertBuffer(node, buf);
+    res.Core = *clear;
+    return res;
+  }
+
+  auto below = node.Core.First, at = clearPoint(below, blockages);
+  for (auto end : {node.Core.Second,
+                   closestOnSegment(
+                       pt_t{.x = (node.Core.First.x + node.Core.Second.x) / 2,
+                            .y = (node.Core.First.y + node.Core.Second.y) / 2},
+                       node.Core)}) {
+    auto cand = clearPoint(end, blockages);
+    if (manhattanDistance(end, cand) < manhattanDistance(below, at)) {
+      below = end;
+      at = cand;
+    }
+  }
+  auto len = manhattanDistance(below, at);
+  auto wm = makeWireModel(wr);
+  auto stubbed = node;
+  stubbed.Delay += wm.delay(len, node.LdCap);
+  stubbed.LdCap += len * wm.C;
+  auto res = insertBuffer(stubbed, buf);
+  res.Core = makeCore(at);
+  res.Stub = len;
+  res.Below = below;
+  return res;
+}
+
+// Position of `node` below a parent at `parent`: its tap point, or the end
+// of the stub when its buffers sit off the merging segment.
+inline pt_t tapPoint(pt_t parent, const DMENode &node) {
+  return node.Stub > 0 ? node.Below : closestOnSegment(parent, node.Core);
+}
+
+// Keeps the downstream capacitance of a merge within `capBudget`. While the
+// merged load would cross the budget, the heavier unbuffered subtree gets a
+// buffer stage on its own merging segment, clear of `blockages`. The
+// subtrees are updated in place so the caller can emit the buffers.
+inline void bufferToBudget(DMENode &lhs, DMENode &rhs, wire wr,
+                           const buffer &buf, double capBudget,
+                           const std::vector<Blockage> &blockages) {
+  auto wm = makeWireModel(wr);
+  // includes any wire snaked to balance a freshly buffered side
+  auto mergedCap = [&] {
+    return splitMerge(lhs, rhs, coreDistance(lhs.Core, rhs.Core), wm).LdCap;
+  };
+
+  auto kids = lhs.LdCap < rhs.LdCap ? std::pair{&rhs, &lhs}
+                                    : std::pair{&lhs, &rhs};
+  for (auto *kid : {kids.first, kids.second}) {
+    if (mergedCap() <= capBudget) {
+      break;
+    }
+    if (kid->Buffers == 0 && kid->LdCap > buf.in_cap) {
+      *kid = insertBuffer(*kid, buf, wr, blockages);
+    }
+  }
+}
+
+inline DMENode mergeBuffered(DMENode &lhs, DMENode &rhs, wire wr,
+                             const buffer &buf, double capBudget,
+                             const std::vector<Blockage> &blockages) {
+  bufferToBudget(lhs, rhs, wr, buf, capBudget, blockages);
+  return merge(lhs, rhs, wr);
+}
+
+// Settings for the embedding stage. Without buffering the result is the
+// plain zero-skew DME tree.
+struct EmbeddingSettings {
+  bool Buffered = false;
+  // Subtrees are buffered once the merged downstream capacitance would
+  // cross this fraction of `simulation::cap_limit`.
+  double CapBudget = 0.9;
+  // Index into `inparams::buffers`, -1 picks the lowest output resistance.
+  int32_t BufferType = -1;
+  // Index into `inparams::wires` used for every edge, -1 selects the wire
+  // per merge (see `selectWire`).
+  int32_t WireType = -1;
+  // Exchange rate between delay and capacitance (fs per fF) used when
+  // selecting wires.
+  double WireCapWeight = 1000;
+  // Worker threads for the DME passes, subtrees of at most `TaskCutoff`
+  // nodes are embedded serially inside a single task.
+  int32_t Threads = 1;
+  int32_t TaskCutoff = 4096;
+};
+
+// Buffer type used for the embedding, -1 if buffering is off.
+inline int32_t selectBuffer(const inparams &inp,
+                            const EmbeddingSettings &sett) {
+  if (!sett.Buffered || inp.buffers.empty()) {
+    return -1;
+  }
+  if (sett.BufferType >= 0 &&
+      static_cast<size_t>(sett.BufferType) < inp.buffers.size()) {
+    return sett.BufferType;
+  }
+  auto strongest = std::min_element(
+      inp.buffers.begin(), inp.buffers.end(),
+      [](auto &&l, auto &&r) { return l.resistance < r.resistance; });
+  return std::distance(inp.buffers.begin(), strongest);
+}
+
+// One merge of the bottom-up pass: picks the wire, buffers either side to
+// the capacitance budget (`buffer` -1 for none) and splits the wire for
+// zero skew. `lhs` and `rhs` come back with the buffers driving them.
+struct MergeStep {
+  DMENode Node;
+  int32_t Wire = 0;
+  int64_t LenA = 0, LenB = 0;
+};
+
+inline MergeStep mergeStep(DMENode &lhs, DMENode &rhs, const inparams &inp,
+                           const std::vector<WireModel> &table,
+                           const EmbeddingSettings &sett, int32_t buffer) {
+  auto wireIdx = sett.WireType;
+  if (wireIdx < 0 || static_cast<size_t>(wireIdx) >= table.size()) {
+    wireIdx = selectWire(lhs, rhs, table, sett.WireCapWeight);
+  }
+  if (buffer != -1) {
+    bufferToBudget(lhs, rhs, inp.wires[wireIdx], inp.buffers[buffer],
+                   sett.CapBudget * inp.smul.cap_limit, inp.blockages);
+  }
+  auto split =
+      splitMerge(lhs, rhs, coreDistance(lhs.Core, rhs.Core), table[wireIdx]);
+  return MergeStep{.Node = merge(lhs, rhs, split),
+                   .Wire = wireIdx,
+                   .LenA = split.LenA,
+                   .LenB = split.LenB};
+}
+
+// Wire type of the source edge. The edge is common to all sinks, so only
+// its own delay and capacitance matter.
+inline int32_t selectSourceWire(int64_t len, double load,
+                                const std::vector<WireModel> &table,
+                                const EmbeddingSettings &sett) {
+  if (sett.WireType >= 0 &&
+      static_cast<size_t>(sett.WireType) < table.size()) {
+    return sett.WireType;
+  }
+  auto cost = [&](const WireModel &wm) {
+    return wm.delay(len, load) + sett.WireCapWeight * len * wm.C;
+  };
+  return std::distance(table.begin(),
+                       std::min_element(table.begin(), table.end(),
+                                        [&](auto &&l, auto &&r) {
+                                          return cost(l) < cost(r);
+                                        }));
+}
+
+// Describes the connection from a node up to its parent.
+struct EmbeddedEdge {
+  // Index into `inparams::wires`.
+  int32_t Wire = 0;
+  // Electrical length of the wire. When it exceeds the distance between
+  // the end points the difference is routed as a detour.
+  int64_t Length = 0;
+  // Buffer cells chained at the child end of the wire.
+  int32_t Buffers = 0;
+  // Wire from the last cell down to the node when the cells sit at
+  // `BufferAt` to clear a blockage (see `DMENode::Stub`).
+  int64_t Stub = 0;
+  pt_t BufferAt{};
+};
+
+// The edge down into `node` over `len` of wire `wire`, with the buffers
+// that drive the node.
+inline EmbeddedEdge edgeInto(const DMENode &node, int32_t wire,
+                             int64_t len) {
+  return EmbeddedEdge{.Wire = wire,
+                      .Length = len,
+                      .Buffers = node.Buffers,
+                      .Stub = node.Stub,
+                      .BufferAt = node.Core.First};
+}
+
+// Topology with every node moved to its tap point, plus per-node data for
+// the edge to its parent (indexed by node Idx).
+struct EmbeddingResult {
+  clksyn::TopologyResult Topology;
+  std::vector<EmbeddedEdge> Edges;
+  int32_t BufferType = 0;
+  // Merging segment, load and delay at the root, below the source edge.
+  DMENode Root;
+  // Bend points of routed edges from the parent on, by child Idx. Edges
+  // without an entry are written as a single wire.
+  std::map<int32_t, std::vector<pt_t>> Routes;
+
+  // Wire and buffer types are written as their library codes.
+  outparams toOutParam(const inparams &inp) const;
+};
+
+inline outparams EmbeddingResult::toOutParam(const inparams &inp) const {
+  auto res = Topology.toOutParam(inp);
+  res.wires.clear();
+  auto wireType = [&](int32_t wire) {
+    return static_cast<size_t>(wire) < inp.wires.size()
+               ? inp.wires[wire].type
+               : std::to_string(wire);
+  };
+  auto bufferType = static_cast<size_t>(BufferType) < inp.buffers.size()
+                        ? inp.buffers[BufferType].id
+                        : std::to_string(BufferType);
+
+  std::map<int32_t, point> location;
+  int32_t nextIdx = 0;
+  for (const auto &node : Topology.Nodes) {
+    location[node.Idx] = point{.x = node.x, .y = node.y};
+    nextIdx = std::max(nextIdx, node.Idx + 1);
+  }
+
+  for (const auto &[from, to] : Topology.Edges) {
+    auto wireTo = to;
+    auto edge = static_cast<size_t>(to) < Edges.size() ? Edges[to]
+                                                       : EmbeddedEdge{};
+    auto cells = edge.Buffers;
+    // where the wire from the parent ends
+    auto end = location[to];
+    if (cells > 0 && edge.Stub > 0) {
+      end = point{.x = edge.BufferAt.x, .y = edge.BufferAt.y};
+    }
+    auto wireFrom = from;
+    auto fromPt = location[from];
+    auto snake = edge.Length;
+    if (auto route = Routes.find(to); route != Routes.end()) {
+      for (auto bend : route->second) {
+        auto bendIdx = nextIdx++;
+        res.nodes.push_back(out_node{.name = std::to_string(bendIdx),
+                                     .pt = point{.x = bend.x, .y = bend.y}});
+        res.wires.push_back(out_wire{.from = std::to_string(wireFrom),
+                                     .to = std::to_string(bendIdx),
+                                     .type = wireType(edge.Wire)});
+        snake -= std::abs(fromPt.x - bend.x) + std::abs(fromPt.y - bend.y);
+        wireFrom = bendIdx;
+        fromPt = point{.x = bend.x, .y = bend.y};
+      }
+    }
+    snake -= std::abs(fromPt.x - end.x) + std::abs(fromPt.y - end.y);
+    if (snake > 1) {
+      // Detour through a point pushed away from the parent, which adds
+      // twice the offset to the Manhattan length. `routeEdges` records a
+      // detour clear of the blockages with the bends instead.
+      auto detour = end;
+      auto offset = snake / 2;
+      if (fromPt.y != end.y) {
+        detour.y += fromPt.y < end.y ? offset : -offset;
+      } else {
+        detour.x += fromPt.x < end.x ? offset : -offset;
+      }
+      auto detourIdx = nextIdx++;
+      res.nodes.push_back(
+          out_node{.name = std::to_string(detourIdx), .pt = detour});
+      res.wires.push_back(out_wire{.from = std::to_string(wireFrom),
+                                   .to = std::to_string(detourIdx),
+                                   .type = wireType(edge.Wire)});
+      wireFrom = detourIdx;
+    }
+    if (cells > 0) {
+      // Buffers sit at the tap point of `to`, or at the top of its stub,
+      // and the wire from the parent lands on the input of the first cell.
+      wireTo = nextIdx++;
+      res.nodes.push_back(out_node{.name = std::to_string(wireTo), .pt = end});
+      auto in = wireTo;
+      for (int32_t i = 0; i < cells; ++i) {
+        auto out = i + 1 == cells && edge.Stub == 0 ? to : nextIdx++;
+        if (out != to) {
+          res.nodes.push_back(out_node{.name = std::to_string(out), .pt = end});
+        }
+        res.buffers.push_back(out_buffer{.from = std::to_string(in),
+                                         .to = std::to_string(out),
+                                         .type = bufferType});
+        in = out;
+      }
+      if (edge.Stub > 0) {
+        res.wires.push_back(out_wire{.from = std::to_string(in),
+                                     .to = std::to_string(to),
+                                     .type = wireType(edge.Wire)});
+      }
+    }
+    res.wires.push_back(out_wire{.from = std::to_string(wireFrom),
+                                 .to = std::to_string(wireTo),
+                                 .type = wireType(edge.Wire)});
+  }
+
+  return res;
+}
 
 struct EmbeddingManager {
-  EmbeddingManager(inparams, clksyn::TopologyResult);
+  EmbeddingManager(inparams, clksyn::TopologyResult, EmbeddingSettings = {});
 
   EmbeddingResult computeEmbedding();
 
+  // The two passes of `computeEmbedding` on their own, so that the tree
+  // can be hung below a parent that is only known later. `mergingTree`
+  // returns the root's merging segment, `embedFrom` places the root
+  // closest to `parent`.
+  DMENode mergingTree();
+  EmbeddingResult embedFrom(pt_t parent);
+
+  // Treats sink `idx` as a prebuilt subtree, e.g. the root of a cluster
+  // embedded separately. Must be called before `mergingTree`.
+  void setLeaf(int32_t idx, const DMENode &node) { leaves_[idx] = node; }
+
 private:
-  void dfs(int32_t nodeIdx, int32_t parentIdx);
-  void finalise(int32_t nodeIdx, int32_t parentIdx);
+  int32_t kidsBegin(int32_t slot) const { return kidStart_[slot]; }
+  int32_t kidsEnd(int32_t slot) const { return kidStart_[slot + 1]; }
+
+  void dfs(clksyn::ThreadPool *pool);
+  void finalise(clksyn::ThreadPool *pool);
+  clksyn::ThreadPool *pool();
+  void mergeNode(int32_t slot);
+  void placeNode(int32_t slot);
 
   inparams inp_;
-  wire wire_;
+  EmbeddingSettings sett_;
+  std::vector<WireModel> wireTable_;
+  int32_t buffer_ = -1;
   clksyn::TopologyResult topology_;
-  std::vector<std::vector<int32_t>> adj_;
+  pt_t source_;
+  // point the root connects to, the source unless embedded from elsewhere
+  pt_t rootParent_;
+  std::map<int32_t, DMENode> leaves_;
+  std::unique_ptr<clksyn::ThreadPool> pool_;
+
+  // Nodes below the source are stored by their post-order position
+  // ("slot"), so the subtree of slot s is the contiguous range
+  // [first_[s], s] of every per-node array.
+  std::vector<int32_t> postOrder_;
+  std::vector<int32_t> first_;
+  // Children in CSR form: kids of slot s are
+  // kids_[kidStart_[s]] .. kids_[kidStart_[s + 1] - 1], parent_ is -1
+  // for the root.
+  std::vector<int32_t> kidStart_;
+  std::vector<int32_t> kids_;
+  std::vector<int32_t> parent_;
+
+  // Subtrees of at most `TaskCutoff` nodes handed out as parallel tasks,
+  // and the remaining nodes above them in post order.
+  std::vector<int32_t> taskRoots_;
+  std::vector<int32_t> topSlots_;
+
   std::vector<clksyn::TreeNode> topoNodes_;
   std::vector<DMENode> nodes_;
+  std::vector<EmbeddedEdge> edges_;
 };
 
 inline EmbeddingManager::EmbeddingManager(inparams inp,
-                                          clksyn::TopologyResult res)
-    : inp_(inp), topology_(res) {
-  // @TODO
-  // going to use a random wire for now
-  // ideally we may want to pick the one that gives least delay
-  wire_ = inp_.wires.back();
+                                          clksyn::TopologyResult res,
+                                          EmbeddingSettings sett)
+    : inp_(inp), sett_(sett), topology_(std::move(res)) {
+  wireTable_ = makeWireTable(inp_.wires);
+
+  buffer_ = selectBuffer(inp_, sett_);
+
+  // Index-space scratch for building the slot arrays, released wholesale
+  // once they are built.
+  auto numIdx = topology_.Nodes.size() + 1;
+  std::pmr::monotonic_buffer_resource scratch(
+      numIdx * (sizeof(void *) + 4 * sizeof(int32_t)) +
+      topology_.Edges.size() * sizeof(int32_t));
+  std::pmr::vector<const clksyn::TreeNode *> byIdx(numIdx, nullptr, &scratch);
+  for (const auto &node : topology_.Nodes) {
+    byIdx[node.Idx] = &node;
+  }
+  source_ = pt_t{.x = byIdx[0]->x, .y = byIdx[0]->y};
+
+  // Edges always point from parent to child.
+  std::pmr::vector<int32_t> idxStart(numIdx + 1, 0, &scratch);
+  std::pmr::vector<int32_t> idxKids(topology_.Edges.size(), &scratch);
+  for (const auto &[from, to] : topology_.Edges) {
+    ++idxStart[from + 1];
+  }
+  std::partial_sum(idxStart.begin(), idxStart.end(), idxStart.begin());
+  std::pmr::vector<int32_t> fill(idxStart, &scratch);
+  for (const auto &[from, to] : topology_.Edges) {
+    idxKids[fill[from]++] = to;
+  }
 
-  adj_.resize(res.Nodes.size() + 1);
-  for (const auto &edge : res.Edges) {
-    adj_[edge.first].push_back(edge.second);
-    adj_[edge.second].push_back(edge.first);
+  // Explicit stack instead of recursion, NNA can produce very deep chains.
+  // 0 is SRC
+  postOrder_.reserve(numIdx);
+  std::pmr::vector<std::pair<int32_t, int32_t>> stack(&scratch);
+  if (idxStart[1] > idxStart[0]) {
+    auto root = idxKids[idxStart[1] - 1];
+    stack.push_back({root, idxStart[root]});
+  }
+  while (!stack.empty()) {
+    auto &[nodeIdx, next] = stack.back();
+    if (next < idxStart[nodeIdx + 1]) {
+      auto kid = idxKids[next++];
+      stack.push_back({kid, idxStart[kid]});
+    } else {
+      postOrder_.push_back(nodeIdx);
+      stack.pop_back();
+    }
   }
 
-  topoNodes_.resize(res.Nodes.size() + 1);
-  for (const auto &node : res.Nodes) {
-    topoNodes_[node.Idx] = node;
+  auto numSlots = static_cast<int32_t>(postOrder_.size());
+  std::pmr::vector<int32_t> slotOf(numIdx, -1, &scratch);
+  for (int32_t slot = 0; slot < numSlots; ++slot) {
+    slotOf[postOrder_[slot]] = slot;
   }
 
-  nodes_.resize(res.Nodes.size() + 1);
+  kidStart_.assign(numSlots + 1, 0);
+  kids_.reserve(numSlots);
+  parent_.assign(numSlots, -1);
+  first_.resize(numSlots);
+  topoNodes_.resize(numSlots);
+  for (int32_t slot = 0; slot < numSlots; ++slot) {
+    auto nodeIdx = postOrder_[slot];
+    topoNodes_[slot] = *byIdx[nodeIdx];
+    first_[slot] = slot;
+    for (auto k = idxStart[nodeIdx]; k < idxStart[nodeIdx + 1]; ++k) {
+      auto kid = slotOf[idxKids[k]];
+      kids_.push_back(kid);
+      parent_[kid] = slot;
+      first_[slot] = std::min(first_[slot], first_[kid]);
+    }
+    kidStart_[slot + 1] = kids_.size();
+  }
 
-  // @FIXME: remove this printout
-  for (size_t i = 0; i < adj_.size(); ++i) {
-    std::cout << i << " " << adj_[i].size() << ": ";
-    for (auto j : adj_[i]) {
-      std::cout << j << ' ';
+  auto cutoff = std::max(sett_.TaskCutoff, 1);
+  auto subtreeSize = [&](int32_t slot) { return slot - first_[slot] + 1; };
+  for (int32_t slot = 0; slot < numSlots; ++slot) {
+    if (subtreeSize(slot) > cutoff) {
+      topSlots_.push_back(slot);
+    } else if (parent_[slot] == -1 || subtreeSize(parent_[slot]) > cutoff) {
+      taskRoots_.push_back(slot);
     }
-    std::cout << std::endl;
   }
+  // hand out the big ones first, stealing evens out the tail
+  std::sort(taskRoots_.begin(), taskRoots_.end(), [&](auto &&l, auto &&r) {
+    return subtreeSize(l) > subtreeSize(r);
+  });
+
+  nodes_.resize(numSlots);
+  edges_.resize(numSlots);
 }
 
-inline void EmbeddingManager::dfs(int32_t nodeIdx, int32_t parentIdx) {
-  int32_t kidOne = -1, kidTwo = -1;
+// Bottom-up pass computing merging segments, children before parents.
+// Task subtrees only touch their own slot range, so they run without
+// synchronisation; the nodes above them follow serially.
+inline void EmbeddingManager::dfs(clksyn::ThreadPool *pool) {
+  if (pool == nullptr) {
+    for (int32_t slot = 0; slot < static_cast<int32_t>(nodes_.size());
+         ++slot) {
+      mergeNode(slot);
+    }
+    return;
+  }
+
+  {
+    clksyn::TaskGroup group(*pool);
+    for (auto root : taskRoots_) {
+      group.run([this, root] {
+        for (auto slot = first_[root]; slot <= root; ++slot) {
+          mergeNode(slot);
+        }
+      });
+    }
+  }
+  for (auto slot : topSlots_) {
+    mergeNode(slot);
+  }
+}
 
-  for (const auto &idx : adj_[nodeIdx]) {
-    if (idx == parentIdx) {
-      continue;
+// Top-down pass fixing tap points, parents before children.
+inline void EmbeddingManager::finalise(clksyn::ThreadPool *pool) {
+  if (pool == nullptr) {
+    for (auto slot = static_cast<int32_t>(nodes_.size()) - 1; slot >= 0;
+         --slot) {
+      placeNode(slot);
     }
-    kidTwo = kidOne;
-    kidOne = idx;
-    dfs(idx, nodeIdx);
+    return;
+  }
+
+  for (auto it = topSlots_.rbegin(); it != topSlots_.rend(); ++it) {
+    placeNode(*it);
   }
+  clksyn::TaskGroup group(*pool);
+  for (auto root : taskRoots_) {
+    group.run([this, root] {
+      for (auto slot = root; slot >= first_[root]; --slot) {
+        placeNode(slot);
+      }
+    });
+  }
+}
 
-  if (kidOne == -1 && kidTwo != -1) {
+inline void EmbeddingManager::mergeNode(int32_t slot) {
+  auto numKids = kidsEnd(slot) - kidsBegin(slot);
+  if (numKids == 1) {
     // single child
     LogError("Unexpected single child in binary tree.");
   }
 
-  const auto &topoNode = topoNodes_[nodeIdx];
-  if (kidOne == -1) {
+  const auto &topoNode = topoNodes_[slot];
+  if (auto leaf = leaves_.find(postOrder_[slot]); leaf != leaves_.end()) {
+    nodes_[slot] = leaf->second;
+  } else if (numKids == 0) {
     // no kids, leaf node
-    nodes_[nodeIdx] = DMENode{
-        .Core = DMECore{.Kind = DMECore::POINT,
-                        .Loc = pt_t{.x = topoNode.x, .y = topoNode.y}},
-        .Delay = 0,
+    nodes_[slot] = DMENode{
+        .Core = makeCore(pt_t{.x = topoNode.x, .y = topoNode.y}),
         .LdCap = topoNode.LdCap,
+        .Delay = 0,
     };
   } else {
-    nodes_[nodeIdx] = merge(nodes_[kidOne], nodes_[kidTwo], wire_);
+    auto kidOne = kids_[kidsEnd(slot) - 1];
+    auto kidTwo = kids_[kidsEnd(slot) - 2];
+    auto step = mergeStep(nodes_[kidOne], nodes_[kidTwo], inp_, wireTable_,
+                          sett_, buffer_);
+    edges_[kidOne].Wire = edges_[kidTwo].Wire = step.Wire;
+    edges_[kidOne].Length = step.LenA;
+    edges_[kidTwo].Length = step.LenB;
+    nodes_[slot] = step.Node;
   }
 }
 
-inline void EmbeddingManager::finalise(int32_t nodeIdx, int32_t parentIdx) {
-  const auto &node = nodes_[nodeIdx];
-  pt_t tap;
-  if (node.Core.Kind == DMECore::POINT) {
-    tap = std::get<pt_t>(node.Core.Loc);
-  } else if (node.Core.Kind == DMECore::SEGMENT) {
-    tap = closestOnSegment({topoNodes_[parentIdx].x, topoNodes_[parentIdx].y},
-                           std::get<seg_t>(node.Core.Loc));
+inline void EmbeddingManager::placeNode(int32_t slot) {
+  const auto &node = nodes_[slot];
+  auto parent = rootParent_;
+  if (parent_[slot] != -1) {
+    parent = pt_t{.x = topoNodes_[parent_[slot]].x,
+                  .y = topoNodes_[parent_[slot]].y};
   }
+  auto tap = tapPoint(parent, node);
 
-  topoNodes_[nodeIdx].x = tap.x;
-  topoNodes_[nodeIdx].y = tap.y;
-  for (auto idx : adj_[nodeIdx]) {
-    if (idx == parentIdx) {
-      continue;
-    }
-    finalise(idx, nodeIdx);
+  topoNodes_[slot].x = tap.x;
+  topoNodes_[slot].y = tap.y;
+}
+
+inline clksyn::ThreadPool *EmbeddingManager::pool() {
+  if (!pool_ && sett_.Threads > 1 && !taskRoots_.empty()) {
+    pool_ = std::make_unique<clksyn::ThreadPool>(sett_.Threads);
   }
+  return pool_.get();
 }
 
 inline EmbeddingResult EmbeddingManager::computeEmbedding() {
-  // 0 is SRC
-  auto root = adj_[0].back();
-  dfs(root, 0);
-  finalise(root, 0);
+  mergingTree();
+  return embedFrom(source_);
+}
+
+inline DMENode EmbeddingManager::mergingTree() {
+  dfs(pool());
+  return nodes_.empty() ? DMENode{} : nodes_.back();
+}
 
-  // @FIXME: finalise leaves the object in unusable state
-  for (auto &node : topology_.Nodes) {
-    node.x = topoNodes_[node.Idx].x;
-    node.y = topoNodes_[node.Idx].y;
+inline EmbeddingResult EmbeddingManager::embedFrom(pt_t parent) {
+  rootParent_ = parent;
+  finalise(pool());
+
+  EmbeddingResult res{};
+  res.Topology = topology_;
+  res.Edges.resize(topology_.Nodes.size() + 1);
+  res.BufferType = std::max(buffer_, 0);
+  if (nodes_.empty()) {
+    return res;
   }
 
-  // @FIXME: remove this printout
-  for (size_t i = 1; i < nodes_.size(); ++i) {
-    std::cout << nodes_[i].str() << std::endl;
+  auto root = static_cast<int32_t>(nodes_.size()) - 1;
+  res.Root = nodes_[root];
+  auto srcLen = manhattanDistance(
+      parent, pt_t{.x = topoNodes_[root].x, .y = topoNodes_[root].y});
+  edges_[root].Wire =
+      selectSourceWire(srcLen, nodes_[root].LdCap, wireTable_, sett_);
+  edges_[root].Length = srcLen;
+
+  std::vector<int32_t> slotOf(res.Edges.size(), -1);
+  for (size_t slot = 0; slot < postOrder_.size(); ++slot) {
+    auto nodeIdx = postOrder_[slot];
+    slotOf[nodeIdx] = slot;
+    res.Edges[nodeIdx] =
+        edgeInto(nodes_[slot], edges_[slot].Wire, edges_[slot].Length);
+  }
+  for (auto &node : res.Topology.Nodes) {
+    if (slotOf[node.Idx] != -1) {
+      node.x = topoNodes_[slotOf[node.Idx]].x;
+      node.y = topoNodes_[slotOf[node.Idx]].y;
+    }
   }
-  return topology_;
+  return res;
 }
 
 } // namespace dme
@@ -0,0 +1,685 @@
+#pragma once
+
+#include "dme.hpp"
+
+#include <array>
+#include <istream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace dme {
+
+// A placement change to one sink. REMOVE only uses the id, MOVE keeps the
+// capacitance.
+struct EcoChange {
+  enum { ADD, REMOVE, MOVE } Kind;
+  std::string Id;
+  point Cord{};
+  int64_t Cap = 0;
+};
+
+// Reads one change per line:
+//   add <id> <x> <y> <cap>
+//   remove <id>
+//   move <id> <x> <y>
+// Blank lines and anything after '#' are skipped. Throws
+// std::invalid_argument on malformed lines.
+inline std::vector<EcoChange> parseEcoChanges(std::istream &in) {
+  std::vector<EcoChange> changes;
+  std::string line;
+  for (int32_t lineNo = 1; std::getline(in, line); ++lineNo) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string op;
+    if (!(fields >> op)) {
+      continue;
+    }
+    EcoChange change{};
+    change.Kind = EcoChange::ADD;
+    auto ok = static_cast<bool>(fields >> change.Id);
+    if (op == "add") {
+      ok = ok && fields >> change.Cord.x >> change.Cord.y >> change.Cap;
+    } else if (op == "move") {
+      change.Kind = EcoChange::MOVE;
+      ok = ok && fields >> change.Cord.x >> change.Cord.y;
+    } else if (op == "remove") {
+      change.Kind = EcoChange::REMOVE;
+    } else {
+      ok = false;
+    }
+    std::string rest;
+    if (!ok || fields >> rest) {
+      throw std::invalid_argument("bad change on line " +
+                                  std::to_string(lineNo) + ": " + line);
+    }
+    changes.push_back(change);
+  }
+  return changes;
+}
+
+// Rebuilds the topology of a tree written by an earlier run, either output
+// file. Sinks are matched to `inp` by name and take its coordinates.
+// Buffer cells count as edges; the extra nodes they and detours add have a
+// single child and are dropped by `EcoSession`. Throws
+// std::invalid_argument on names it cannot resolve.
+inline clksyn::TopologyResult topologyFromOutput(const inparams &inp,
+                                                 const outparams &out) {
+  clksyn::TopologyResult res;
+  std::unordered_map<std::string, int32_t> sinkIdx;
+  for (size_t i = 0; i < inp.sinks.size(); ++i) {
+    sinkIdx[inp.sinks[i].id] = i + 1;
+  }
+
+  std::unordered_map<std::string, int32_t> idxOf{{out.src.node_name, 0}};
+  res.Tags[0] = inp.src.source_name;
+  res.Nodes.push_back(clksyn::TreeNode{.Kind = clksyn::TreeNode::SOURCE,
+                                       .Idx = 0,
+                                       .x = inp.src.pt.x,
+                                       .y = inp.src.pt.y,
+                                       .LdCap = 0});
+  for (const auto &s : out.sinks) {
+    auto it = sinkIdx.find(s.sink_name);
+    if (it == sinkIdx.end()) {
+      throw std::invalid_argument("sink " + s.sink_name +
+                                  " is not in the design");
+    }
+    const auto &src = inp.sinks[it->second - 1];
+    idxOf[s.node_name] = it->second;
+    res.Tags[it->second] = src.id;
+    res.Nodes.push_back(
+        clksyn::TreeNode{.Kind = clksyn::TreeNode::SINK,
+                         .Idx = it->second,
+                         .x = src.cord.x,
+                         .y = src.cord.y,
+                         .LdCap = static_cast<double>(src.cap)});
+  }
+  auto nextIdx = static_cast<int32_t>(inp.sinks.size()) + 1;
+  for (const auto &node : out.nodes) {
+    idxOf[node.name] = nextIdx;
+    res.Nodes.push_back(clksyn::TreeNode{.Kind = clksyn::TreeNode::INTERNAL,
+                                         .Idx = nextIdx++,
+                                         .x = node.pt.x,
+                                         .y = node.pt.y,
+                                         .LdCap = 0});
+  }
+
+  auto lookup = [&](const std::string &name) {
+    auto it = idxOf.find(name);
+    if (it == idxOf.end()) {
+      throw std::invalid_argument("edge to unknown node " + name);
+    }
+    return it->second;
+  };
+  for (const auto &w : out.wires) {
+    res.Edges.push_back({lookup(w.from), lookup(w.to)});
+  }
+  for (const auto &b : out.buffers) {
+    res.Edges.push_back({lookup(b.from), lookup(b.to)});
+  }
+  return res;
+}
+
+// Sinks bucketed on a uniform grid, for nearest-sink queries while the
+// sink set changes.
+struct SinkGrid {
+  explicit SinkGrid(int64_t cell = 1) : cell_(std::max<int64_t>(cell, 1)) {}
+
+  void insert(int32_t id, pt_t pt);
+  void erase(int32_t id, pt_t pt);
+  // Closest id by Manhattan distance, ties to the lower id, -1 if empty.
+  int32_t nearest(pt_t pt) const;
+
+private:
+  int64_t cellOf(int64_t v) const {
+    return v >= 0 ? v / cell_ : -((cell_ - 1 - v) / cell_);
+  }
+  static int64_t key(int64_t cx, int64_t cy) {
+    return (cx << 32) ^ (cy & 0xffffffff);
+  }
+
+  int64_t cell_;
+  std::unordered_map<int64_t, std::vector<std::pair<int32_t, pt_t>>> cells_;
+  size_t size_ = 0;
+  // cells ever occupied, rings outside them are skipped
+  int64_t loX_ = 0, hiX_ = -1, loY_ = 0, hiY_ = -1;
+};
+
+inline void SinkGrid::insert(int32_t id, pt_t pt) {
+  auto cx = cellOf(pt.x), cy = cellOf(pt.y);
+  if (size_++ == 0 && hiX_ < loX_) {
+    loX_ = hiX_ = cx;
+    loY_ = hiY_ = cy;
+  }
+  loX_ = std::min(loX_, cx);
+  hiX_ = std::max(hiX_, cx);
+  loY_ = std::min(loY_, cy);
+  hiY_ = std::max(hiY_, cy);
+  cells_[key(cx, cy)].push_back({id, pt});
+}
+
+inline void SinkGrid::erase(int32_t id, pt_t pt) {
+  auto it = cells_.find(key(cellOf(pt.x), cellOf(pt.y)));
+  if (it == cells_.end()) {
+    return;
+  }
+  auto &cell = it->second;
+  for (auto &entry : cell) {
+    if (entry.first == id) {
+      entry = cell.back();
+      cell.pop_back();
+      --size_;
+      break;
+    }
+  }
+  if (cell.empty()) {
+    cells_.erase(it);
+  }
+}
+
+// Scans rings of cells around `pt`. Everything beyond ring r is more than
+// r cells away along one axis, so the search ends once the best distance
+// is within r * cell.
+inline int32_t SinkGrid::nearest(pt_t pt) const {
+  if (size_ == 0) {
+    return -1;
+  }
+  auto cx = cellOf(pt.x), cy = cellOf(pt.y);
+  auto best = std::make_pair(std::numeric_limits<int64_t>::max(), -1);
+  auto scan = [&](int64_t x, int64_t y) {
+    auto it = cells_.find(key(x, y));
+    if (it == cells_.end()) {
+      return;
+    }
+    for (const auto &[id, at] : it->second) {
+      best = std::min(best, std::make_pair(manhattanDistance(pt, at), id));
+    }
+  };
+  auto first = std::max({loX_ - cx, cx - hiX_, loY_ - cy, cy - hiY_,
+                         static_cast<int64_t>(0)});
+  auto last = std::max({hiX_ - cx, cx - loX_, hiY_ - cy, cy - loY_});
+  for (auto r = first; r <= last; ++r) {
+    for (auto y = std::max(cy - r, loY_); y <= std::min(cy + r, hiY_); ++y) {
+      if (y == cy - r || y == cy + r) {
+        for (auto x = std::max(cx - r, loX_); x <= std::min(cx + r, hiX_);
+             ++x) {
+          scan(x, y);
+        }
+        continue;
+      }
+      if (cx - r >= loX_) {
+        scan(cx - r, y);
+      }
+      if (r > 0 && cx + r <= hiX_) {
+        scan(cx + r, y);
+      }
+    }
+    if (best.second != -1 && best.first <= r * cell_) {
+      break;
+    }
+  }
+  return best.second;
+}
+
+// Work done by the last `apply`, or by the constructor.
+struct EcoStats {
+  // Subtrees merged again bottom-up, and tap points recomputed top-down.
+  int32_t Merges = 0;
+  int32_t Placements = 0;
+};
+
+struct EcoResult {
+  // The design after the changes: surviving sinks in their original order,
+  // added ones at the end.
+  inparams Input;
+  EmbeddingResult Tree;
+};
+
+// Incremental re-synthesis after sink changes (ECOs). The session keeps
+// the tree together with the merging segment of every subtree, so a
+// change only merges the nodes on its path to the root again and
+// re-places the taps that move; the rest of the tree is reused.
+//
+// A removed sink is spliced out together with its parent. Added and moved
+// sinks hang off the nearest sink, under a new node in place of it. Every
+// recomputed merge is the zero-skew merge of the full DME, so the result
+// is the tree `EmbeddingManager` produces for the edited topology.
+struct EcoSession {
+  // Throws std::invalid_argument unless `topology` is a binary tree over
+  // exactly the sinks of `inp`. Nodes with a single child are dropped.
+  EcoSession(inparams, clksyn::TopologyResult, EmbeddingSettings = {});
+
+  // Applies the changes in order. Throws std::invalid_argument, before
+  // changing anything, if one removes or moves a sink that is not there
+  // or adds one that is.
+  void apply(const std::vector<EcoChange> &changes);
+
+  EcoResult result() const;
+  const EcoStats &stats() const { return stats_; }
+
+private:
+  struct Node {
+    int32_t Parent = -1;
+    // Both -1 for sinks. Kids[0] is merged as the left side.
+    std::array<int32_t, 2> Kids{-1, -1};
+    int32_t Sink = -1;
+    // Merging segment of the subtree, and the same as driven from the
+    // parent's merge, i.e. with the buffers that merge added.
+    DMENode Merged, Driven;
+    // wire up to the parent
+    EmbeddedEdge Edge;
+    pt_t Tap{};
+    // Dirty nodes are merged again by `remerge`, and `place` re-places
+    // what it merged (Fresh).
+    bool Dirty = false, Fresh = false;
+  };
+
+  int32_t newNode();
+  void freeNode(int32_t node);
+  void markDirty(int32_t node);
+  void replaceKid(int32_t parent, int32_t from, int32_t to);
+  void attach(int32_t sinkIdx);
+  void detach(int32_t sinkIdx);
+  void mergeAt(int32_t node);
+  void remerge();
+  void place();
+
+  inparams inp_;
+  EmbeddingSettings sett_;
+  std::vector<WireModel> wireTable_;
+  int32_t buffer_ = -1;
+  pt_t source_;
+
+  std::vector<Node> nodes_;
+  std::vector<int32_t> free_;
+  int32_t root_ = -1;
+
+  // Sinks by index, removed ones stay as tombstones so indices are stable.
+  std::vector<sink> sinks_;
+  std::vector<bool> alive_;
+  std::vector<int32_t> sinkNode_;
+  std::unordered_map<std::string, int32_t> byId_;
+  SinkGrid grid_;
+
+  EcoStats stats_;
+};
+
+inline EcoSession::EcoSession(inparams inp, clksyn::TopologyResult topology,
+                              EmbeddingSettings sett)
+    : inp_(std::move(inp)), sett_(sett) {
+  wireTable_ = makeWireTable(inp_.wires);
+  buffer_ = selectBuffer(inp_, sett_);
+  source_ = pt_t{.x = inp_.src.pt.x, .y = inp_.src.pt.y};
+
+  sinks_ = std::move(inp_.sinks);
+  inp_.sinks.clear();
+  alive_.assign(sinks_.size(), true);
+  sinkNode_.assign(sinks_.size(), -1);
+  // about one sink per cell
+  int64_t loX = 0, hiX = 0, loY = 0, hiY = 0;
+  for (size_t i = 0; i < sinks_.size(); ++i) {
+    byId_[sinks_[i].id] = i;
+    const auto &at = sinks_[i].cord;
+    loX = i == 0 ? at.x : std::min(loX, at.x);
+    hiX = i == 0 ? at.x : std::max(hiX, at.x);
+    loY = i == 0 ? at.y : std::min(loY, at.y);
+    hiY = i == 0 ? at.y : std::max(hiY, at.y);
+  }
+  auto area = static_cast<double>(hiX - loX + 1) * (hiY - loY + 1);
+  grid_ = SinkGrid(static_cast<int64_t>(
+      std::sqrt(area / std::max<size_t>(sinks_.size(), 1))));
+
+  // Topology indices are used as node ids, 0 (the source) is never one.
+  int32_t numIdx = 1;
+  for (const auto &node : topology.Nodes) {
+    numIdx = std::max(numIdx, node.Idx + 1);
+  }
+  nodes_.resize(numIdx);
+  std::vector<bool> used(numIdx, false);
+  for (const auto &node : topology.Nodes) {
+    if (node.Kind != clksyn::TreeNode::SINK) {
+      used[node.Idx] = node.Kind == clksyn::TreeNode::INTERNAL;
+      continue;
+    }
+    auto tag = topology.Tags.find(node.Idx);
+    auto it = tag == topology.Tags.end() ? byId_.end()
+                                         : byId_.find(tag->second);
+    if (it == byId_.end() || sinkNode_[it->second] != -1) {
+      throw std::invalid_argument("topology sink " +
+                                  std::to_string(node.Idx) +
+                                  " does not match a sink of the design");
+    }
+    used[node.Idx] = true;
+    nodes_[node.Idx].Sink = it->second;
+    sinkNode_[it->second] = node.Idx;
+  }
+  for (size_t i = 0; i < sinks_.size(); ++i) {
+    if (sinkNode_[i] == -1) {
+      throw std::invalid_argument("sink " + sinks_[i].id +
+                                  " is missing from the topology");
+    }
+    grid_.insert(i, pt_t{.x = sinks_[i].cord.x, .y = sinks_[i].cord.y});
+  }
+
+  // Same sides as `EmbeddingManager`: the last child listed is merged as
+  // the left one.
+  std::vector<std::vector<int32_t>> kids(numIdx);
+  for (const auto &[from, to] : topology.Edges) {
+    if (from < 0 || to <= 0 || from >= numIdx || to >= numIdx || !used[to]) {
+      throw std::invalid_argument("edge to unknown node " +
+                                  std::to_string(to));
+    }
+    if (from == 0) {
+      if (root_ != -1) {
+        throw std::invalid_argument("source drives more than one node");
+      }
+      root_ = to;
+      continue;
+    }
+    kids[from].push_back(to);
+  }
+  for (int32_t idx = 1; idx < numIdx; ++idx) {
+    if (!used[idx]) {
+      free_.push_back(idx);
+      continue;
+    }
+    auto &node = nodes_[idx];
+    auto numKids = kids[idx].size();
+    if (numKids > 2 || (node.Sink != -1) != (numKids == 0)) {
+      throw std::invalid_argument("node " + std::to_string(idx) +
+                                  " has " + std::to_string(numKids) +
+                                  " children");
+    }
+    for (size_t k = 0; k < numKids; ++k) {
+      node.Kids[k] = kids[idx][numKids - 1 - k];
+      nodes_[node.Kids[k]].Parent = idx;
+    }
+  }
+  for (int32_t idx = 1; idx < numIdx; ++idx) {
+    if (used[idx] && nodes_[idx].Sink == -1 && nodes_[idx].Kids[1] == -1) {
+      auto kid = nodes_[idx].Kids[0];
+      replaceKid(nodes_[idx].Parent, idx, kid);
+      nodes_[kid].Parent = nodes_[idx].Parent;
+      freeNode(idx);
+    }
+  }
+  if (root_ == -1 && !sinks_.empty()) {
+    throw std::invalid_argument("topology has no root");
+  }
+
+  for (auto node : sinkNode_) {
+    markDirty(node);
+  }
+  remerge();
+  for (auto node : sinkNode_) {
+    if (nodes_[node].Dirty) {
+      throw std::invalid_argument("topology does not reach every sink");
+    }
+  }
+  place();
+}
+
+inline int32_t EcoSession::newNode() {
+  if (free_.empty()) {
+    nodes_.emplace_back();
+    return nodes_.size() - 1;
+  }
+  auto node = free_.back();
+  free_.pop_back();
+  return node;
+}
+
+inline void EcoSession::freeNode(int32_t node) {
+  nodes_[node] = Node{};
+  free_.push_back(node);
+}
+
+// Marks the node and its ancestors. Ancestors of a dirty node are always
+// dirty, so the walk stops at the first one that already is.
+inline void EcoSession::markDirty(int32_t node) {
+  while (node != -1 && !nodes_[node].Dirty) {
+    nodes_[node].Dirty = true;
+    node = nodes_[node].Parent;
+  }
+}
+
+inline void EcoSession::replaceKid(int32_t parent, int32_t from, int32_t to) {
+  if (parent == -1) {
+    root_ = to;
+    return;
+  }
+  for (auto &kid : nodes_[parent].Kids) {
+    if (kid == from) {
+      kid = to;
+    }
+  }
+}
+
+inline void EcoSession::attach(int32_t sinkIdx) {
+  auto leaf = newNode();
+  nodes_[leaf].Sink = sinkIdx;
+  sinkNode_[sinkIdx] = leaf;
+  auto at = pt_t{.x = sinks_[sinkIdx].cord.x, .y = sinks_[sinkIdx].cord.y};
+  auto near = grid_.nearest(at);
+  grid_.insert(sinkIdx, at);
+  if (near == -1) {
+    root_ = leaf;
+    markDirty(leaf);
+    return;
+  }
+
+  auto sibling = sinkNode_[near];
+  auto mid = newNode();
+  auto up = nodes_[sibling].Parent;
+  replaceKid(up, sibling, mid);
+  nodes_[mid].Parent = up;
+  nodes_[mid].Kids = {sibling, leaf};
+  nodes_[sibling].Parent = nodes_[leaf].Parent = mid;
+  markDirty(leaf);
+}
+
+inline void EcoSession::detach(int32_t sinkIdx) {
+  auto leaf = sinkNode_[sinkIdx];
+  grid_.erase(sinkIdx,
+              pt_t{.x = sinks_[sinkIdx].cord.x, .y = sinks_[sinkIdx].cord.y});
+  sinkNode_[sinkIdx] = -1;
+  auto parent = nodes_[leaf].Parent;
+  freeNode(leaf);
+  if (parent == -1) {
+    root_ = -1;
+    return;
+  }
+
+  const auto &kids = nodes_[parent].Kids;
+  auto sibling = kids[0] == leaf ? kids[1] : kids[0];
+  auto up = nodes_[parent].Parent;
+  replaceKid(up, parent, sibling);
+  nodes_[sibling].Parent = up;
+  freeNode(parent);
+  // a sibling that became the root keeps its merge, `place` re-taps it
+  markDirty(up);
+}
+
+inline void EcoSession::mergeAt(int32_t node) {
+  auto &cur = nodes_[node];
+  if (cur.Sink != -1) {
+    const auto &s = sinks_[cur.Sink];
+    cur.Merged = DMENode{.Core = makeCore(pt_t{.x = s.cord.x, .y = s.cord.y}),
+                         .LdCap = static_cast<double>(s.cap),
+                         .Delay = 0};
+    return;
+  }
+  auto &lhsNode = nodes_[cur.Kids[0]], &rhsNode = nodes_[cur.Kids[1]];
+  auto lhs = lhsNode.Merged, rhs = rhsNode.Merged;
+  auto step = mergeStep(lhs, rhs, inp_, wireTable_, sett_, buffer_);
+  lhsNode.Driven = lhs;
+  rhsNode.Driven = rhs;
+  lhsNode.Edge = edgeInto(lhs, step.Wire, step.LenA);
+  rhsNode.Edge = edgeInto(rhs, step.Wire, step.LenB);
+  cur.Merged = step.Node;
+}
+
+// Bottom-up over the dirty nodes only, children before parents.
+inline void EcoSession::remerge() {
+  if (root_ == -1) {
+    return;
+  }
+  std::vector<std::pair<int32_t, int32_t>> stack;
+  if (nodes_[root_].Dirty) {
+    stack.push_back({root_, 0});
+  }
+  while (!stack.empty()) {
+    auto [node, next] = stack.back();
+    if (nodes_[node].Sink == -1 && next < 2) {
+      ++stack.back().second;
+      auto kid = nodes_[node].Kids[next];
+      if (nodes_[kid].Dirty) {
+        stack.push_back({kid, 0});
+      }
+      continue;
+    }
+    stack.pop_back();
+    mergeAt(node);
+    nodes_[node].Dirty = false;
+    nodes_[node].Fresh = true;
+    ++stats_.Merges;
+  }
+  nodes_[root_].Driven = nodes_[root_].Merged;
+}
+
+// Top-down from the root. A tap only moves when the parent's tap or the
+// node's own merging segment did, so the walk follows those nodes and
+// the children of freshly merged ones.
+inline void EcoSession::place() {
+  if (root_ == -1) {
+    return;
+  }
+  std::vector<int32_t> stack{root_};
+  while (!stack.empty()) {
+    auto node = stack.back();
+    stack.pop_back();
+    auto &cur = nodes_[node];
+    auto parent = cur.Parent == -1 ? source_ : nodes_[cur.Parent].Tap;
+    auto tap = tapPoint(parent, cur.Driven);
+    auto moved = cur.Fresh || tap != cur.Tap;
+    cur.Tap = tap;
+    cur.Fresh = false;
+    ++stats_.Placements;
+    if (cur.Sink != -1) {
+      continue;
+    }
+    for (auto kid : cur.Kids) {
+      if (moved || nodes_[kid].Fresh) {
+        stack.push_back(kid);
+      }
+    }
+  }
+
+  auto &root = nodes_[root_];
+  auto len = manhattanDistance(source_, root.Tap);
+  root.Edge = edgeInto(
+      root.Driven,
+      selectSourceWire(len, root.Merged.LdCap, wireTable_, sett_), len);
+}
+
+inline void EcoSession::apply(const std::vector<EcoChange> &changes) {
+  std::unordered_map<std::string, bool> present;
+  for (const auto &change : changes) {
+    auto it = present.find(change.Id);
+    bool there = it != present.end() ? it->second : byId_.count(change.Id);
+    if ((change.Kind == EcoChange::ADD) == there) {
+      throw std::invalid_argument(
+          there ? "sink " + change.Id + " already exists"
+                : "sink " + change.Id + " does not exist");
+    }
+    present[change.Id] = change.Kind != EcoChange::REMOVE;
+  }
+
+  stats_ = EcoStats{};
+  for (const auto &change : changes) {
+    if (change.Kind == EcoChange::ADD) {
+      auto sinkIdx = static_cast<int32_t>(sinks_.size());
+      sinks_.push_back(
+          sink{.id = change.Id, .cord = change.Cord, .cap = change.Cap});
+      alive_.push_back(true);
+      sinkNode_.push_back(-1);
+      byId_[change.Id] = sinkIdx;
+      attach(sinkIdx);
+      continue;
+    }
+    auto sinkIdx = byId_.at(change.Id);
+    detach(sinkIdx);
+    if (change.Kind == EcoChange::MOVE) {
+      sinks_[sinkIdx].cord = change.Cord;
+      attach(sinkIdx);
+    } else {
+      alive_[sinkIdx] = false;
+      byId_.erase(change.Id);
+    }
+  }
+  remerge();
+  place();
+}
+
+// Numbers the tree the way `TreeSynthesis` does: source 0, sinks from 1
+// in input order, internal nodes after them.
+inline EcoResult EcoSession::result() const {
+  EcoResult res{};
+  res.Input = inp_;
+  auto &topology = res.Tree.Topology;
+  std::vector<int32_t> idxOf(nodes_.size(), -1);
+  topology.Tags[0] = inp_.src.source_name;
+  topology.Nodes.push_back(clksyn::TreeNode{.Kind = clksyn::TreeNode::SOURCE,
+                                            .Idx = 0,
+                                            .x = source_.x,
+                                            .y = source_.y,
+                                            .LdCap = 0});
+  for (size_t i = 0; i < sinks_.size(); ++i) {
+    if (!alive_[i]) {
+      continue;
+    }
+    res.Input.sinks.push_back(sinks_[i]);
+    auto idx = static_cast<int32_t>(res.Input.sinks.size());
+    idxOf[sinkNode_[i]] = idx;
+    topology.Tags[idx] = sinks_[i].id;
+  }
+  res.Tree.BufferType = std::max(buffer_, 0);
+  if (root_ == -1) {
+    res.Tree.Edges.resize(1);
+    return res;
+  }
+
+  auto nextIdx = static_cast<int32_t>(res.Input.sinks.size()) + 1;
+  std::vector<int32_t> order{root_};
+  for (size_t i = 0; i < order.size(); ++i) {
+    const auto &node = nodes_[order[i]];
+    if (node.Sink == -1) {
+      idxOf[order[i]] = nextIdx++;
+      order.push_back(node.Kids[0]);
+      order.push_back(node.Kids[1]);
+    }
+  }
+
+  res.Tree.Edges.resize(nextIdx);
+  res.Tree.Root = nodes_[root_].Merged;
+  topology.Edges.push_back({0, idxOf[root_]});
+  for (auto id : order) {
+    const auto &node = nodes_[id];
+    auto idx = idxOf[id];
+    topology.Nodes.push_back(clksyn::TreeNode{
+        .Kind = node.Sink == -1 ? clksyn::TreeNode::INTERNAL
+                                : clksyn::TreeNode::SINK,
+        .Idx = idx,
+        .x = node.Tap.x,
+        .y = node.Tap.y,
+        .LdCap = node.Merged.LdCap});
+    res.Tree.Edges[idx] = node.Edge;
+    if (node.Sink == -1) {
+      // the left side last, as `EmbeddingManager` reads it
+      topology.Edges.push_back({idx, idxOf[node.Kids[1]]});
+      topology.Edges.push_back({idx, idxOf[node.Kids[0]]});
+    }
+  }
+  return res;
+}
+
+} // namespace dme
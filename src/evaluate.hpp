@@ -0,0 +1,113 @@
+#pragma once
+
+#include "dme.hpp"
+
+namespace dme {
+
+// Elmore figures of an embedded tree, delays in fs and capacitances in
+// fF. Latencies are measured from the source.
+struct Evaluation {
+  double MaxLatency = 0, MinLatency = 0, Skew = 0;
+  // Wire capacitance alone, and together with the sink and buffer input
+  // capacitance it switches.
+  double WireCap = 0, TotalCap = 0;
+};
+
+// Scores an embedding in process with the same model the embedding uses:
+// every wire is a distributed RC of its electrical length, and the buffer
+// cells at the child end of an edge each drive the next cell (the last
+// one the child, through its stub if it has one) through their output
+// resistance. No output files or external checker needed, so candidate
+// trees can be compared directly.
+inline Evaluation evaluate(const inparams &inp, const EmbeddingResult &res) {
+  const auto &topology = res.Topology;
+  int32_t numIdx = 0;
+  for (const auto &node : topology.Nodes) {
+    numIdx = std::max(numIdx, node.Idx + 1);
+  }
+  std::vector<double> sinkCap(numIdx, 0);
+  std::vector<bool> isSink(numIdx, false);
+  for (const auto &node : topology.Nodes) {
+    if (node.Kind == clksyn::TreeNode::SINK) {
+      sinkCap[node.Idx] = inp.sinks[node.Idx - 1].cap;
+      isSink[node.Idx] = true;
+    }
+  }
+
+  // children in CSR form, edges point from parent to child
+  std::vector<int32_t> start(numIdx + 1, 0), kids(topology.Edges.size());
+  for (const auto &[from, to] : topology.Edges) {
+    ++start[from + 1];
+  }
+  std::partial_sum(start.begin(), start.end(), start.begin());
+  auto fill = start;
+  for (const auto &[from, to] : topology.Edges) {
+    kids[fill[from]++] = to;
+  }
+
+  // parents before children, without recursion
+  std::vector<int32_t> order{0};
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (auto k = start[order[i]]; k < start[order[i] + 1]; ++k) {
+      order.push_back(kids[k]);
+    }
+  }
+
+  const buffer *buf = inp.buffers.empty() ? nullptr
+                                          : &inp.buffers[res.BufferType];
+  Evaluation eval;
+  // load seen at a node, and at the far end of the wire into it
+  std::vector<double> load(numIdx, 0), wireEnd(numIdx, 0);
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    auto idx = *it;
+    auto cap = sinkCap[idx];
+    eval.TotalCap += sinkCap[idx];
+    for (auto k = start[idx]; k < start[idx + 1]; ++k) {
+      auto kid = kids[k];
+      const auto &edge = res.Edges[kid];
+      auto wc = edge.Length * inp.wires[edge.Wire].cap;
+      cap += wc + wireEnd[kid];
+      eval.WireCap += wc;
+    }
+    load[idx] = cap;
+    const auto &edge = res.Edges[idx];
+    wireEnd[idx] = cap;
+    if (buf != nullptr && edge.Buffers > 0) {
+      wireEnd[idx] = buf->in_cap;
+      eval.TotalCap += edge.Buffers * buf->in_cap;
+      eval.WireCap += edge.Stub * inp.wires[edge.Wire].cap;
+    }
+  }
+  eval.TotalCap += eval.WireCap;
+
+  std::vector<double> latency(numIdx, 0);
+  eval.MinLatency = std::numeric_limits<double>::max();
+  for (auto idx : order) {
+    for (auto k = start[idx]; k < start[idx + 1]; ++k) {
+      auto kid = kids[k];
+      const auto &edge = res.Edges[kid];
+      auto wm = makeWireModel(inp.wires[edge.Wire]);
+      auto t = latency[idx] + wm.delay(edge.Length, wireEnd[kid]);
+      if (buf != nullptr && edge.Buffers > 0) {
+        t += buf->resistance *
+                 (buf->out_cap + load[kid] + edge.Stub * wm.C) +
+             (edge.Buffers - 1) * buf->resistance *
+                 (buf->out_cap + buf->in_cap) +
+             wm.delay(edge.Stub, load[kid]);
+      }
+      latency[kid] = t;
+    }
+    if (isSink[idx]) {
+      eval.MaxLatency = std::max(eval.MaxLatency, latency[idx]);
+      eval.MinLatency = std::min(eval.MinLatency, latency[idx]);
+    }
+  }
+  if (eval.MinLatency > eval.MaxLatency) {
+    // no sinks
+    eval.MinLatency = 0;
+  }
+  eval.Skew = eval.MaxLatency - eval.MinLatency;
+  return eval;
+}
+
+} // namespace dme
@@ -0,0 +1,383 @@
+#pragma once
+
+#include "dme.hpp"
+
+#include <queue>
+#include <tuple>
+
+namespace dme {
+
+// Greedy-DME: topology generation and embedding in a single bottom-up pass.
+// Instead of pairing `simpleMerge` midpoints and embedding the resulting
+// topology afterwards, the pair of active merging segments with the lowest
+// zero-skew merge cost is merged next, so the topology follows the segments
+// DME actually builds.
+//
+// The merge cost is the total wire of the zero-skew split, snaking included,
+// which is never below the core distance. Nearest neighbours are found on a
+// uniform grid over core midpoints; candidates go into a lazy priority queue
+// and are recomputed once their partner has been merged away.
+//
+// Like NNA, merging runs in passes that match a `delta` fraction of the
+// active cores. Cores created in a pass only join the next one, which keeps
+// the tree balanced; merging one pair at a time grows long chains that end
+// up snaked.
+struct GreedyDME {
+  GreedyDME(inparams, EmbeddingSettings = {}, double delta = 0.5);
+
+  EmbeddingResult computeEmbedding();
+
+private:
+  struct Candidate {
+    double Cost;
+    int32_t A, B;
+
+    // lowest cost at the top of a priority queue
+    bool operator<(const Candidate &rhs) const {
+      return std::tie(Cost, A, B) > std::tie(rhs.Cost, rhs.A, rhs.B);
+    }
+  };
+
+  double pairCost(int32_t a, int32_t b) const;
+  std::optional<Candidate> nearest(int32_t idx) const;
+  void mergePair(int32_t a, int32_t b, int32_t resIdx);
+  void place(int32_t root);
+
+  void buildGrid();
+  std::pair<int32_t, int32_t> cellOf(pt_t pt) const;
+  void insert(int32_t idx);
+  void erase(int32_t idx);
+
+  inparams inp_;
+  EmbeddingSettings sett_;
+  double delta_;
+  std::vector<WireModel> wireTable_;
+  // wire model the pairing cost is evaluated with
+  WireModel pairWire_;
+  int32_t buffer_ = -1;
+  pt_t source_;
+
+  // Per-node data indexed by node Idx, sinks are 1..n and internal nodes
+  // follow in merge order, so children always precede their parent.
+  std::vector<DMENode> nodes_;
+  std::vector<EmbeddedEdge> edges_;
+  std::vector<clksyn::TreeNode> topoNodes_;
+  std::vector<int32_t> parent_;
+  std::vector<bool> active_;
+  int32_t numActive_ = 0;
+  std::map<int32_t, std::string> tags_;
+  std::vector<std::pair<int32_t, int32_t>> topoEdges_;
+
+  // Grid over the midpoints of active cores. `maxReach_` bounds the
+  // distance from the midpoint of any indexed core to its end points.
+  pt_t origin_;
+  int64_t cell_ = 1;
+  int32_t cols_ = 1, rows_ = 1;
+  int32_t gridBuiltFor_ = 0;
+  int64_t maxReach_ = 0;
+  std::vector<std::vector<int32_t>> buckets_;
+  std::vector<int32_t> bucketOf_;
+};
+
+inline pt_t coreMidpoint(const DMECore &core) {
+  return pt_t{.x = (core.First.x + core.Second.x) / 2,
+              .y = (core.First.y + core.Second.y) / 2};
+}
+
+// Upper bound on the distance from the midpoint to either end of a core.
+inline int64_t coreReach(const DMECore &core) {
+  return (std::abs(core.Second.x - core.First.x) +
+          std::abs(core.Second.y - core.First.y)) /
+             2 +
+         1;
+}
+
+inline GreedyDME::GreedyDME(inparams inp, EmbeddingSettings sett,
+                            double delta)
+    : inp_(inp), sett_(sett), delta_(delta) {
+  wireTable_ = makeWireTable(inp_.wires);
+  auto pairIdx = sett_.WireType;
+  if (pairIdx < 0 || static_cast<size_t>(pairIdx) >= wireTable_.size()) {
+    pairIdx = 0;
+  }
+  pairWire_ = wireTable_.empty() ? WireModel{} : wireTable_[pairIdx];
+  buffer_ = selectBuffer(inp_, sett_);
+  source_ = pt_t{.x = inp_.src.pt.x, .y = inp_.src.pt.y};
+  tags_[0] = inp_.src.source_name;
+
+  // n sinks produce n - 1 internal nodes, slot 0 is the source.
+  auto numSinks = static_cast<int32_t>(inp_.sinks.size());
+  auto numIdx = std::max(2 * numSinks, 1);
+  nodes_.resize(numIdx);
+  edges_.resize(numIdx);
+  topoNodes_.resize(numIdx);
+  parent_.assign(numIdx, -1);
+  active_.assign(numIdx, false);
+  bucketOf_.assign(numIdx, -1);
+
+  for (int32_t i = 0; i < numSinks; ++i) {
+    const auto &sink = inp_.sinks[i];
+    auto idx = i + 1;
+    topoNodes_[idx] = clksyn::TreeNode{
+        .Kind = clksyn::TreeNode::SINK,
+        .Idx = idx,
+        .x = sink.cord.x,
+        .y = sink.cord.y,
+        .LdCap = static_cast<double>(sink.cap),
+    };
+    nodes_[idx] = DMENode{
+        .Core = makeCore(pt_t{.x = sink.cord.x, .y = sink.cord.y}),
+        .LdCap = static_cast<double>(sink.cap),
+        .Delay = 0,
+    };
+    active_[idx] = true;
+    tags_[idx] = sink.id;
+  }
+  numActive_ = numSinks;
+}
+
+inline double GreedyDME::pairCost(int32_t a, int32_t b) const {
+  auto d = coreDistance(nodes_[a].Core, nodes_[b].Core);
+  auto split = splitMerge(nodes_[a], nodes_[b], d, pairWire_);
+  return split.LenA + split.LenB;
+}
+
+// Sized for about one active core per cell. Called again whenever the
+// active set has shrunk to a quarter, so rings stay short.
+inline void GreedyDME::buildGrid() {
+  int64_t minX = std::numeric_limits<int64_t>::max(), minY = minX;
+  int64_t maxX = std::numeric_limits<int64_t>::min(), maxY = maxX;
+  maxReach_ = 0;
+  for (size_t idx = 0; idx < nodes_.size(); ++idx) {
+    if (!active_[idx]) {
+      continue;
+    }
+    auto mid = coreMidpoint(nodes_[idx].Core);
+    minX = std::min(minX, mid.x);
+    minY = std::min(minY, mid.y);
+    maxX = std::max(maxX, mid.x);
+    maxY = std::max(maxY, mid.y);
+  }
+
+  origin_ = pt_t{.x = minX, .y = minY};
+  auto area = static_cast<double>(maxX - minX + 1) * (maxY - minY + 1);
+  cell_ = std::max<int64_t>(1, std::llround(std::sqrt(area / numActive_)));
+  cols_ = (maxX - minX) / cell_ + 1;
+  rows_ = (maxY - minY) / cell_ + 1;
+  gridBuiltFor_ = numActive_;
+
+  buckets_.assign(static_cast<size_t>(cols_) * rows_, {});
+  std::fill(bucketOf_.begin(), bucketOf_.end(), -1);
+  for (size_t idx = 0; idx < nodes_.size(); ++idx) {
+    if (active_[idx]) {
+      insert(idx);
+    }
+  }
+}
+
+// Cores created after the grid was built may lie outside of it, clamping
+// keeps the ring distance a lower bound on the real distance.
+inline std::pair<int32_t, int32_t> GreedyDME::cellOf(pt_t pt) const {
+  auto cx = std::clamp<int64_t>((pt.x - origin_.x) / cell_, 0, cols_ - 1);
+  auto cy = std::clamp<int64_t>((pt.y - origin_.y) / cell_, 0, rows_ - 1);
+  return {cx, cy};
+}
+
+inline void GreedyDME::insert(int32_t idx) {
+  auto [cx, cy] = cellOf(coreMidpoint(nodes_[idx].Core));
+  bucketOf_[idx] = cy * cols_ + cx;
+  buckets_[bucketOf_[idx]].push_back(idx);
+  maxReach_ = std::max(maxReach_, coreReach(nodes_[idx].Core));
+}
+
+inline void GreedyDME::erase(int32_t idx) {
+  auto &bucket = buckets_[bucketOf_[idx]];
+  auto it = std::find(bucket.begin(), bucket.end(), idx);
+  *it = bucket.back();
+  bucket.pop_back();
+  bucketOf_[idx] = -1;
+}
+
+// Scans rings of cells around the midpoint of `idx`. A core in ring r is
+// at least (r - 1) * cell_ away up to the reach of both cores, and the
+// merge cost never undercuts the distance, so the scan stops once that
+// bound passes the best cost found.
+inline std::optional<GreedyDME::Candidate>
+GreedyDME::nearest(int32_t idx) const {
+  auto [cx, cy] = cellOf(coreMidpoint(nodes_[idx].Core));
+  auto reach = coreReach(nodes_[idx].Core) + maxReach_;
+  auto maxRing = std::max(cols_, rows_);
+
+  std::optional<Candidate> best;
+  auto visit = [&](int32_t x, int32_t y) {
+    if (x < 0 || y < 0 || x >= cols_ || y >= rows_) {
+      return;
+    }
+    for (auto other : buckets_[y * cols_ + x]) {
+      if (other == idx) {
+        continue;
+      }
+      auto cand = Candidate{.Cost = pairCost(idx, other),
+                            .A = std::min(idx, other),
+                            .B = std::max(idx, other)};
+      // operator< is inverted for the priority queue
+      if (!best || *best < cand) {
+        best = cand;
+      }
+    }
+  };
+
+  for (int32_t r = 0; r <= maxRing; ++r) {
+    if (best && best->Cost <= static_cast<double>((r - 1) * cell_ - reach)) {
+      break;
+    }
+    if (r == 0) {
+      visit(cx, cy);
+      continue;
+    }
+    for (int32_t x = cx - r; x <= cx + r; ++x) {
+      visit(x, cy - r);
+      visit(x, cy + r);
+    }
+    for (int32_t y = cy - r + 1; y <= cy + r - 1; ++y) {
+      visit(cx - r, y);
+      visit(cx + r, y);
+    }
+  }
+  return best;
+}
+
+// Same merge as `EmbeddingManager::mergeNode`. The merged node becomes
+// active at the end of the pass.
+inline void GreedyDME::mergePair(int32_t a, int32_t b, int32_t resIdx) {
+  auto wireIdx = sett_.WireType;
+  if (wireIdx < 0 || static_cast<size_t>(wireIdx) >= wireTable_.size()) {
+    wireIdx =
+        selectWire(nodes_[a], nodes_[b], wireTable_, sett_.WireCapWeight);
+  }
+
+  auto &lhs = nodes_[a], &rhs = nodes_[b];
+  if (buffer_ != -1) {
+    bufferToBudget(lhs, rhs, inp_.wires[wireIdx], inp_.buffers[buffer_],
+                   sett_.CapBudget * inp_.smul.cap_limit, inp_.blockages);
+  }
+  auto split = splitMerge(lhs, rhs, coreDistance(lhs.Core, rhs.Core),
+                          wireTable_[wireIdx]);
+  edges_[a] = edgeInto(lhs, wireIdx, split.LenA);
+  edges_[b] = edgeInto(rhs, wireIdx, split.LenB);
+  nodes_[resIdx] = merge(lhs, rhs, split);
+
+  topoNodes_[resIdx] = clksyn::TreeNode{.Kind = clksyn::TreeNode::INTERNAL,
+                                        .Idx = resIdx,
+                                        .x = 0,
+                                        .y = 0,
+                                        .LdCap = nodes_[resIdx].LdCap};
+  topoEdges_.push_back({resIdx, a});
+  topoEdges_.push_back({resIdx, b});
+  parent_[a] = parent_[b] = resIdx;
+
+  erase(a);
+  erase(b);
+  active_[a] = active_[b] = false;
+  numActive_ -= 2;
+}
+
+// Top-down pass fixing tap points. Parents have larger indices than their
+// children, so a descending sweep sees every parent first.
+inline void GreedyDME::place(int32_t root) {
+  for (auto idx = root; idx >= 1; --idx) {
+    auto parent = parent_[idx] == -1
+                      ? source_
+                      : pt_t{.x = topoNodes_[parent_[idx]].x,
+                             .y = topoNodes_[parent_[idx]].y};
+    auto tap = tapPoint(parent, nodes_[idx]);
+    topoNodes_[idx].x = tap.x;
+    topoNodes_[idx].y = tap.y;
+  }
+}
+
+inline EmbeddingResult GreedyDME::computeEmbedding() {
+  EmbeddingResult res{};
+  res.BufferType = std::max(buffer_, 0);
+  auto numSinks = static_cast<int32_t>(inp_.sinks.size());
+  if (numSinks == 0) {
+    return res;
+  }
+
+  buildGrid();
+  auto nextIdx = numSinks + 1;
+  std::vector<int32_t> fresh;
+  while (numActive_ > 1) {
+    // start a new pass
+    std::priority_queue<Candidate> pq;
+    for (int32_t idx = 1; idx < nextIdx; ++idx) {
+      if (!active_[idx]) {
+        continue;
+      }
+      if (auto cand = nearest(idx)) {
+        pq.push(*cand);
+      }
+    }
+
+    auto quota = std::max<int32_t>(1, numActive_ * delta_ / 2);
+    for (int32_t picked = 0; picked < quota && !pq.empty();) {
+      auto top = pq.top();
+      pq.pop();
+      if (!active_[top.A] && !active_[top.B]) {
+        continue;
+      }
+      if (!active_[top.A] || !active_[top.B]) {
+        // partner was merged away, look again for the survivor
+        if (auto cand = nearest(active_[top.A] ? top.A : top.B)) {
+          pq.push(*cand);
+        }
+        continue;
+      }
+      mergePair(top.A, top.B, nextIdx);
+      fresh.push_back(nextIdx++);
+      ++picked;
+    }
+
+    numActive_ += fresh.size();
+    for (auto idx : fresh) {
+      active_[idx] = true;
+    }
+    if (numActive_ * 4 <= gridBuiltFor_) {
+      buildGrid();
+    } else {
+      for (auto idx : fresh) {
+        insert(idx);
+      }
+    }
+    fresh.clear();
+  }
+
+  auto root = nextIdx - 1;
+  res.Root = nodes_[root];
+  place(root);
+  auto srcLen = manhattanDistance(
+      source_, pt_t{.x = topoNodes_[root].x, .y = topoNodes_[root].y});
+  edges_[root] = edgeInto(
+      nodes_[root],
+      selectSourceWire(srcLen, nodes_[root].LdCap, wireTable_, sett_),
+      srcLen);
+
+  // Same layout as `TreeSynthesis::getTopology`: sinks, internal nodes in
+  // merge order, then the source.
+  auto &top = res.Topology;
+  top.Nodes.assign(topoNodes_.begin() + 1, topoNodes_.begin() + root + 1);
+  top.Nodes.push_back(clksyn::TreeNode{.Kind = clksyn::TreeNode::SOURCE,
+                                       .Idx = 0,
+                                       .x = source_.x,
+                                       .y = source_.y,
+                                       .LdCap = 0});
+  top.Edges = topoEdges_;
+  top.Edges.push_back({0, root});
+  top.Tags = tags_;
+
+  res.Edges = edges_;
+  res.Edges.resize(top.Nodes.size() + 1);
+  return res;
+}
+
+} // namespace dme
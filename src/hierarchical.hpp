@@ -0,0 +1,233 @@
+#pragma once
+
+#include "dme.hpp"
+#include "threadpool.hpp"
+#include "topology.hpp"
+
+namespace dme {
+
+// Copy of `inp` restricted to the sinks at `positions`.
+inline inparams subsetSinks(const inparams &inp,
+                            const std::vector<int32_t> &positions) {
+  auto sub = inp;
+  sub.sinks.clear();
+  for (auto pos : positions) {
+    sub.sinks.push_back(inp.sinks[pos]);
+  }
+  return sub;
+}
+
+// Copies an embedding over a subset of the sinks into `res`. Sink i of
+// `sub` becomes sink `positions[i - 1] + 1`, its internal nodes are
+// numbered from `nextIdx` on. The source edge of `sub` is dropped; returns
+// the new index of its root so the caller can connect it.
+inline int32_t appendSubtree(EmbeddingResult &res, const EmbeddingResult &sub,
+                             const std::vector<int32_t> &positions,
+                             int32_t &nextIdx) {
+  auto &topology = res.Topology;
+  std::vector<int32_t> global(sub.Edges.size(), 0);
+  for (auto node : sub.Topology.Nodes) {
+    if (node.Kind == clksyn::TreeNode::SOURCE) {
+      continue;
+    }
+    auto idx = node.Kind == clksyn::TreeNode::SINK
+                   ? positions[node.Idx - 1] + 1
+                   : nextIdx++;
+    global[node.Idx] = idx;
+    if (static_cast<size_t>(idx) >= res.Edges.size()) {
+      res.Edges.resize(std::max<size_t>(2 * res.Edges.size(), idx + 1));
+    }
+    res.Edges[idx] = sub.Edges[node.Idx];
+    node.Idx = idx;
+    topology.Nodes.push_back(node);
+  }
+  int32_t root = 0;
+  for (const auto &[from, to] : sub.Topology.Edges) {
+    if (from == 0) {
+      root = global[to];
+    } else {
+      topology.Edges.push_back({global[from], global[to]});
+    }
+  }
+  return root;
+}
+
+// Settings for partition-and-stitch synthesis. Clusters and the top level
+// use the same topology algorithm and embedding settings.
+struct HierarchicalSettings {
+  clksyn::TreeSynthesisSettings Topology;
+  EmbeddingSettings Embedding;
+  // Upper bound on the sinks per cluster. NNA and DNNA keep every pair of
+  // a cluster in their heap, so this bounds their memory as well.
+  int32_t ClusterSize = 2000;
+  // Clusters are synthesised in parallel, each one serially on a worker.
+  int32_t Threads = 1;
+};
+
+// Partition-and-stitch synthesis for designs too large for a single
+// `getTopology` heap. Sinks are cut into spatially balanced clusters, and
+// every cluster gets its own topology and merging tree. A top-level tree
+// is then synthesised over the cluster roots. The top-level DME sees each
+// cluster as a sink with its merging segment, load and delay, so the
+// stitching merges absorb the delay differences between clusters (snaking
+// where needed) and the whole tree stays zero skew.
+struct HierarchicalSynthesis {
+  HierarchicalSynthesis(inparams, HierarchicalSettings);
+
+  EmbeddingResult computeEmbedding();
+
+private:
+  std::vector<std::vector<int32_t>> partition() const;
+
+  inparams inp_;
+  HierarchicalSettings sett_;
+};
+
+inline HierarchicalSynthesis::HierarchicalSynthesis(inparams inp,
+                                                    HierarchicalSettings sett)
+    : inp_(inp), sett_(sett) {}
+
+// Grid partitioning balanced by count: vertical strips of equal size,
+// each cut along y into chunks of at most `ClusterSize` sinks. Returns
+// positions into `inparams::sinks`.
+inline std::vector<std::vector<int32_t>>
+HierarchicalSynthesis::partition() const {
+  auto numSinks = static_cast<int64_t>(inp_.sinks.size());
+  auto size = std::max<int64_t>(sett_.ClusterSize, 1);
+  auto numClusters = (numSinks + size - 1) / size;
+  auto strips = std::max<int64_t>(
+      1, std::llround(std::sqrt(static_cast<double>(numClusters))));
+
+  const auto &sinks = inp_.sinks;
+  std::vector<int32_t> order(numSinks);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](auto &&l, auto &&r) {
+    return std::tie(sinks[l].cord.x, sinks[l].cord.y, l) <
+           std::tie(sinks[r].cord.x, sinks[r].cord.y, r);
+  });
+
+  std::vector<std::vector<int32_t>> clusters;
+  for (int64_t s = 0; s < strips; ++s) {
+    auto lo = s * numSinks / strips, hi = (s + 1) * numSinks / strips;
+    std::sort(order.begin() + lo, order.begin() + hi, [&](auto &&l, auto &&r) {
+      return std::tie(sinks[l].cord.y, sinks[l].cord.x, l) <
+             std::tie(sinks[r].cord.y, sinks[r].cord.x, r);
+    });
+    auto chunks = (hi - lo + size - 1) / size;
+    for (int64_t c = 0; c < chunks; ++c) {
+      auto first = lo + c * (hi - lo) / chunks;
+      auto last = lo + (c + 1) * (hi - lo) / chunks;
+      clusters.emplace_back(order.begin() + first, order.begin() + last);
+    }
+  }
+  return clusters;
+}
+
+inline EmbeddingResult HierarchicalSynthesis::computeEmbedding() {
+  auto clusters = partition();
+  auto numClusters = static_cast<int32_t>(clusters.size());
+  auto numSinks = static_cast<int32_t>(inp_.sinks.size());
+  EmbeddingResult res;
+  auto &topology = res.Topology;
+  topology.Tags[0] = inp_.src.source_name;
+  auto source = clksyn::TreeNode{.Kind = clksyn::TreeNode::SOURCE,
+                                 .Idx = 0,
+                                 .x = inp_.src.pt.x,
+                                 .y = inp_.src.pt.y,
+                                 .LdCap = 0};
+  if (numClusters == 0) {
+    topology.Nodes.push_back(source);
+    return res;
+  }
+  std::unique_ptr<clksyn::ThreadPool> pool;
+  if (sett_.Threads > 1) {
+    pool = std::make_unique<clksyn::ThreadPool>(sett_.Threads);
+  }
+  auto forEachCluster = [&](auto &&fn) {
+    clksyn::parallelFor(pool.get(), numClusters, fn);
+  };
+
+  // Everything but the sinks is shared by the clusters and the top level.
+  auto shell = subsetSinks(inp_, {});
+  auto clusterTopo = sett_.Topology;
+  clusterTopo.Threads = 1;
+  auto clusterEmb = sett_.Embedding;
+  clusterEmb.Threads = 1;
+
+  // Bottom-up per cluster, the tap points wait for the top level.
+  std::vector<std::unique_ptr<EmbeddingManager>> managers(numClusters);
+  std::vector<DMENode> roots(numClusters);
+  forEachCluster([&](int32_t c) {
+    auto sub = subsetSinks(inp_, clusters[c]);
+    auto top = clksyn::TreeSynthesis(sub, clusterTopo).getTopology();
+    managers[c] = std::make_unique<EmbeddingManager>(sub, top, clusterEmb);
+    roots[c] = managers[c]->mergingTree();
+  });
+
+  // Top level over the cluster roots, sink c + 1 is cluster c.
+  auto topInp = shell;
+  for (int32_t c = 0; c < numClusters; ++c) {
+    auto mid = pt_t{.x = (roots[c].Core.First.x + roots[c].Core.Second.x) / 2,
+                    .y = (roots[c].Core.First.y + roots[c].Core.Second.y) / 2};
+    topInp.sinks.push_back(
+        sink{.id = std::to_string(c),
+             .cord = point{.x = mid.x, .y = mid.y},
+             .cap = static_cast<int64_t>(std::llround(roots[c].LdCap))});
+  }
+  auto topTopology =
+      clksyn::TreeSynthesis(topInp, sett_.Topology).getTopology();
+  auto topEm = EmbeddingManager(topInp, topTopology, sett_.Embedding);
+  for (int32_t c = 0; c < numClusters; ++c) {
+    topEm.setLeaf(c + 1, roots[c]);
+  }
+  auto topRes = topEm.computeEmbedding();
+
+  // Top-down per cluster, from wherever the top level put its root: a
+  // point of the root's merging segment, which may have been narrowed to
+  // clear blockages for a buffer.
+  std::vector<pt_t> attach(numClusters);
+  for (const auto &node : topRes.Topology.Nodes) {
+    if (node.Kind == clksyn::TreeNode::SINK) {
+      attach[node.Idx - 1] = pt_t{.x = node.x, .y = node.y};
+    }
+  }
+  std::vector<EmbeddingResult> clusterRes(numClusters);
+  forEachCluster(
+      [&](int32_t c) { clusterRes[c] = managers[c]->embedFrom(attach[c]); });
+
+  // Stitch: sinks keep their global index, internal nodes of the clusters
+  // and the top level are numbered after them.
+  res.BufferType = topRes.BufferType;
+  res.Root = topRes.Root;
+  res.Edges.resize(2 * numSinks + 1);
+  int32_t nextIdx = numSinks + 1;
+  std::vector<int32_t> clusterRoot(numClusters);
+  for (int32_t c = 0; c < numClusters; ++c) {
+    clusterRoot[c] = appendSubtree(res, clusterRes[c], clusters[c], nextIdx);
+  }
+
+  std::vector<int32_t> global(topRes.Edges.size(), 0);
+  for (auto node : topRes.Topology.Nodes) {
+    if (node.Kind == clksyn::TreeNode::SINK) {
+      // the edge into a cluster root is a stitching edge of the top level
+      global[node.Idx] = clusterRoot[node.Idx - 1];
+      res.Edges[clusterRoot[node.Idx - 1]] = topRes.Edges[node.Idx];
+    } else if (node.Kind == clksyn::TreeNode::INTERNAL) {
+      global[node.Idx] = nextIdx++;
+      res.Edges[global[node.Idx]] = topRes.Edges[node.Idx];
+      node.Idx = global[node.Idx];
+      topology.Nodes.push_back(node);
+    }
+  }
+  for (const auto &[from, to] : topRes.Topology.Edges) {
+    topology.Edges.push_back({global[from], global[to]});
+  }
+
+  topology.Nodes.push_back(source);
+  for (int32_t i = 0; i < numSinks; ++i) {
+    topology.Tags[i + 1] = inp_.sinks[i].id;
+  }
+  return res;
+}
+
+} // namespace dme
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "dme.hpp"
+#include "hierarchical.hpp"
+#include "threadpool.hpp"
+#include "topology.hpp"
+
+namespace dme {
+
+// Settings for the H-tree flow. Every leaf region gets its own topology
+// and embedding with these settings.
+struct HTreeSettings {
+  clksyn::TreeSynthesisSettings Topology;
+  EmbeddingSettings Embedding;
+  // Levels of the trunk, the floorplan is cut into 2^Depth leaf regions.
+  // Clamped to [0, 20].
+  int32_t Depth = 4;
+  // Leaf regions are synthesised in parallel, each one serially.
+  int32_t Threads = 1;
+};
+
+// Structured top level for designs with uniform sink density. The
+// `simulation` floorplan is halved recursively, across its longer side,
+// into 2^Depth leaf regions. The trunk connects the region centres, each
+// parent sits halfway between its children, so it is a symmetric H-tree.
+// Sinks go to the leaf whose region contains them and every leaf runs its
+// own DME, which leaves synthesis dominated by small independent problems.
+//
+// A geometrically symmetric trunk is only zero skew when the leaf subtrees
+// are identical. Whatever differs between them (delay, load, buffers) is
+// balanced on the trunk itself: at every branch the faster side is snaked
+// until both arrive together, so the branch points never move.
+struct HTreeSynthesis {
+  HTreeSynthesis(inparams, HTreeSettings);
+
+  EmbeddingResult computeEmbedding();
+
+private:
+  // Trunk node k has children 2k + 1 and 2k + 2, the last 2^Depth nodes
+  // are the leaves.
+  struct Region {
+    int64_t X0, Y0, X1, Y1;
+
+    pt_t center() const { return pt_t{.x = (X0 + X1) / 2, .y = (Y0 + Y1) / 2}; }
+    bool splitsX() const { return X1 - X0 >= Y1 - Y0; }
+  };
+
+  int32_t leafOf(const sink &) const;
+
+  inparams inp_;
+  HTreeSettings sett_;
+  std::vector<Region> trunk_;
+  int32_t firstLeaf_ = 0;
+};
+
+inline HTreeSynthesis::HTreeSynthesis(inparams inp, HTreeSettings sett)
+    : inp_(inp), sett_(sett) {
+  auto depth = std::clamp(sett_.Depth, 0, 20);
+  firstLeaf_ = (1 << depth) - 1;
+  trunk_.resize(2 * firstLeaf_ + 1);
+  const auto &fp = inp_.smul;
+  trunk_[0] = Region{.X0 = std::min(fp.lower_left.x, fp.upper_right.x),
+                     .Y0 = std::min(fp.lower_left.y, fp.upper_right.y),
+                     .X1 = std::max(fp.lower_left.x, fp.upper_right.x),
+                     .Y1 = std::max(fp.lower_left.y, fp.upper_right.y)};
+  for (int32_t k = 0; k < firstLeaf_; ++k) {
+    auto lo = trunk_[k], hi = trunk_[k];
+    if (trunk_[k].splitsX()) {
+      lo.X1 = hi.X0 = trunk_[k].center().x;
+    } else {
+      lo.Y1 = hi.Y0 = trunk_[k].center().y;
+    }
+    trunk_[2 * k + 1] = lo;
+    trunk_[2 * k + 2] = hi;
+  }
+}
+
+// Descends along the cuts, sinks outside the floorplan end up in the
+// nearest border region.
+inline int32_t HTreeSynthesis::leafOf(const sink &s) const {
+  int32_t k = 0;
+  while (k < firstLeaf_) {
+    auto mid = trunk_[k].center();
+    auto upper = trunk_[k].splitsX() ? s.cord.x >= mid.x : s.cord.y >= mid.y;
+    k = 2 * k + 1 + upper;
+  }
+  return k;
+}
+
+inline EmbeddingResult HTreeSynthesis::computeEmbedding() {
+  auto numSinks = static_cast<int32_t>(inp_.sinks.size());
+  auto numTrunk = static_cast<int32_t>(trunk_.size());
+  EmbeddingResult res;
+  auto &topology = res.Topology;
+  topology.Tags[0] = inp_.src.source_name;
+  auto source = clksyn::TreeNode{.Kind = clksyn::TreeNode::SOURCE,
+                                 .Idx = 0,
+                                 .x = inp_.src.pt.x,
+                                 .y = inp_.src.pt.y,
+                                 .LdCap = 0};
+  if (numSinks == 0) {
+    topology.Nodes.push_back(source);
+    return res;
+  }
+
+  // Occupied leaves only, empty regions are pruned from the trunk.
+  std::vector<std::vector<int32_t>> regionSinks(numTrunk);
+  for (int32_t i = 0; i < numSinks; ++i) {
+    regionSinks[leafOf(inp_.sinks[i])].push_back(i);
+  }
+  std::vector<int32_t> leaves;
+  for (int32_t k = firstLeaf_; k < numTrunk; ++k) {
+    if (!regionSinks[k].empty()) {
+      leaves.push_back(k);
+    }
+  }
+  auto numLeaves = static_cast<int32_t>(leaves.size());
+
+  std::unique_ptr<clksyn::ThreadPool> pool;
+  if (sett_.Threads > 1) {
+    pool = std::make_unique<clksyn::ThreadPool>(sett_.Threads);
+  }
+  auto leafTopo = sett_.Topology;
+  leafTopo.Threads = 1;
+  auto leafEmb = sett_.Embedding;
+  leafEmb.Threads = 1;
+
+  // Local DME per region, tapped from the region centre.
+  std::vector<EmbeddingResult> leafRes(numLeaves);
+  std::vector<DMENode> roots(numLeaves);
+  clksyn::parallelFor(pool.get(), numLeaves, [&](int32_t l) {
+    auto sub = subsetSinks(inp_, regionSinks[leaves[l]]);
+    auto top = clksyn::TreeSynthesis(sub, leafTopo).getTopology();
+    auto em = EmbeddingManager(sub, top, leafEmb);
+    roots[l] = em.mergingTree();
+    leafRes[l] = em.embedFrom(trunk_[leaves[l]].center());
+  });
+
+  // Bottom-up over the trunk: load and delay seen at every branch point,
+  // and the edge from each trunk node up to its parent.
+  auto wireTable = makeWireTable(inp_.wires);
+  auto buffer = selectBuffer(inp_, sett_.Embedding);
+  auto capBudget = sett_.Embedding.CapBudget * inp_.smul.cap_limit;
+  std::vector<DMENode> state(numTrunk);
+  std::vector<EmbeddedEdge> edges(numTrunk);
+  std::vector<bool> used(numTrunk, false);
+  auto at = [&](int32_t k) { return makeCore(trunk_[k].center()); };
+
+  for (int32_t l = 0; l < numLeaves; ++l) {
+    // same wire and length as the root edge `embedFrom` produced
+    const auto &root = roots[l];
+    auto k = leaves[l];
+    auto len = manhattanDistance(trunk_[k].center(), root.Core);
+    const auto &wm = wireTable[selectSourceWire(len, root.LdCap, wireTable,
+                                                sett_.Embedding)];
+    state[k] = DMENode{.Core = at(k),
+                       .LdCap = root.LdCap + len * wm.C,
+                       .Delay = root.Delay + wm.delay(len, root.LdCap)};
+    used[k] = true;
+  }
+
+  for (int32_t k = firstLeaf_ - 1; k >= 0; --k) {
+    auto a = 2 * k + 1, b = 2 * k + 2;
+    if (!used[a] && !used[b]) {
+      continue;
+    }
+    used[k] = true;
+    auto center = trunk_[k].center();
+    if (!used[a] || !used[b]) {
+      // a single occupied half, plain wire down to it
+      auto kid = used[a] ? a : b;
+      auto len = manhattanDistance(center, state[kid].Core);
+      auto wireIdx =
+          selectSourceWire(len, state[kid].LdCap, wireTable, sett_.Embedding);
+      const auto &wm = wireTable[wireIdx];
+      edges[kid] = edgeInto(state[kid], wireIdx, len);
+      state[k] =
+          DMENode{.Core = at(k),
+                  .LdCap = state[kid].LdCap + len * wm.C,
+                  .Delay = state[kid].Delay + wm.delay(len, state[kid].LdCap)};
+      continue;
+    }
+
+    auto wireIdx = sett_.Embedding.WireType;
+    if (wireIdx < 0 || static_cast<size_t>(wireIdx) >= wireTable.size()) {
+      wireIdx = selectWire(state[a], state[b], wireTable,
+                           sett_.Embedding.WireCapWeight);
+    }
+    auto &lhs = state[a], &rhs = state[b];
+    if (buffer != -1) {
+      bufferToBudget(lhs, rhs, inp_.wires[wireIdx], inp_.buffers[buffer],
+                     capBudget, inp_.blockages);
+    }
+    const auto &wm = wireTable[wireIdx];
+    auto lenA = manhattanDistance(center, lhs.Core);
+    auto lenB = manhattanDistance(center, rhs.Core);
+    auto delayA = lhs.Delay + wm.delay(lenA, lhs.LdCap);
+    auto delayB = rhs.Delay + wm.delay(lenB, rhs.LdCap);
+    if (delayA < delayB) {
+      lenA = std::max<int64_t>(
+          lenA,
+          std::llround(balancingLength(lhs.Delay, lhs.LdCap, delayB, wm)));
+      delayA = lhs.Delay + wm.delay(lenA, lhs.LdCap);
+    } else if (delayB < delayA) {
+      lenB = std::max<int64_t>(
+          lenB,
+          std::llround(balancingLength(rhs.Delay, rhs.LdCap, delayA, wm)));
+      delayB = rhs.Delay + wm.delay(lenB, rhs.LdCap);
+    }
+    edges[a] = edgeInto(lhs, wireIdx, lenA);
+    edges[b] = edgeInto(rhs, wireIdx, lenB);
+    state[k] = DMENode{.Core = at(k),
+                       .LdCap = lhs.LdCap + rhs.LdCap + (lenA + lenB) * wm.C,
+                       .Delay = std::max(delayA, delayB)};
+  }
+
+  // Stitch: sinks keep their global index, the leaf subtrees and then the
+  // trunk are numbered after them.
+  res.BufferType = std::max(buffer, 0);
+  res.Root = state[0];
+  res.Edges.resize(2 * numSinks + numTrunk + 1);
+  int32_t nextIdx = numSinks + 1;
+  std::vector<int32_t> subRoot(numLeaves);
+  for (int32_t l = 0; l < numLeaves; ++l) {
+    subRoot[l] =
+        appendSubtree(res, leafRes[l], regionSinks[leaves[l]], nextIdx);
+  }
+
+  std::vector<int32_t> global(numTrunk, 0);
+  for (int32_t k = 0; k < numTrunk; ++k) {
+    if (!used[k]) {
+      continue;
+    }
+    global[k] = nextIdx++;
+    auto center = trunk_[k].center();
+    topology.Nodes.push_back(
+        clksyn::TreeNode{.Kind = clksyn::TreeNode::INTERNAL,
+                         .Idx = global[k],
+                         .x = center.x,
+                         .y = center.y,
+                         .LdCap = 0});
+    res.Edges[global[k]] = edges[k];
+    topology.Edges.push_back({k == 0 ? 0 : global[(k - 1) / 2], global[k]});
+  }
+  for (int32_t l = 0; l < numLeaves; ++l) {
+    topology.Edges.push_back({global[leaves[l]], subRoot[l]});
+  }
+
+  // source edge into the trunk root
+  auto srcLen = manhattanDistance(
+      pt_t{.x = inp_.src.pt.x, .y = inp_.src.pt.y}, state[0].Core);
+  res.Edges[global[0]] = edgeInto(
+      state[0],
+      selectSourceWire(srcLen, state[0].LdCap, wireTable, sett_.Embedding),
+      srcLen);
+
+  topology.Nodes.push_back(source);
+  for (int32_t i = 0; i < numSinks; ++i) {
+    topology.Tags[i + 1] = inp_.sinks[i].id;
+  }
+  return res;
+}
+
+} // namespace dme
@@ -0,0 +1,347 @@
+#pragma once
+
+#include "dme.hpp"
+#include "threadpool.hpp"
+#include "topology.hpp"
+
+#include <array>
+#include <atomic>
+#include <stdexcept>
+
+namespace dme {
+
+// Settings for the rotation post-pass over a topology.
+struct LocalSearchSettings {
+  EmbeddingSettings Embedding;
+  // Sweeps over the tree. The search stops early after a sweep that
+  // commits nothing.
+  int32_t Rounds = 8;
+  // Disjoint subtrees of at most `TaskCutoff` nodes are swept in parallel,
+  // the nodes above them serially.
+  int32_t Threads = 1;
+  int32_t TaskCutoff = 4096;
+};
+
+struct LocalSearchStats {
+  int64_t Evaluated = 0;
+  int64_t Committed = 0;
+  int32_t Rounds = 0;
+  // Wire and buffer input capacitance (fF) of the zero-skew tree, before
+  // the search and for the returned topology.
+  double CapBefore = 0, CapAfter = 0;
+};
+
+// Local search over rotations and swaps. At an internal node v = (X, Y)
+// whose child X = (X0, X1) is internal, either grandchild can trade places
+// with Y: v = ((X0, Y), X1) or v = ((X1, Y), X0). When Y = (Y0, Y1) is
+// internal as well the grandchildren can also be re-paired across sides,
+// v = ((X0, Y0), (X1, Y1)) or ((X0, Y1), (X1, Y0)). A move is judged by
+// the merges it changes, below v and at v, plus the merge at v's parent,
+// which absorbs the change in delay. That is a constant number of
+// `mergeStep` calls on the merging segments involved, whatever the tree
+// size.
+//
+// Every sweep visits the nodes in post order, so the segments of the
+// children are exact when a node is reached, and re-merges each node
+// after its best improving move is committed. The tree of each sweep is
+// therefore a valid zero-skew DME tree, and the cheapest one is returned.
+// Subtrees below `TaskCutoff` are swept concurrently. The sibling of a
+// subtree root is read from a copy made before the sweep, so the result
+// does not depend on the thread count.
+//
+// Throws std::invalid_argument unless `topology` is a binary tree.
+inline clksyn::TopologyResult
+optimizeTopology(const inparams &inp, clksyn::TopologyResult topology,
+                 const LocalSearchSettings &sett,
+                 LocalSearchStats *stats = nullptr) {
+  auto wireTable = makeWireTable(inp.wires);
+  auto buffer = selectBuffer(inp, sett.Embedding);
+  auto bufferCap = buffer == -1 ? 0. : inp.buffers[buffer].in_cap;
+  auto source = pt_t{.x = inp.src.pt.x, .y = inp.src.pt.y};
+
+  // tree by topology index, Kids[0] is the last child listed
+  int32_t numIdx = 1;
+  for (const auto &node : topology.Nodes) {
+    numIdx = std::max(numIdx, node.Idx + 1);
+  }
+  std::vector<int32_t> parent(numIdx, -1);
+  std::vector<std::array<int32_t, 2>> kids(numIdx, {-1, -1});
+  std::vector<int32_t> numKids(numIdx, 0);
+  std::vector<DMENode> merged(numIdx);
+  std::vector<double> cost(numIdx, 0);
+  std::vector<bool> isSink(numIdx, false);
+  int32_t root = -1;
+  for (const auto &[from, to] : topology.Edges) {
+    if (from == 0) {
+      root = to;
+      continue;
+    }
+    if (numKids[from] == 2) {
+      throw std::invalid_argument("node " + std::to_string(from) +
+                                  " has more than two children");
+    }
+    kids[from][1] = kids[from][0];
+    kids[from][0] = to;
+    parent[to] = from;
+    ++numKids[from];
+  }
+  for (const auto &node : topology.Nodes) {
+    if (node.Kind == clksyn::TreeNode::SOURCE) {
+      continue;
+    }
+    isSink[node.Idx] = node.Kind == clksyn::TreeNode::SINK;
+    if ((numKids[node.Idx] == 0) != isSink[node.Idx] ||
+        numKids[node.Idx] == 1) {
+      throw std::invalid_argument("node " + std::to_string(node.Idx) +
+                                  " is not binary");
+    }
+    if (isSink[node.Idx]) {
+      merged[node.Idx] =
+          DMENode{.Core = makeCore(pt_t{.x = node.x, .y = node.y}),
+                  .LdCap = node.LdCap,
+                  .Delay = 0};
+    }
+  }
+  if (root == -1) {
+    if (stats != nullptr) {
+      *stats = LocalSearchStats{};
+    }
+    return topology;
+  }
+
+  // Wire and buffer capacitance a merge adds, and the merged segment.
+  auto mergeCost = [&](DMENode lhs, DMENode rhs, DMENode *out) {
+    auto step = mergeStep(lhs, rhs, inp, wireTable, sett.Embedding, buffer);
+    if (out != nullptr) {
+      *out = step.Node;
+    }
+    return (step.LenA + step.LenB) * wireTable[step.Wire].C +
+           (lhs.Buffers + rhs.Buffers) * bufferCap;
+  };
+  auto sourceCost = [&] {
+    auto len = manhattanDistance(source, merged[root].Core);
+    auto wire = selectSourceWire(len, merged[root].LdCap, wireTable,
+                                 sett.Embedding);
+    return len * wireTable[wire].C;
+  };
+
+  LocalSearchStats total;
+  std::atomic<int64_t> evaluated = 0, committed = 0;
+  std::unique_ptr<clksyn::ThreadPool> pool;
+  if (sett.Threads > 1) {
+    pool = std::make_unique<clksyn::ThreadPool>(sett.Threads);
+  }
+
+  // Visits `v` with its children up to date. `sibling` is the segment v's
+  // parent merges it with, null at the root.
+  auto visit = [&](int32_t v, const DMENode *sibling, bool search) {
+    if (isSink[v]) {
+      return;
+    }
+    auto parentCost = [&](const DMENode &node) {
+      return sibling == nullptr ? 0. : mergeCost(node, *sibling, nullptr);
+    };
+    DMENode node;
+    cost[v] = mergeCost(merged[kids[v][0]], merged[kids[v][1]], &node);
+    if (!search) {
+      merged[v] = node;
+      return;
+    }
+
+    // A candidate gives v the children `Top`, and each Top[s] whose pair
+    // is re-formed the children Sub[s] ({-1, -1} keeps it as it is).
+    struct Candidate {
+      std::array<int32_t, 2> Top;
+      std::array<std::array<int32_t, 2>, 2> Sub;
+    };
+    constexpr std::array<int32_t, 2> keep{-1, -1};
+    std::array<Candidate, 6> cands;
+    int32_t numCands = 0;
+    for (int32_t side = 0; side < 2; ++side) {
+      auto x = kids[v][side], y = kids[v][1 - side];
+      if (isSink[x]) {
+        continue;
+      }
+      // rotations: a child of X trades places with Y
+      for (int32_t k = 0; k < 2; ++k) {
+        auto &c = cands[numCands++];
+        c.Top[side] = x;
+        c.Top[1 - side] = kids[x][1 - k];
+        c.Sub[side] = {kids[x][k], y};
+        c.Sub[1 - side] = keep;
+      }
+    }
+    auto a = kids[v][0], b = kids[v][1];
+    if (!isSink[a] && !isSink[b]) {
+      // swaps between the two children
+      for (int32_t k = 0; k < 2; ++k) {
+        cands[numCands++] =
+            Candidate{.Top = kids[v],
+                      .Sub = {std::array{kids[a][0], kids[b][k]},
+                              std::array{kids[a][1], kids[b][1 - k]}}};
+      }
+    }
+
+    auto current = cost[v] + parentCost(node);
+    double bestDelta = -1e-9 * std::max(current, 1.);
+    int32_t bestCand = -1;
+    std::array<DMENode, 3> bestNodes;
+    std::array<double, 3> bestCosts{};
+    for (int32_t i = 0; i < numCands; ++i) {
+      const auto &c = cands[i];
+      std::array<DMENode, 3> nodes;
+      std::array<double, 3> costs{};
+      auto delta = -current;
+      for (int32_t s = 0; s < 2; ++s) {
+        if (c.Sub[s] == keep) {
+          nodes[s] = merged[c.Top[s]];
+          continue;
+        }
+        costs[s] = mergeCost(merged[c.Sub[s][0]], merged[c.Sub[s][1]],
+                             &nodes[s]);
+        delta += costs[s] - cost[c.Top[s]];
+      }
+      costs[2] = mergeCost(nodes[0], nodes[1], &nodes[2]);
+      delta += costs[2] + parentCost(nodes[2]);
+      ++evaluated;
+      if (delta < bestDelta) {
+        bestDelta = delta;
+        bestCand = i;
+        bestNodes = nodes;
+        bestCosts = costs;
+      }
+    }
+    if (bestCand == -1) {
+      merged[v] = node;
+      return;
+    }
+
+    const auto &c = cands[bestCand];
+    for (int32_t s = 0; s < 2; ++s) {
+      auto top = c.Top[s];
+      kids[v][s] = top;
+      parent[top] = v;
+      if (c.Sub[s] == keep) {
+        continue;
+      }
+      kids[top] = c.Sub[s];
+      parent[c.Sub[s][0]] = parent[c.Sub[s][1]] = top;
+      merged[top] = bestNodes[s];
+      cost[top] = bestCosts[s];
+    }
+    merged[v] = bestNodes[2];
+    cost[v] = bestCosts[2];
+    ++committed;
+  };
+
+  // One sweep. Subtree roots, the nodes above them and their order are
+  // recomputed every time since rotations above the cutoff move subtrees.
+  auto sweep = [&](bool search) {
+    std::vector<int32_t> order, first(numIdx, 0), size(numIdx, 1);
+    std::vector<std::pair<int32_t, int32_t>> stack{{root, 0}};
+    while (!stack.empty()) {
+      auto [v, next] = stack.back();
+      if (!isSink[v] && next < 2) {
+        ++stack.back().second;
+        stack.push_back({kids[v][next], 0});
+        continue;
+      }
+      stack.pop_back();
+      first[v] = order.size();
+      if (!isSink[v]) {
+        first[v] = first[kids[v][0]];
+        size[v] = 1 + size[kids[v][0]] + size[kids[v][1]];
+      }
+      order.push_back(v);
+    }
+
+    auto cutoff = std::max(sett.TaskCutoff, 1);
+    std::vector<int32_t> tasks, top;
+    std::vector<int32_t> pos(numIdx, 0);
+    for (size_t i = 0; i < order.size(); ++i) {
+      auto v = order[i];
+      pos[v] = i;
+      if (size[v] > cutoff) {
+        top.push_back(v);
+      } else if (v == root || size[parent[v]] > cutoff) {
+        tasks.push_back(v);
+      }
+    }
+    auto siblingOf = [&](int32_t v) {
+      auto p = parent[v];
+      return kids[p][0] == v ? kids[p][1] : kids[p][0];
+    };
+    std::vector<DMENode> frozen(tasks.size());
+    for (size_t t = 0; t < tasks.size(); ++t) {
+      if (tasks[t] != root) {
+        frozen[t] = merged[siblingOf(tasks[t])];
+      }
+    }
+
+    clksyn::parallelFor(
+        pool.get(), static_cast<int32_t>(tasks.size()), [&](int32_t t) {
+          auto taskRoot = tasks[t];
+          for (auto i = first[taskRoot]; i <= pos[taskRoot]; ++i) {
+            auto v = order[i];
+            const DMENode *sibling = nullptr;
+            if (v == taskRoot) {
+              sibling = v == root ? nullptr : &frozen[t];
+            } else {
+              sibling = &merged[siblingOf(v)];
+            }
+            visit(v, sibling, search);
+          }
+        });
+    for (auto v : top) {
+      visit(v, v == root ? nullptr : &merged[siblingOf(v)], search);
+    }
+
+    auto sum = sourceCost();
+    for (auto v : order) {
+      sum += cost[v];
+    }
+    return sum;
+  };
+
+  total.CapBefore = total.CapAfter = sweep(false);
+  auto bestParent = parent;
+  auto bestKids = kids;
+  for (int32_t round = 0; round < sett.Rounds; ++round) {
+    auto before = committed.load();
+    auto cap = sweep(true);
+    ++total.Rounds;
+    if (cap < total.CapAfter) {
+      total.CapAfter = cap;
+      bestParent = parent;
+      bestKids = kids;
+    }
+    if (committed.load() == before) {
+      break;
+    }
+  }
+  total.Evaluated = evaluated.load();
+  total.Committed = committed.load();
+  if (stats != nullptr) {
+    *stats = total;
+  }
+
+  // Same nodes, new edges; internal nodes sit on their merging segments.
+  parent = std::move(bestParent);
+  kids = std::move(bestKids);
+  sweep(false);
+  topology.Edges.clear();
+  topology.Edges.push_back({0, root});
+  for (auto &node : topology.Nodes) {
+    if (node.Kind != clksyn::TreeNode::INTERNAL) {
+      continue;
+    }
+    node.x = merged[node.Idx].Core.First.x;
+    node.y = merged[node.Idx].Core.First.y;
+    node.LdCap = merged[node.Idx].LdCap;
+    topology.Edges.push_back({node.Idx, kids[node.Idx][1]});
+    topology.Edges.push_back({node.Idx, kids[node.Idx][0]});
+  }
+  return topology;
+}
+
+} // namespace dme
@@ -60,8 +60,8 @@ struct buffer { // Probably not needed ?
   std::string id;
   std::string cktname;
   int inverted;
-  int64_t in_cap;
-  int64_t out_cap;
+  float in_cap;
+  float out_cap;
   float resistance;
 };
 
@@ -81,12 +81,14 @@ struct out_node {
 
 struct out_wire {
   std::string from, to;
-  int type;
+  // library code, `wire::type`
+  std::string type;
 };
 
 struct out_buffer {
   std::string from, to;
-  int type;
+  // library code, `buffer::id`
+  std::string type;
 };
 
 struct out_sink {
@@ -153,7 +155,7 @@ inline inparams parse(std::string filename) {
             iter = num_wires;
           } else {
             wire curr;
-            s >> curr.type >> curr.cap >> curr.resistance;
+            s >> curr.type >> curr.resistance >> curr.cap;
             iter--;
             output_pkt.wires.push_back(curr);
             if (iter == 0) {
@@ -242,3 +244,34 @@ inline void print_output(std::string filename, struct outparams t) {
 
   file.close();
 }
+
+// Reads back a file written by `print_output`.
+inline outparams parse_output(std::string filename) {
+  outparams output_pkt;
+  std::ifstream file(filename);
+  std::string tag, name;
+  size_t count = 0;
+
+  file >> tag >> output_pkt.src.node_name >> output_pkt.src.src_name;
+  file >> tag >> name >> count;
+  output_pkt.nodes.resize(count);
+  for (auto &node : output_pkt.nodes) {
+    file >> node.name >> node.pt.x >> node.pt.y;
+  }
+  file >> tag >> name >> count;
+  output_pkt.sinks.resize(count);
+  for (auto &sink : output_pkt.sinks) {
+    file >> sink.node_name >> sink.sink_name;
+  }
+  file >> tag >> name >> count;
+  output_pkt.wires.resize(count);
+  for (auto &wire : output_pkt.wires) {
+    file >> wire.from >> wire.to >> wire.type;
+  }
+  file >> tag >> name >> count;
+  output_pkt.buffers.resize(count);
+  for (auto &buffer : output_pkt.buffers) {
+    file >> buffer.from >> buffer.to >> buffer.type;
+  }
+  return output_pkt;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace clksyn {
+
+// Monotone priority queue over unsigned integer keys (radix heap). Bucket
+// i > 0 holds keys whose highest bit differing from the last popped key is
+// bit i - 1, bucket 0 holds keys equal to it. A pop only redistributes the
+// first non-empty bucket, and every key moves to a strictly lower bucket
+// when it does, so push and pop are amortised O(1) per bit of the key.
+//
+// Keys below the last popped one break the monotone order. They are rare
+// (NNA only produces them when a merge lands close to an older node) and
+// are kept in a binary heap that always pops first, since all of its keys
+// are smaller than anything in the buckets.
+template <typename T> struct RadixHeap {
+  void push(uint64_t key, T value);
+  std::pair<uint64_t, T> pop();
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+private:
+  using Entry = std::pair<uint64_t, T>;
+
+  static int32_t bucketOf(uint64_t key, uint64_t last) {
+    return key == last ? 0 : 64 - __builtin_clzll(key ^ last);
+  }
+  void refill();
+
+  std::array<std::vector<Entry>, 65> buckets_;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>
+      underflow_;
+  uint64_t last_ = 0;
+  size_t size_ = 0;
+};
+
+template <typename T> inline void RadixHeap<T>::push(uint64_t key, T value) {
+  ++size_;
+  if (key < last_) {
+    underflow_.emplace(key, std::move(value));
+    return;
+  }
+  buckets_[bucketOf(key, last_)].emplace_back(key, std::move(value));
+}
+
+// Moves the smallest keys into bucket 0, raising `last_` to their value.
+template <typename T> inline void RadixHeap<T>::refill() {
+  if (!buckets_[0].empty()) {
+    return;
+  }
+  size_t i = 1;
+  while (buckets_[i].empty()) {
+    ++i;
+  }
+  auto &from = buckets_[i];
+  last_ = from.front().first;
+  for (const auto &entry : from) {
+    last_ = std::min(last_, entry.first);
+  }
+  for (auto &entry : from) {
+    buckets_[bucketOf(entry.first, last_)].push_back(std::move(entry));
+  }
+  // Drop the capacity as well. Entries only leave the upper buckets this
+  // way, so each of them stays within twice its current size.
+  std::vector<Entry>().swap(from);
+}
+
+template <typename T> inline std::pair<uint64_t, T> RadixHeap<T>::pop() {
+  --size_;
+  if (!underflow_.empty()) {
+    auto top = underflow_.top();
+    underflow_.pop();
+    return top;
+  }
+  refill();
+  auto top = std::move(buckets_[0].back());
+  buckets_[0].pop_back();
+  return top;
+}
+
+} // end namespace clksyn
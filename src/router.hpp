@@ -0,0 +1,669 @@
+#pragma once
+
+#include "dme.hpp"
+#include "threadpool.hpp"
+
+#include <queue>
+
+namespace dme {
+
+// Settings for routing the embedded edges around the blockages.
+struct RouterSettings {
+  int32_t Threads = 1;
+  // Lengthen the faster side of every merge after routing, so the
+  // detours do not turn into skew.
+  bool Rebalance = true;
+  // Take edges with an end inside a blockage (DME may place a merge point
+  // there) out of it by the nearest side. Off leaves them direct, which
+  // costs less wire.
+  bool Escape = true;
+};
+
+struct RouterStats {
+  int64_t Edges = 0;
+  // Edges routed with an explicit bend or around a blockage, and those of
+  // them no L shape could clear, which were searched.
+  int64_t Bent = 0, Searched = 0;
+  // Searches answered from the cache of a worker.
+  int64_t CacheHits = 0;
+  // Edges with an end inside a blockage that leave it by the nearest
+  // side, and edges left direct: both ends inside the same blockage, or
+  // no path around.
+  int64_t Escaped = 0, Unroutable = 0;
+  // Wire (dbu) added by the detours, and by rebalancing after them.
+  int64_t Detour = 0, Rebalanced = 0;
+  // Merge and tap points moved out of blockages before routing, buffer
+  // stubs folded onto their cells included.
+  int64_t Moved = 0;
+  // Edges longer than their path that got a clear detour for the rest,
+  // and those no single detour keeps clear, which `toOutParam` snakes.
+  int64_t Snaked = 0, Unsnaked = 0;
+};
+
+// The blockages over the grid of their sides: the distinct x and y
+// coordinates of all rectangles cut the plane into cells that are either
+// inside some blockage or free. Wires may run along the sides, only the
+// interior of a blockage is off limits.
+struct BlockageGrid {
+  explicit BlockageGrid(const std::vector<Blockage> &blockages);
+
+  bool empty() const { return rects_.empty(); }
+  // Whether `pt` lies strictly inside a blockage, and whether one
+  // blockage holds both points.
+  bool inside(pt_t pt) const;
+  bool insideSame(pt_t a, pt_t b) const;
+  // Points a wire from `pt` passes to leave the blockages around it by
+  // the nearest side, empty if `pt` is outside.
+  std::vector<pt_t> escape(pt_t pt) const;
+  // Whether the axis-parallel wire from `a` to `b` passes through the
+  // interior of a blockage.
+  bool crosses(pt_t a, pt_t b) const;
+
+  const std::vector<int64_t> &xs() const { return xs_; }
+  const std::vector<int64_t> &ys() const { return ys_; }
+
+private:
+  bool blocked(int64_t col, int64_t row) const;
+  bool crossesAlongX(int64_t y, int64_t lo, int64_t hi) const;
+  bool crossesAlongY(int64_t x, int64_t lo, int64_t hi) const;
+
+  std::vector<Blockage> rects_;
+  std::vector<int64_t> xs_, ys_;
+  // cell (i, j) spans xs_[i]..xs_[i + 1] and ys_[j]..ys_[j + 1]
+  std::vector<uint8_t> cells_;
+};
+
+inline BlockageGrid::BlockageGrid(const std::vector<Blockage> &blockages) {
+  for (auto rect : blockages) {
+    if (rect.x1 > rect.x2) {
+      std::swap(rect.x1, rect.x2);
+    }
+    if (rect.y1 > rect.y2) {
+      std::swap(rect.y1, rect.y2);
+    }
+    if (rect.x1 == rect.x2 || rect.y1 == rect.y2) {
+      continue;
+    }
+    rects_.push_back(rect);
+    xs_.insert(xs_.end(), {rect.x1, rect.x2});
+    ys_.insert(ys_.end(), {rect.y1, rect.y2});
+  }
+  for (auto *lines : {&xs_, &ys_}) {
+    std::sort(lines->begin(), lines->end());
+    lines->erase(std::unique(lines->begin(), lines->end()), lines->end());
+  }
+  if (rects_.empty()) {
+    return;
+  }
+
+  // mark the cells of every rectangle through 2-D prefix sums
+  auto cols = static_cast<int64_t>(xs_.size()),
+       rows = static_cast<int64_t>(ys_.size());
+  std::vector<int32_t> cover(cols * rows, 0);
+  auto pos = [](const std::vector<int64_t> &lines, int64_t v) {
+    return std::lower_bound(lines.begin(), lines.end(), v) - lines.begin();
+  };
+  for (const auto &rect : rects_) {
+    auto i1 = pos(xs_, rect.x1), i2 = pos(xs_, rect.x2);
+    auto j1 = pos(ys_, rect.y1), j2 = pos(ys_, rect.y2);
+    ++cover[i1 * rows + j1];
+    --cover[i2 * rows + j1];
+    --cover[i1 * rows + j2];
+    ++cover[i2 * rows + j2];
+  }
+  for (int64_t i = 0; i < cols; ++i) {
+    for (int64_t j = 0; j < rows; ++j) {
+      auto &c = cover[i * rows + j];
+      c += (i > 0 ? cover[(i - 1) * rows + j] : 0) +
+           (j > 0 ? cover[i * rows + j - 1] : 0) -
+           (i > 0 && j > 0 ? cover[(i - 1) * rows + j - 1] : 0);
+    }
+  }
+  cells_.resize(cols * rows);
+  for (size_t c = 0; c < cover.size(); ++c) {
+    cells_[c] = cover[c] > 0;
+  }
+}
+
+inline bool BlockageGrid::blocked(int64_t col, int64_t row) const {
+  auto rows = static_cast<int64_t>(ys_.size());
+  if (col < 0 || row < 0 || col + 1 >= static_cast<int64_t>(xs_.size()) ||
+      row + 1 >= rows) {
+    return false;
+  }
+  return cells_[col * rows + row];
+}
+
+inline bool BlockageGrid::inside(pt_t pt) const {
+  return std::any_of(rects_.begin(), rects_.end(), [&](const auto &rect) {
+    return rect.x1 < pt.x && pt.x < rect.x2 && rect.y1 < pt.y &&
+           pt.y < rect.y2;
+  });
+}
+
+inline bool BlockageGrid::insideSame(pt_t a, pt_t b) const {
+  return std::any_of(rects_.begin(), rects_.end(), [&](const auto &rect) {
+    return rect.x1 < std::min(a.x, b.x) && std::max(a.x, b.x) < rect.x2 &&
+           rect.y1 < std::min(a.y, b.y) && std::max(a.y, b.y) < rect.y2;
+  });
+}
+
+inline std::vector<pt_t> BlockageGrid::escape(pt_t pt) const {
+  std::vector<pt_t> res;
+  // a side may lie inside an overlapping blockage, which is left next
+  for (size_t step = 0; step < rects_.size(); ++step) {
+    auto it = std::find_if(rects_.begin(), rects_.end(), [&](const auto &r) {
+      return r.x1 < pt.x && pt.x < r.x2 && r.y1 < pt.y && pt.y < r.y2;
+    });
+    if (it == rects_.end()) {
+      break;
+    }
+    auto left = pt.x - it->x1, right = it->x2 - pt.x;
+    auto down = pt.y - it->y1, up = it->y2 - pt.y;
+    auto nearest = std::min({left, right, down, up});
+    if (nearest == left || nearest == right) {
+      pt.x = nearest == left ? it->x1 : it->x2;
+    } else {
+      pt.y = nearest == down ? it->y1 : it->y2;
+    }
+    res.push_back(pt);
+  }
+  return res;
+}
+
+// A wire along y is inside a blockage where the cells on both of its
+// sides are, which is the same cell unless y is a grid line.
+inline bool BlockageGrid::crossesAlongX(int64_t y, int64_t lo,
+                                        int64_t hi) const {
+  if (lo >= hi || y <= ys_.front() || y >= ys_.back() || hi <= xs_.front() ||
+      lo >= xs_.back()) {
+    return false;
+  }
+  auto above = std::upper_bound(ys_.begin(), ys_.end(), y) - ys_.begin() - 1;
+  auto below = ys_[above] == y ? above - 1 : above;
+  auto col = std::max<int64_t>(
+      std::upper_bound(xs_.begin(), xs_.end(), lo) - xs_.begin() - 1, 0);
+  for (; col + 1 < static_cast<int64_t>(xs_.size()) && xs_[col] < hi;
+       ++col) {
+    if (blocked(col, above) && blocked(col, below)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool BlockageGrid::crossesAlongY(int64_t x, int64_t lo,
+                                        int64_t hi) const {
+  if (lo >= hi || x <= xs_.front() || x >= xs_.back() || hi <= ys_.front() ||
+      lo >= ys_.back()) {
+    return false;
+  }
+  auto right = std::upper_bound(xs_.begin(), xs_.end(), x) - xs_.begin() - 1;
+  auto left = xs_[right] == x ? right - 1 : right;
+  auto row = std::max<int64_t>(
+      std::upper_bound(ys_.begin(), ys_.end(), lo) - ys_.begin() - 1, 0);
+  for (; row + 1 < static_cast<int64_t>(ys_.size()) && ys_[row] < hi;
+       ++row) {
+    if (blocked(left, row) && blocked(right, row)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool BlockageGrid::crosses(pt_t a, pt_t b) const {
+  if (rects_.empty()) {
+    return false;
+  }
+  if (a.y == b.y) {
+    return crossesAlongX(a.y, std::min(a.x, b.x), std::max(a.x, b.x));
+  }
+  return crossesAlongY(a.x, std::min(a.y, b.y), std::max(a.y, b.y));
+}
+
+// Path of one wire: the points it bends at, in order from the parent, and
+// its length.
+struct RoutedPath {
+  std::vector<pt_t> Bends;
+  int64_t Length = 0;
+};
+
+// Scratch of one routing worker, reused across its searches, and its
+// cache of searched wires by end points.
+struct RouteContext {
+  std::vector<int64_t> Xs, Ys, Dist;
+  std::vector<int32_t> Prev;
+  std::map<std::pair<pt_t, pt_t>, std::optional<RoutedPath>> Cache;
+};
+
+// Shortest path from `a` to `b` clear of the blockage interiors, by A* on
+// the Hanan grid of the blockage sides and the two end points. Some
+// shortest rectilinear path always runs along those lines. Returns
+// nothing if the blockages enclose an end.
+inline std::optional<RoutedPath> searchRoute(const BlockageGrid &grid,
+                                             pt_t a, pt_t b,
+                                             RouteContext &ctx) {
+  auto key = std::minmax(a, b);
+  if (auto it = ctx.Cache.find(key); it != ctx.Cache.end()) {
+    auto path = it->second;
+    if (path && key.first != a) {
+      std::reverse(path->Bends.begin(), path->Bends.end());
+    }
+    return path;
+  }
+
+  auto lines = [](std::vector<int64_t> &out, const std::vector<int64_t> &in,
+                  int64_t u, int64_t v) {
+    out = in;
+    out.insert(out.end(), {u, v});
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+  };
+  lines(ctx.Xs, grid.xs(), a.x, b.x);
+  lines(ctx.Ys, grid.ys(), a.y, b.y);
+  auto cols = static_cast<int32_t>(ctx.Xs.size()),
+       rows = static_cast<int32_t>(ctx.Ys.size());
+  auto at = [&](int32_t id) {
+    return pt_t{.x = ctx.Xs[id / rows], .y = ctx.Ys[id % rows]};
+  };
+  auto idOf = [&](pt_t p) {
+    auto i = std::lower_bound(ctx.Xs.begin(), ctx.Xs.end(), p.x) -
+             ctx.Xs.begin();
+    auto j = std::lower_bound(ctx.Ys.begin(), ctx.Ys.end(), p.y) -
+             ctx.Ys.begin();
+    return static_cast<int32_t>(i * rows + j);
+  };
+  ctx.Dist.assign(static_cast<size_t>(cols) * rows,
+                  std::numeric_limits<int64_t>::max());
+  ctx.Prev.assign(ctx.Dist.size(), -1);
+
+  constexpr std::pair<int32_t, int32_t> steps[] = {
+      {1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  auto source = idOf(a), target = idOf(b);
+  using Entry = std::pair<int64_t, int32_t>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<>> open;
+  ctx.Dist[source] = 0;
+  open.push({manhattanDistance(a, b), source});
+  while (!open.empty()) {
+    auto [f, id] = open.top();
+    open.pop();
+    auto here = at(id);
+    if (f - manhattanDistance(here, b) > ctx.Dist[id]) {
+      continue;
+    }
+    if (id == target) {
+      break;
+    }
+    auto i = id / rows, j = id % rows;
+    for (auto [di, dj] : steps) {
+      if (i + di < 0 || i + di >= cols || j + dj < 0 || j + dj >= rows) {
+        continue;
+      }
+      auto next = (i + di) * rows + j + dj;
+      auto there = at(next);
+      if (grid.crosses(here, there)) {
+        continue;
+      }
+      auto d = ctx.Dist[id] + manhattanDistance(here, there);
+      if (d < ctx.Dist[next]) {
+        ctx.Dist[next] = d;
+        ctx.Prev[next] = id;
+        open.push({d + manhattanDistance(there, b), next});
+      }
+    }
+  }
+
+  std::optional<RoutedPath> res;
+  if (ctx.Prev[target] != -1 || source == target) {
+    res = RoutedPath{};
+    res->Length = ctx.Dist[target];
+    // walk back, keeping only the points where the direction changes
+    std::vector<pt_t> points{b};
+    for (auto id = ctx.Prev[target]; id != -1; id = ctx.Prev[id]) {
+      points.push_back(at(id));
+    }
+    std::reverse(points.begin(), points.end());
+    for (size_t p = 1; p + 1 < points.size(); ++p) {
+      auto prev = points[p - 1], here = points[p], next = points[p + 1];
+      if ((prev.x == here.x) != (here.x == next.x)) {
+        res->Bends.push_back(here);
+      }
+    }
+  }
+  auto cached = res;
+  if (cached && key.first != a) {
+    std::reverse(cached->Bends.begin(), cached->Bends.end());
+  }
+  ctx.Cache.emplace(key, std::move(cached));
+  return res;
+}
+
+// Re-times `tree` bottom up and lengthens the faster subtree of every
+// merge until it catches up, see `routeEdges`.
+inline void rebalance(const inparams &inp, EmbeddingResult &tree,
+                      RouterStats &stats) {
+  const auto &topology = tree.Topology;
+  int32_t numIdx = 0;
+  for (const auto &node : topology.Nodes) {
+    numIdx = std::max(numIdx, node.Idx + 1);
+  }
+  auto numEdges = static_cast<int32_t>(topology.Edges.size());
+
+  // children in CSR form and a parents-first order, as `evaluate` does
+  std::vector<int32_t> start(numIdx + 1, 0), kids(numEdges);
+  for (const auto &[from, to] : topology.Edges) {
+    ++start[from + 1];
+  }
+  std::partial_sum(start.begin(), start.end(), start.begin());
+  auto fill = start;
+  for (const auto &[from, to] : topology.Edges) {
+    kids[fill[from]++] = to;
+  }
+  std::vector<int32_t> order{0};
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (auto k = start[order[i]]; k < start[order[i] + 1]; ++k) {
+      order.push_back(kids[k]);
+    }
+  }
+  std::vector<double> sinkCap(numIdx, 0);
+  for (const auto &node : topology.Nodes) {
+    if (node.Kind == clksyn::TreeNode::SINK) {
+      sinkCap[node.Idx] = inp.sinks[node.Idx - 1].cap;
+    }
+  }
+
+  // Bottom up: the load at a node and at the far end of the wire into it,
+  // and the latest delay from the node down to a sink.
+  auto table = makeWireTable(inp.wires);
+  const buffer *buf =
+      inp.buffers.empty() ? nullptr : &inp.buffers[tree.BufferType];
+  std::vector<double> load(numIdx, 0), wireEnd(numIdx, 0), below(numIdx, 0);
+  auto bufferDelay = [&](int32_t kid) {
+    const auto &edge = tree.Edges[kid];
+    if (buf == nullptr || edge.Buffers == 0) {
+      return 0.;
+    }
+    const auto &wm = table[edge.Wire];
+    return buf->resistance * (buf->out_cap + load[kid] + edge.Stub * wm.C) +
+           (edge.Buffers - 1) * buf->resistance *
+               (buf->out_cap + buf->in_cap) +
+           wm.delay(edge.Stub, load[kid]);
+  };
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    auto idx = *it;
+    double target = 0;
+    for (auto k = start[idx]; k < start[idx + 1]; ++k) {
+      auto kid = kids[k];
+      const auto &edge = tree.Edges[kid];
+      target = std::max(target, below[kid] + bufferDelay(kid) +
+                                    table[edge.Wire].delay(edge.Length,
+                                                           wireEnd[kid]));
+    }
+    auto cap = sinkCap[idx];
+    for (auto k = start[idx]; k < start[idx + 1] && idx != 0; ++k) {
+      auto kid = kids[k];
+      auto &edge = tree.Edges[kid];
+      auto len = std::llround(balancingLength(below[kid] + bufferDelay(kid),
+                                              wireEnd[kid], target,
+                                              table[edge.Wire]));
+      if (len > edge.Length) {
+        stats.Rebalanced += len - edge.Length;
+        edge.Length = len;
+      }
+    }
+    for (auto k = start[idx]; k < start[idx + 1]; ++k) {
+      auto kid = kids[k];
+      const auto &edge = tree.Edges[kid];
+      cap += edge.Length * inp.wires[edge.Wire].cap + wireEnd[kid];
+    }
+    load[idx] = cap;
+    wireEnd[idx] = buf != nullptr && tree.Edges[idx].Buffers > 0
+                       ? buf->in_cap
+                       : cap;
+    below[idx] = target;
+  }
+}
+
+// A position `i` in `path` and the points to insert after `path[i]` that
+// make the path `2 * offset` longer and keep it clear of the blockages.
+// The detour pushes one end of a segment away from the other and reaches
+// it by an L, like the snake of `toOutParam`; the segments nearest the end
+// of the path are tried first.
+inline std::optional<std::pair<size_t, std::vector<pt_t>>>
+clearDetour(const BlockageGrid &grid, const std::vector<pt_t> &path,
+            int64_t offset) {
+  auto clear = [&](std::initializer_list<pt_t> pts) {
+    for (auto it = pts.begin(); it + 1 != pts.end(); ++it) {
+      if (grid.crosses(*it, *(it + 1))) {
+        return false;
+      }
+    }
+    return true;
+  };
+  // away from `other` along one axis, either way if level with it
+  auto away = [&](int64_t at, int64_t other) {
+    return at == other ? std::vector<int64_t>{at + offset, at - offset}
+           : at > other ? std::vector<int64_t>{at + offset}
+                        : std::vector<int64_t>{at - offset};
+  };
+  for (auto i = path.size() - 1; i-- > 0;) {
+    auto p = path[i], e = path[i + 1];
+    std::vector<pt_t> ends;
+    for (auto y : away(e.y, p.y)) {
+      ends.push_back(pt_t{.x = e.x, .y = y});
+    }
+    for (auto x : away(e.x, p.x)) {
+      ends.push_back(pt_t{.x = x, .y = e.y});
+    }
+    for (auto d : ends) {
+      for (auto c : {pt_t{.x = d.x, .y = p.y}, pt_t{.x = p.x, .y = d.y}}) {
+        if (clear({p, c, d, e})) {
+          return std::pair{i, std::vector<pt_t>{c, d}};
+        }
+      }
+    }
+    std::vector<pt_t> starts;
+    for (auto y : away(p.y, e.y)) {
+      starts.push_back(pt_t{.x = p.x, .y = y});
+    }
+    for (auto x : away(p.x, e.x)) {
+      starts.push_back(pt_t{.x = x, .y = p.y});
+    }
+    for (auto d : starts) {
+      for (auto c : {pt_t{.x = e.x, .y = d.y}, pt_t{.x = d.x, .y = e.y}}) {
+        if (clear({p, d, c, e})) {
+          return std::pair{i, std::vector<pt_t>{d, c}};
+        }
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+// Routes every edge of `tree` around `inp.blockages` and records the bend
+// points in `tree.Routes`. A direct edge is kept if both of its L shapes
+// are clear, an explicit corner picks the clear one, and only edges that
+// no L clears are searched on the Hanan grid, after leaving the blockages
+// around their ends. Workers split the edges and each keeps its own search
+// scratch and cache.
+//
+// Merge and tap points DME left inside a blockage are first moved to the
+// nearest clear point, and a subtree below a buffer stub onto its cells,
+// so only a sink or the source inside a blockage still has to escape it.
+//
+// Routed lengths become the electrical length of an edge where they
+// exceed it. With `Rebalance` the tree is then re-timed bottom up with the
+// Elmore model of `evaluate`, and the faster subtree of every merge gets
+// wire added until it catches up, so the detours cost wire rather than
+// skew. Wire an edge has beyond its path is snaked through a clear
+// detour, recorded with the bends.
+inline RouterStats routeEdges(const inparams &inp, EmbeddingResult &tree,
+                              const RouterSettings &sett) {
+  RouterStats stats;
+  auto &topology = tree.Topology;
+  stats.Edges = static_cast<int64_t>(topology.Edges.size());
+  BlockageGrid grid(inp.blockages);
+  if (grid.empty()) {
+    return stats;
+  }
+
+  int32_t numIdx = 0;
+  for (const auto &node : topology.Nodes) {
+    numIdx = std::max(numIdx, node.Idx + 1);
+  }
+  std::vector<pt_t> location(numIdx);
+  for (const auto &node : topology.Nodes) {
+    location[node.Idx] = pt_t{.x = node.x, .y = node.y};
+  }
+  // the wire into a node with a stub ends at the buffers on top of it
+  auto endOf = [&](int32_t to) {
+    const auto &edge = tree.Edges[to];
+    return edge.Buffers > 0 && edge.Stub > 0 ? edge.BufferAt : location[to];
+  };
+
+  for (auto &node : topology.Nodes) {
+    if (node.Kind != clksyn::TreeNode::INTERNAL) {
+      continue;
+    }
+    auto &edge = tree.Edges[node.Idx];
+    auto at = location[node.Idx];
+    if (edge.Buffers > 0 && edge.Stub > 0) {
+      at = edge.BufferAt;
+      edge.Stub = 0;
+    } else if (grid.inside(at)) {
+      at = clearPoint(at, inp.blockages);
+    } else {
+      continue;
+    }
+    ++stats.Moved;
+    location[node.Idx] = at;
+    node.x = at.x;
+    node.y = at.y;
+  }
+  for (const auto &[from, to] : topology.Edges) {
+    auto &edge = tree.Edges[to];
+    auto len = manhattanDistance(location[from], endOf(to));
+    if (len > edge.Length) {
+      stats.Detour += len - edge.Length;
+      edge.Length = len;
+    }
+  }
+
+  auto numEdges = static_cast<int32_t>(topology.Edges.size());
+  std::vector<std::optional<RoutedPath>> paths(numEdges);
+  auto threads = std::max(sett.Threads, 1);
+  std::vector<RouterStats> perWorker(threads);
+  std::unique_ptr<clksyn::ThreadPool> pool;
+  if (threads > 1) {
+    pool = std::make_unique<clksyn::ThreadPool>(threads);
+  }
+  clksyn::parallelFor(pool.get(), threads, [&](int32_t w) {
+    RouteContext ctx;
+    auto &local = perWorker[w];
+    for (auto e = w; e < numEdges; e += threads) {
+      auto [from, to] = topology.Edges[e];
+      auto a = location[from], b = endOf(to);
+      auto viaX = pt_t{.x = b.x, .y = a.y}, viaY = pt_t{.x = a.x, .y = b.y};
+      auto clearX = !grid.crosses(a, viaX) && !grid.crosses(viaX, b);
+      auto clearY = !grid.crosses(a, viaY) && !grid.crosses(viaY, b);
+      if (clearX && clearY) {
+        continue;
+      }
+      if (clearX || clearY) {
+        ++local.Bent;
+        paths[e] = RoutedPath{.Bends = {clearX ? viaX : viaY},
+                              .Length = manhattanDistance(a, b)};
+        continue;
+      }
+      if (grid.insideSame(a, b) ||
+          (!sett.Escape && (grid.inside(a) || grid.inside(b)))) {
+        ++local.Unroutable;
+        continue;
+      }
+      // the way out of a blockage around an end is part of the wire
+      auto outA = grid.escape(a), outB = grid.escape(b);
+      auto fromA = outA.empty() ? a : outA.back();
+      auto fromB = outB.empty() ? b : outB.back();
+      local.Escaped += !outA.empty() || !outB.empty();
+      ++local.Searched;
+      auto cached = ctx.Cache.size();
+      auto path = searchRoute(grid, fromA, fromB, ctx);
+      local.CacheHits += ctx.Cache.size() == cached;
+      if (!path) {
+        ++local.Unroutable;
+        continue;
+      }
+      ++local.Bent;
+      auto escaped = [](pt_t end, const std::vector<pt_t> &out) {
+        return out.empty() ? 0 : manhattanDistance(end, out.front()) +
+                                     manhattanDistance(out.front(),
+                                                       out.back());
+      };
+      path->Length += escaped(a, outA) + escaped(b, outB);
+      path->Bends.insert(path->Bends.begin(), outA.begin(), outA.end());
+      path->Bends.insert(path->Bends.end(), outB.rbegin(), outB.rend());
+      paths[e] = std::move(path);
+    }
+  });
+  for (const auto &local : perWorker) {
+    stats.Escaped += local.Escaped;
+    stats.Bent += local.Bent;
+    stats.Searched += local.Searched;
+    stats.CacheHits += local.CacheHits;
+    stats.Unroutable += local.Unroutable;
+  }
+  if (stats.Unroutable > 0) {
+    LogWarn(std::to_string(stats.Unroutable) +
+            " edges left direct: an end inside a blockage or no path "
+            "around.");
+  }
+
+  for (int32_t e = 0; e < numEdges; ++e) {
+    if (!paths[e]) {
+      continue;
+    }
+    auto to = topology.Edges[e].second;
+    auto &edge = tree.Edges[to];
+    stats.Detour += paths[e]->Length -
+                    manhattanDistance(location[topology.Edges[e].first],
+                                      endOf(to));
+    edge.Length = std::max(edge.Length, paths[e]->Length);
+    tree.Routes[to] = std::move(paths[e]->Bends);
+  }
+  if (sett.Rebalance && (stats.Detour > 0 || stats.Moved > 0)) {
+    rebalance(inp, tree, stats);
+  }
+
+  for (const auto &[from, to] : topology.Edges) {
+    std::vector<pt_t> path{location[from]};
+    if (auto it = tree.Routes.find(to); it != tree.Routes.end()) {
+      path.insert(path.end(), it->second.begin(), it->second.end());
+    }
+    path.push_back(endOf(to));
+    auto extra = tree.Edges[to].Length;
+    for (size_t i = 1; i < path.size(); ++i) {
+      extra -= manhattanDistance(path[i - 1], path[i]);
+    }
+    if (extra <= 1) {
+      continue;
+    }
+    auto detour = clearDetour(grid, path, extra / 2);
+    if (!detour) {
+      ++stats.Unsnaked;
+      continue;
+    }
+    ++stats.Snaked;
+    path.insert(path.begin() + detour->first + 1, detour->second.begin(),
+                detour->second.end());
+    // a corner may fall on an end of its segment
+    path.erase(std::unique(path.begin(), path.end()), path.end());
+    tree.Routes[to].assign(path.begin() + 1, path.end() - 1);
+  }
+  if (stats.Unsnaked > 0) {
+    LogWarn(std::to_string(stats.Unsnaked) +
+            " edges snaked without a clear detour.");
+  }
+  return stats;
+}
+
+} // namespace dme
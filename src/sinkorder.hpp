@@ -0,0 +1,151 @@
+#pragma once
+
+#include "dme.hpp"
+
+#include <bit>
+#include <optional>
+
+namespace dme {
+
+// Order of the sink table the synthesis works on. Sink Idx follows the
+// table, so a space-filling curve order keeps sinks that are close on the
+// die close in every array indexed by Idx.
+enum class SinkOrder { INPUT, HILBERT, MORTON };
+
+// Command line names of the orders.
+inline std::string sinkOrderName(SinkOrder order) {
+  switch (order) {
+  case SinkOrder::INPUT:
+    return "input";
+  case SinkOrder::HILBERT:
+    return "hilbert";
+  case SinkOrder::MORTON:
+    return "morton";
+  }
+  __builtin_unreachable();
+}
+
+inline std::optional<SinkOrder> sinkOrderFromName(const std::string &name) {
+  for (auto order :
+       {SinkOrder::INPUT, SinkOrder::HILBERT, SinkOrder::MORTON}) {
+    if (sinkOrderName(order) == name) {
+      return order;
+    }
+  }
+  return std::nullopt;
+}
+
+// Distance along the Hilbert curve through the 2^32 x 2^32 grid.
+// Consecutive keys are always adjacent cells, which Z-order does not give.
+inline uint64_t hilbertKey(uint32_t x, uint32_t y) {
+  uint64_t key = 0;
+  for (uint32_t s = 1u << 31; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) != 0, ry = (y & s) != 0;
+    key += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    // rotate the quadrant so the curve continues where it entered
+    if (ry == 0) {
+      if (rx == 1) {
+        x = ~x;
+        y = ~y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return key;
+}
+
+// Positions into `inp.sinks` in the given order; ties keep input order.
+inline std::vector<int32_t> sinkOrder(const inparams &inp, SinkOrder order) {
+  auto numSinks = static_cast<int32_t>(inp.sinks.size());
+  std::vector<int32_t> res(numSinks);
+  std::iota(res.begin(), res.end(), 0);
+  if (order == SinkOrder::INPUT || numSinks == 0) {
+    return res;
+  }
+
+  // offsets from the lower left corner, scaled down to fit 32 bits
+  int64_t minX = std::numeric_limits<int64_t>::max(), minY = minX;
+  uint64_t span = 0;
+  for (const auto &s : inp.sinks) {
+    minX = std::min(minX, s.cord.x);
+    minY = std::min(minY, s.cord.y);
+  }
+  for (const auto &s : inp.sinks) {
+    span = std::max({span, static_cast<uint64_t>(s.cord.x - minX),
+                     static_cast<uint64_t>(s.cord.y - minY)});
+  }
+  auto shift = std::max<int32_t>(std::bit_width(span) - 32, 0);
+
+  std::vector<uint64_t> keys(numSinks);
+  for (int32_t i = 0; i < numSinks; ++i) {
+    auto x = static_cast<uint32_t>(
+        static_cast<uint64_t>(inp.sinks[i].cord.x - minX) >> shift);
+    auto y = static_cast<uint32_t>(
+        static_cast<uint64_t>(inp.sinks[i].cord.y - minY) >> shift);
+    keys[i] = order == SinkOrder::HILBERT ? hilbertKey(x, y)
+                                          : clksyn::mortonKey(x, y);
+  }
+  std::stable_sort(res.begin(), res.end(),
+                   [&](auto &&l, auto &&r) { return keys[l] < keys[r]; });
+  return res;
+}
+
+// Copy of `inp` with sink i being `inp.sinks[order[i]]`.
+inline inparams reorderSinks(const inparams &inp,
+                             const std::vector<int32_t> &order) {
+  auto res = inp;
+  for (size_t i = 0; i < order.size(); ++i) {
+    res.sinks[i] = inp.sinks[order[i]];
+  }
+  return res;
+}
+
+// The permutation that undoes `order`.
+inline std::vector<int32_t> inverseOrder(const std::vector<int32_t> &order) {
+  std::vector<int32_t> res(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    res[order[i]] = static_cast<int32_t>(i);
+  }
+  return res;
+}
+
+// Moves sink i + 1 to Idx `pos[i] + 1`, everything else keeps its Idx.
+// With `pos` the order passed to `reorderSinks` this numbers a tree of the
+// reordered design like one of the input design; its inverse goes back.
+inline void renumberSinks(clksyn::TopologyResult &top,
+                          const std::vector<int32_t> &pos) {
+  auto numSinks = static_cast<int32_t>(pos.size());
+  auto map = [&](int32_t idx) {
+    return idx >= 1 && idx <= numSinks ? pos[idx - 1] + 1 : idx;
+  };
+  for (auto &node : top.Nodes) {
+    node.Idx = map(node.Idx);
+  }
+  for (auto &[from, to] : top.Edges) {
+    from = map(from);
+    to = map(to);
+  }
+  std::map<int32_t, std::string> tags;
+  for (auto &[idx, tag] : top.Tags) {
+    tags[map(idx)] = std::move(tag);
+  }
+  top.Tags = std::move(tags);
+}
+
+inline void renumberSinks(EmbeddingResult &res,
+                          const std::vector<int32_t> &pos) {
+  renumberSinks(res.Topology, pos);
+  auto edges = res.Edges;
+  for (size_t i = 0; i < pos.size() && i + 1 < edges.size(); ++i) {
+    res.Edges[pos[i] + 1] = edges[i + 1];
+  }
+  std::map<int32_t, std::vector<pt_t>> routes;
+  for (auto &[idx, bends] : res.Routes) {
+    auto sinkPos = static_cast<size_t>(idx - 1);
+    routes[idx >= 1 && sinkPos < pos.size() ? pos[sinkPos] + 1 : idx] =
+        std::move(bends);
+  }
+  res.Routes = std::move(routes);
+}
+
+} // namespace dme
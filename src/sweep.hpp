@@ -0,0 +1,203 @@
+#pragma once
+
+#include "dme.hpp"
+#include "evaluate.hpp"
+#include "threadpool.hpp"
+#include "topology.hpp"
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace dme {
+
+// Settings shared by every point of a sweep.
+struct SweepSettings {
+  EmbeddingSettings Embedding;
+  // Points run concurrently, each one serially on a worker.
+  int32_t Threads = 1;
+  // Ranking objective: total capacitance (fF) plus this many fF per ps
+  // of skew.
+  double SkewWeight = 1000;
+};
+
+// One synthesis setting and how its tree scored.
+struct SweepPoint {
+  clksyn::TreeSynthesisSettings Settings;
+  Evaluation Score;
+  double Objective = 0;
+};
+
+struct SweepResult {
+  // Best first.
+  std::vector<SweepPoint> Points;
+  EmbeddingResult Best;
+};
+
+// Expands a grid such as "algo=dnna,nna;alpha=0.1,0.2;gamma=0.25,0.5"
+// into the cartesian product of its value lists. Keys are algo, alpha,
+// beta, gamma and delta; anything not listed keeps its value from `base`.
+// Throws std::invalid_argument on malformed specs.
+inline std::vector<clksyn::TreeSynthesisSettings>
+parseSweepGrid(const std::string &spec, clksyn::TreeSynthesisSettings base) {
+  std::vector<clksyn::TreeSynthesisSettings> grid{base};
+  std::istringstream fields(spec);
+  std::string field;
+  while (std::getline(fields, field, ';')) {
+    if (field.empty()) {
+      continue;
+    }
+    auto eq = field.find('=');
+    if (eq == std::string::npos) {
+      throw std::invalid_argument("sweep field without '=': " + field);
+    }
+    auto key = field.substr(0, eq);
+    std::vector<std::string> values;
+    std::istringstream list(field.substr(eq + 1));
+    for (std::string value; std::getline(list, value, ',');) {
+      values.push_back(value);
+    }
+    if (values.empty()) {
+      throw std::invalid_argument("sweep field without values: " + field);
+    }
+
+    std::vector<clksyn::TreeSynthesisSettings> next;
+    for (const auto &sett : grid) {
+      for (const auto &value : values) {
+        auto point = sett;
+        if (key == "algo") {
+          auto algo = clksyn::topologyAlgorithmFromName(value);
+          if (!algo) {
+            throw std::invalid_argument("unknown topology algorithm: " +
+                                        value);
+          }
+          point.Algo = *algo;
+        } else {
+          auto number = std::stod(value);
+          if (key == "alpha") {
+            point.Alpha = number;
+          } else if (key == "beta") {
+            point.Beta = number;
+          } else if (key == "gamma") {
+            point.Gamma = number;
+          } else if (key == "delta") {
+            point.Delta = number;
+          } else {
+            throw std::invalid_argument("unknown sweep key: " + key);
+          }
+        }
+        next.push_back(point);
+      }
+    }
+    grid = std::move(next);
+  }
+  return grid;
+}
+
+// Inverse of `parseSweepGrid` for a single point.
+inline std::string sweepSpec(const clksyn::TreeSynthesisSettings &sett) {
+  std::ostringstream oss;
+  oss << "algo=" << clksyn::topologyAlgorithmName(sett.Algo)
+      << ";alpha=" << sett.Alpha << ";beta=" << sett.Beta
+      << ";gamma=" << sett.Gamma << ";delta=" << sett.Delta;
+  return oss.str();
+}
+
+// Ranking objective of a scored tree, lower is better.
+inline double sweepObjective(const Evaluation &score,
+                             const SweepSettings &sett) {
+  return score.TotalCap + sett.SkewWeight * score.Skew / 1000;
+}
+
+// Synthesises and scores a single setting. `base` supplies the sinks and
+// blockages of `inp`, the tree is moved into `tree` when given.
+inline SweepPoint scorePoint(const clksyn::TreeSynthesis &base,
+                             const inparams &inp,
+                             const clksyn::TreeSynthesisSettings &pointSett,
+                             const SweepSettings &sett,
+                             EmbeddingResult *tree = nullptr) {
+  auto serial = pointSett;
+  serial.Threads = 1;
+  auto embSett = sett.Embedding;
+  embSett.Threads = 1;
+  auto topology = base.withSettings(serial).getTopology();
+  auto emres =
+      EmbeddingManager(inp, std::move(topology), embSett).computeEmbedding();
+  SweepPoint point{.Settings = pointSett, .Score = evaluate(inp, emres)};
+  point.Objective = sweepObjective(point.Score, sett);
+  if (tree != nullptr) {
+    *tree = std::move(emres);
+  }
+  return point;
+}
+
+// Runs topology, DME and the Elmore evaluation for every setting of
+// `grid` concurrently. Sinks and blockages are indexed once and shared
+// by all points. Points are ranked by objective, ties by grid order, so
+// the ranking does not depend on scheduling.
+inline SweepResult
+runSweep(const inparams &inp,
+         const std::vector<clksyn::TreeSynthesisSettings> &grid,
+         const SweepSettings &sett) {
+  SweepResult res;
+  auto numPoints = static_cast<int32_t>(grid.size());
+  res.Points.resize(numPoints);
+  if (numPoints == 0) {
+    return res;
+  }
+
+  auto base = clksyn::TreeSynthesis(inp, grid.front());
+  std::unique_ptr<clksyn::ThreadPool> pool;
+  if (sett.Threads > 1) {
+    pool = std::make_unique<clksyn::ThreadPool>(sett.Threads);
+  }
+  std::mutex bestMtx;
+  int32_t bestPoint = -1;
+  clksyn::parallelFor(pool.get(), numPoints, [&](int32_t i) {
+    EmbeddingResult emres;
+    res.Points[i] = scorePoint(base, inp, grid[i], sett, &emres);
+
+    std::lock_guard<std::mutex> lock(bestMtx);
+    auto better = [&](int32_t a, int32_t b) {
+      return std::tie(res.Points[a].Objective, a) <
+             std::tie(res.Points[b].Objective, b);
+    };
+    if (bestPoint == -1 || better(i, bestPoint)) {
+      bestPoint = i;
+      res.Best = std::move(emres);
+    }
+  });
+
+  std::vector<int32_t> rank(numPoints);
+  std::iota(rank.begin(), rank.end(), 0);
+  std::sort(rank.begin(), rank.end(), [&](auto &&a, auto &&b) {
+    return std::tie(res.Points[a].Objective, a) <
+           std::tie(res.Points[b].Objective, b);
+  });
+  std::vector<SweepPoint> ranked;
+  for (auto i : rank) {
+    ranked.push_back(res.Points[i]);
+  }
+  res.Points = std::move(ranked);
+  return res;
+}
+
+// One row per point, best first. Latencies and skew in ps, capacitance
+// in fF.
+inline void writeSweepCsv(const std::string &path,
+                          const std::vector<SweepPoint> &points) {
+  std::ofstream out(path);
+  out << "rank,algo,alpha,beta,gamma,delta,max_latency_ps,skew_ps,"
+         "wire_cap_ff,total_cap_ff,objective\n";
+  for (size_t i = 0; i < points.size(); ++i) {
+    const auto &[sett, score, objective] = points[i];
+    out << i + 1 << "," << clksyn::topologyAlgorithmName(sett.Algo) << ","
+        << sett.Alpha << "," << sett.Beta << "," << sett.Gamma << ","
+        << sett.Delta << "," << score.MaxLatency / 1000 << ","
+        << score.Skew / 1000 << "," << score.WireCap << "," << score.TotalCap
+        << "," << objective << "\n";
+  }
+}
+
+} // namespace dme
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace clksyn {
+
+struct ThreadPool;
+
+namespace detail {
+// Identifies the pool worker running on the current thread, if any.
+inline thread_local ThreadPool *tlsPool = nullptr;
+inline thread_local size_t tlsWorker = 0;
+} // namespace detail
+
+// Work-stealing thread pool. Every worker owns a deque: it pops its own
+// newest task and steals the oldest task of another worker once it runs
+// dry. Tasks submitted from outside the pool are spread round robin.
+struct ThreadPool {
+  explicit ThreadPool(size_t numThreads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers_.size(); }
+  void submit(std::function<void()> task);
+
+  // Runs one queued task on the calling thread. Returns false if there
+  // was nothing to run.
+  bool runPending();
+
+private:
+  struct Queue {
+    std::mutex Mtx;
+    std::deque<std::function<void()>> Tasks;
+  };
+
+  bool popTask(size_t self, std::function<void()> &task);
+  void workerLoop(size_t self);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  std::mutex sleepMtx_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> nextQueue_{0};
+  bool stop_ = false;
+};
+
+inline ThreadPool::ThreadPool(size_t numThreads) {
+  if (numThreads == 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < numThreads; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  for (size_t i = 0; i < numThreads; ++i) {
+    workers_.emplace_back([this, i] { workerLoop(i); });
+  }
+}
+
+inline ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMtx_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+inline void ThreadPool::submit(std::function<void()> task) {
+  auto self = detail::tlsPool == this
+                  ? detail::tlsWorker
+                  : nextQueue_.fetch_add(1) % queues_.size();
+  {
+    std::lock_guard<std::mutex> lock(queues_[self]->Mtx);
+    queues_[self]->Tasks.push_back(std::move(task));
+  }
+  queued_.fetch_add(1);
+  // Taking the lock orders this against a worker about to go to sleep.
+  { std::lock_guard<std::mutex> lock(sleepMtx_); }
+  wake_.notify_one();
+}
+
+inline bool ThreadPool::popTask(size_t self, std::function<void()> &task) {
+  // own queue first, newest task (LIFO keeps the working set warm)
+  {
+    auto &own = *queues_[self];
+    std::lock_guard<std::mutex> lock(own.Mtx);
+    if (!own.Tasks.empty()) {
+      task = std::move(own.Tasks.back());
+      own.Tasks.pop_back();
+      queued_.fetch_sub(1);
+      return true;
+    }
+  }
+  // steal the oldest task from someone else
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    auto &other = *queues_[(self + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(other.Mtx);
+    if (!other.Tasks.empty()) {
+      task = std::move(other.Tasks.front());
+      other.Tasks.pop_front();
+      queued_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ThreadPool::runPending() {
+  auto self = detail::tlsPool == this ? detail::tlsWorker
+                                      : nextQueue_.load() % queues_.size();
+  std::function<void()> task;
+  if (!popTask(self, task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+inline void ThreadPool::workerLoop(size_t self) {
+  detail::tlsPool = this;
+  detail::tlsWorker = self;
+  while (true) {
+    std::function<void()> task;
+    if (popTask(self, task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMtx_);
+    wake_.wait(lock, [&] { return stop_ || queued_.load() > 0; });
+    if (stop_ && queued_.load() == 0) {
+      return;
+    }
+  }
+}
+
+// Fork-join helper on top of a ThreadPool. `wait` keeps executing pool
+// tasks while the group is outstanding, so groups can be nested inside
+// pool tasks without starving the workers.
+struct TaskGroup {
+  explicit TaskGroup(ThreadPool &pool) : pool_(pool) {}
+  ~TaskGroup() { wait(); }
+
+  void run(std::function<void()> task);
+  void wait();
+
+private:
+  ThreadPool &pool_;
+  std::atomic<size_t> pending_{0};
+};
+
+inline void TaskGroup::run(std::function<void()> task) {
+  pending_.fetch_add(1);
+  pool_.submit([this, task = std::move(task)] {
+    task();
+    pending_.fetch_sub(1);
+  });
+}
+
+inline void TaskGroup::wait() {
+  while (pending_.load() > 0) {
+    if (!pool_.runPending()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Runs `fn(i)` for every i in [0, n), on the pool when there is one and
+// serially otherwise.
+template <typename Fn>
+inline void parallelFor(ThreadPool *pool, int32_t n, Fn &&fn) {
+  if (!pool) {
+    for (int32_t i = 0; i < n; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  TaskGroup group(*pool);
+  for (int32_t i = 0; i < n; ++i) {
+    group.run([&fn, i] { fn(i); });
+  }
+}
+
+} // end namespace clksyn
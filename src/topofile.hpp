@@ -0,0 +1,252 @@
+#pragma once
+
+#include "parser.hpp"
+#include "topology.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace clksyn {
+
+// Binary topology checkpoints, so the embedding stage can be rerun without
+// `getTopology`. Little endian, fixed width:
+//
+//   magic "CLKTOPO" + version byte, design fingerprint (u64)
+//   node count (u64), per node: kind (u8), idx (i32), x, y (i64),
+//     load (f64)
+//   edge count (u64), per edge: from, to (i32)
+//   tag count (u64), per tag: idx (i32), length (u32), bytes
+//
+// The fingerprint covers the sinks of the design, so a checkpoint is only
+// loaded for the design it was made from.
+constexpr std::array<char, 8> TopologyFileMagic{'C', 'L', 'K', 'T',
+                                                'O', 'P', 'O', 1};
+
+// FNV-1a over the sink ids, coordinates and capacitances, in input order.
+inline uint64_t designFingerprint(const inparams &inp) {
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&](unsigned char byte) {
+    hash = (hash ^ byte) * 1099511628211ull;
+  };
+  auto mixInt = [&](int64_t value) {
+    for (int32_t i = 0; i < 8; ++i) {
+      mix(static_cast<uint64_t>(value) >> (8 * i));
+    }
+  };
+  for (const auto &s : inp.sinks) {
+    for (auto c : s.id) {
+      mix(c);
+    }
+    mix(0);
+    mixInt(s.cord.x);
+    mixInt(s.cord.y);
+    mixInt(s.cap);
+  }
+  return hash;
+}
+
+namespace detail {
+
+// Unsigned integer of the same width as T, for byte-order independent I/O.
+template <typename T>
+using BitsOf = std::conditional_t<
+    sizeof(T) == 1, uint8_t,
+    std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+
+template <typename T> inline void writeLE(std::ostream &out, T value) {
+  auto bits = std::bit_cast<BitsOf<T>>(value);
+  char bytes[sizeof(T)];
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    bytes[i] = static_cast<char>(bits >> (8 * i));
+  }
+  out.write(bytes, sizeof(T));
+}
+
+template <typename T> inline T readLE(std::istream &in) {
+  unsigned char bytes[sizeof(T)];
+  if (!in.read(reinterpret_cast<char *>(bytes), sizeof(T))) {
+    throw std::runtime_error("topology file is truncated");
+  }
+  BitsOf<T> bits = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    bits |= static_cast<BitsOf<T>>(bytes[i]) << (8 * i);
+  }
+  return std::bit_cast<T>(bits);
+}
+
+} // namespace detail
+
+// Throws std::runtime_error if the file cannot be written.
+inline void saveTopology(const std::string &path, const TopologyResult &top,
+                         const inparams &inp) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(TopologyFileMagic.data(), TopologyFileMagic.size());
+  detail::writeLE<uint64_t>(out, designFingerprint(inp));
+
+  detail::writeLE<uint64_t>(out, top.Nodes.size());
+  for (const auto &node : top.Nodes) {
+    detail::writeLE<uint8_t>(out, node.Kind);
+    detail::writeLE<int32_t>(out, node.Idx);
+    detail::writeLE<int64_t>(out, node.x);
+    detail::writeLE<int64_t>(out, node.y);
+    detail::writeLE<double>(out, node.LdCap);
+  }
+  detail::writeLE<uint64_t>(out, top.Edges.size());
+  for (const auto &[from, to] : top.Edges) {
+    detail::writeLE<int32_t>(out, from);
+    detail::writeLE<int32_t>(out, to);
+  }
+  detail::writeLE<uint64_t>(out, top.Tags.size());
+  for (const auto &[idx, tag] : top.Tags) {
+    detail::writeLE<int32_t>(out, idx);
+    detail::writeLE<uint32_t>(out, tag.size());
+    out.write(tag.data(), tag.size());
+  }
+  if (!out) {
+    throw std::runtime_error("cannot write topology file " + path);
+  }
+}
+
+// Throws std::runtime_error unless `top` is a tree numbered the way
+// `TreeSynthesis` numbers it: the source 0 with one child, sinks 1 to n
+// without children and internal nodes up to 2n with two each, every node
+// reachable from the source.
+inline void checkTopologyShape(const TopologyResult &top, size_t numSinks) {
+  auto maxIdx = static_cast<int64_t>(2 * numSinks);
+  auto bad = [](const std::string &what) {
+    throw std::runtime_error("topology file has " + what);
+  };
+  auto inRange = [&](int32_t idx) { return idx >= 0 && idx <= maxIdx; };
+  if (top.Nodes.size() != std::max<size_t>(2 * numSinks, 1) ||
+      top.Edges.size() + 1 != top.Nodes.size()) {
+    bad("the wrong number of nodes or edges");
+  }
+
+  std::vector<int8_t> kind(maxIdx + 1, -1);
+  for (const auto &node : top.Nodes) {
+    if (!inRange(node.Idx) || kind[node.Idx] >= 0) {
+      bad("a bad or repeated node index " + std::to_string(node.Idx));
+    }
+    auto isSink = node.Idx >= 1 && node.Idx <= static_cast<int64_t>(numSinks);
+    if ((node.Kind == TreeNode::SINK) != isSink ||
+        (node.Kind == TreeNode::SOURCE) != (node.Idx == 0)) {
+      bad("node " + std::to_string(node.Idx) + " of the wrong kind");
+    }
+    kind[node.Idx] = node.Kind;
+  }
+  for (const auto &[idx, tag] : top.Tags) {
+    if (!inRange(idx) || kind[idx] < 0) {
+      bad("a tag on missing node " + std::to_string(idx));
+    }
+  }
+
+  std::vector<int32_t> numKids(maxIdx + 1, 0), parent(maxIdx + 1, -1);
+  for (const auto &[from, to] : top.Edges) {
+    if (!inRange(from) || !inRange(to) || kind[from] < 0 || kind[to] < 0) {
+      bad("an edge to a missing node");
+    }
+    if (to == 0 || parent[to] >= 0) {
+      bad("node " + std::to_string(to) + " with two parents");
+    }
+    parent[to] = from;
+    ++numKids[from];
+  }
+  for (const auto &node : top.Nodes) {
+    auto want = node.Kind == TreeNode::SINK     ? 0
+                : node.Kind == TreeNode::SOURCE ? (numSinks > 0 ? 1 : 0)
+                                                : 2;
+    if (numKids[node.Idx] != want) {
+      bad("node " + std::to_string(node.Idx) + " with " +
+          std::to_string(numKids[node.Idx]) + " children");
+    }
+  }
+  // Every node but the source has one parent now, so only a cycle keeps
+  // a node from the source. Walks up until a node known to reach it,
+  // 1 marks the nodes of the current walk.
+  std::vector<int8_t> reaches(maxIdx + 1, 0);
+  reaches[0] = 2;
+  std::vector<int32_t> walk;
+  for (const auto &node : top.Nodes) {
+    walk.clear();
+    auto idx = node.Idx;
+    for (; reaches[idx] == 0; idx = parent[idx]) {
+      reaches[idx] = 1;
+      walk.push_back(idx);
+    }
+    if (reaches[idx] == 1) {
+      bad("a cycle through node " + std::to_string(idx));
+    }
+    for (auto up : walk) {
+      reaches[up] = 2;
+    }
+  }
+}
+
+// Throws std::runtime_error if the file is missing, malformed, is not a
+// tree over the sinks of `inp` or was made for a different design.
+inline TopologyResult loadTopology(const std::string &path,
+                                   const inparams &inp) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("cannot open topology file " + path);
+  }
+  std::array<char, 8> magic{};
+  in.read(magic.data(), magic.size());
+  if (!in || magic != TopologyFileMagic) {
+    throw std::runtime_error(path + " is not a topology file");
+  }
+  if (detail::readLE<uint64_t>(in) != designFingerprint(inp)) {
+    throw std::runtime_error(path + " was saved for a different design");
+  }
+
+  // Counts and tag lengths are checked against what is left of the file
+  // before reserving.
+  in.seekg(0, std::ios::end);
+  auto size = static_cast<uint64_t>(in.tellg());
+  in.seekg(TopologyFileMagic.size() + sizeof(uint64_t));
+  auto fits = [&](uint64_t n, uint64_t recordSize) {
+    if (n > (size - static_cast<uint64_t>(in.tellg())) / recordSize) {
+      throw std::runtime_error("topology file is truncated");
+    }
+    return n;
+  };
+  auto count = [&](uint64_t recordSize) {
+    return fits(detail::readLE<uint64_t>(in), recordSize);
+  };
+
+  TopologyResult top;
+  top.Nodes.resize(count(29));
+  for (auto &node : top.Nodes) {
+    auto kind = detail::readLE<uint8_t>(in);
+    if (kind > TreeNode::SOURCE) {
+      throw std::runtime_error("bad node kind in topology file");
+    }
+    node.Kind = static_cast<decltype(node.Kind)>(kind);
+    node.Idx = detail::readLE<int32_t>(in);
+    node.x = detail::readLE<int64_t>(in);
+    node.y = detail::readLE<int64_t>(in);
+    node.LdCap = detail::readLE<double>(in);
+  }
+  top.Edges.resize(count(8));
+  for (auto &[from, to] : top.Edges) {
+    from = detail::readLE<int32_t>(in);
+    to = detail::readLE<int32_t>(in);
+  }
+  for (auto n = count(8); n > 0; --n) {
+    auto idx = detail::readLE<int32_t>(in);
+    std::string tag(fits(detail::readLE<uint32_t>(in), 1), '\0');
+    if (!in.read(tag.data(), tag.size())) {
+      throw std::runtime_error("topology file is truncated");
+    }
+    top.Tags[idx] = std::move(tag);
+  }
+  checkTopologyShape(top, inp.sinks.size());
+  return top;
+}
+
+} // end namespace clksyn
@@ -4,15 +4,25 @@
 
 #include "blockage.hpp"
 #include "parser.hpp"
+#include "radixheap.hpp"
+#include "threadpool.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <iterator>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
 #include <queue>
 #include <set>
+#include <tuple>
 
 namespace clksyn {
 
-// Supporting two Topology Generation Algorithms.
+// Supporting four Topology Generation Algorithms.
 // NNA: https://ieeexplore.ieee.org/stamp/stamp.jsp?tp=&arnumber=1600293
 //    - Simple distance based cost function.
 //    - In each pass, we pick `Delta` fraction of the nodes at hand.
@@ -20,13 +30,100 @@ namespace clksyn {
 //    - Cost function includes information regarding blockages and loads.
 //    - In each pass, a cost range defined by (min_cost, min_cost * Delta)
 //      is used to pick nodes.
-enum class TopologyAlgorithm { DNNA, NNA };
+// MMM: Jackson, Srinivasan and Kuh, "Clock Routing for High-Performance
+//      ICs", DAC 1990.
+//    - Method of means and medians, top-down recursive bipartition.
+//    - Sinks are split at the load weighted median along the longer side
+//      of their bounding box.
+// MATCHING: Edahiro, "A Clustering-Based Optimization Algorithm in
+//      Zero-Skew Routings", DAC 1993.
+//    - Every level pairs up all active nodes with a near minimum cost
+//      matching over the k nearest neighbour graph.
+enum class TopologyAlgorithm { DNNA, NNA, MMM, MATCHING };
+
+// Command line names of the algorithms.
+inline std::string topologyAlgorithmName(TopologyAlgorithm algo) {
+  switch (algo) {
+  case TopologyAlgorithm::DNNA:
+    return "dnna";
+  case TopologyAlgorithm::NNA:
+    return "nna";
+  case TopologyAlgorithm::MMM:
+    return "mmm";
+  case TopologyAlgorithm::MATCHING:
+    return "matching";
+  }
+  __builtin_unreachable();
+}
+
+inline std::optional<TopologyAlgorithm>
+topologyAlgorithmFromName(const std::string &name) {
+  for (auto algo : {TopologyAlgorithm::DNNA, TopologyAlgorithm::NNA,
+                    TopologyAlgorithm::MMM, TopologyAlgorithm::MATCHING}) {
+    if (topologyAlgorithmName(algo) == name) {
+      return algo;
+    }
+  }
+  return std::nullopt;
+}
+
+// Where NNA and DNNA take their merge candidates from.
+// EXACT: every pair, or the k nearest neighbours of every node when all
+//    pairs would not fit in `MaxPairMem`.
+// MORTON: the next `MortonWindow` nodes along each of `MortonCurves`
+//    diagonally shifted Morton curves, O(n log n) per pass. Neighbours a
+//    curve separates at a cell boundary are usually close on another one.
+//    The window, then the curve count, shrinks to fit `MaxPairMem`.
+enum class PairSeeding { EXACT, MORTON };
+
+inline std::string pairSeedingName(PairSeeding seeding) {
+  switch (seeding) {
+  case PairSeeding::EXACT:
+    return "exact";
+  case PairSeeding::MORTON:
+    return "morton";
+  }
+  __builtin_unreachable();
+}
+
+inline std::optional<PairSeeding>
+pairSeedingFromName(const std::string &name) {
+  for (auto seeding : {PairSeeding::EXACT, PairSeeding::MORTON}) {
+    if (pairSeedingName(seeding) == name) {
+      return seeding;
+    }
+  }
+  return std::nullopt;
+}
 
 // Various parameter settings required by the algorithms.
-// Note that NNA only requires Delta.
+// Note that NNA only requires Delta, MMM and MATCHING require none. A zero
+// Gamma turns DNNA's total load term off.
 struct TreeSynthesisSettings {
   TopologyAlgorithm Algo;
   double Alpha, Beta, Gamma, Delta;
+  // Worker threads, used by MMM and to sort the curves of MORTON seeding.
+  int32_t Threads = 1;
+  // Cap in bytes on the merge candidates NNA and DNNA keep queued, 0 means
+  // unlimited. When all pairs would not fit, every node only keeps its
+  // nearest neighbours that do, refreshed after each pass. A cap below one
+  // candidate per sink throws `std::runtime_error`.
+  int64_t MaxPairMem = 0;
+  // Candidate source of NNA and DNNA and the MORTON parameters, see
+  // `PairSeeding`.
+  PairSeeding Seeding = PairSeeding::EXACT;
+  int32_t MortonWindow = 4;
+  int32_t MortonCurves = 4;
+};
+
+// Statistics of the last `getTopology` run.
+struct TopologyStats {
+  // Bytes the candidate queue was allowed, 0 if uncapped.
+  int64_t PairBudget = 0;
+  // Candidates per node in bounded mode, 0 when all pairs were queued.
+  int32_t CandidatesPerNode = 0;
+  // Largest number of queued pairs.
+  size_t PeakPairs = 0;
 };
 
 struct TreeNode {
@@ -52,13 +149,18 @@ struct TopologyResult {
   std::vector<std::pair<int32_t, int32_t>> Edges;
   std::map<int32_t, std::string> Tags;
 
-  outparams toOutParam();
+  // Every edge is written as a wire of the first library type.
+  outparams toOutParam(const inparams &inp) const;
 };
 
-inline outparams TopologyResult::toOutParam() {
+inline outparams TopologyResult::toOutParam(const inparams &inp) const {
   outparams res;
+  auto tag = [&](int32_t idx) {
+    auto it = Tags.find(idx);
+    return it == Tags.end() ? std::string() : it->second;
+  };
 
-  res.src = out_srcnode{.node_name = std::to_string(0), .src_name = Tags[0]};
+  res.src = out_srcnode{.node_name = std::to_string(0), .src_name = tag(0)};
 
   for (auto &node : Nodes) {
     if (node.Kind == TreeNode::INTERNAL) {
@@ -66,15 +168,15 @@ inline outparams TopologyResult::toOutParam() {
                                    .pt = point{.x = node.x, .y = node.y}});
     } else if (node.Kind == TreeNode::SINK) {
       res.sinks.push_back(out_sink{.node_name = std::to_string(node.Idx),
-                                   .sink_name = Tags[node.Idx]});
+                                   .sink_name = tag(node.Idx)});
     }
   }
 
+  auto wireType = inp.wires.empty() ? std::string("0") : inp.wires[0].type;
   for (auto &edge : Edges) {
-    res.wires.push_back(out_wire{
-        .from = std::to_string(edge.first),
-        .to = std::to_string(edge.second),
-    });
+    res.wires.push_back(out_wire{.from = std::to_string(edge.first),
+                                 .to = std::to_string(edge.second),
+                                 .type = wireType});
   }
 
   return res;
@@ -88,7 +190,7 @@ struct NodePair {
 
   bool operator<(const NodePair &rhs) const { return Cost > rhs.Cost; }
 
-  TreeNode simpleMerge(int32_t resIdx) const;
+  TreeNode simpleMerge(int32_t resIdx, double wireCap = 0) const;
 };
 
 inline std::ostream &operator<<(std::ostream &os, const NodePair &p) {
@@ -96,15 +198,80 @@ inline std::ostream &operator<<(std::ostream &os, const NodePair &p) {
   return os;
 }
 
+// Pairs waiting to be merged, cheapest first, as node indices. NNA costs
+// are Manhattan distances and go to a radix heap keyed by the integer
+// distance, DNNA's weighted costs stay in a binary heap.
+struct PairQueue {
+  explicit PairQueue(bool integral) : integral_(integral) {}
+
+  void push(double cost, int32_t a, int32_t b);
+  std::tuple<double, int32_t, int32_t> pop();
+  bool empty() const { return integral_ ? radix_.empty() : heap_.empty(); }
+  size_t size() const { return integral_ ? radix_.size() : heap_.size(); }
+  void clear() { *this = PairQueue(integral_); }
+
+  // Worst case memory per queued pair: vectors may hold twice their size
+  // while they grow.
+  static constexpr int64_t BytesPerPair =
+      2 * sizeof(std::pair<uint64_t, std::pair<int32_t, int32_t>>);
+
+private:
+  using Ends = std::pair<int32_t, int32_t>;
+  using Entry = std::pair<double, Ends>;
+
+  bool integral_;
+  RadixHeap<Ends> radix_;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap_;
+};
+
+inline void PairQueue::push(double cost, int32_t a, int32_t b) {
+  if (integral_) {
+    radix_.push(static_cast<uint64_t>(cost), Ends{a, b});
+  } else {
+    heap_.emplace(cost, Ends{a, b});
+  }
+}
+
+inline std::tuple<double, int32_t, int32_t> PairQueue::pop() {
+  Entry top;
+  if (integral_) {
+    auto [key, ends] = radix_.pop();
+    top = Entry{static_cast<double>(key), ends};
+  } else {
+    top = heap_.top();
+    heap_.pop();
+  }
+  return {top.first, top.second.first, top.second.second};
+}
+
+inline std::vector<std::pair<int32_t, int32_t>>
+nearestPairs(const std::vector<TreeNode> &nodes, int32_t k);
+inline std::vector<std::pair<int32_t, int32_t>>
+mortonPairs(const std::vector<TreeNode> &nodes, int32_t window,
+            int32_t curves, ThreadPool *pool = nullptr);
+
+// Smallest `MaxPairMem` NNA and DNNA accept for `numSinks` sinks: one
+// merge candidate per sink. A candidate costs a queue entry plus its
+// entry in the pair list of `nearestPairs`, or in the per curve lists of
+// `mortonPairs` and their merged copy.
+inline int64_t minPairMem(int64_t numSinks, PairSeeding seeding) {
+  auto lists = seeding == PairSeeding::MORTON ? 2 : 1;
+  return numSinks * static_cast<int64_t>(
+                        PairQueue::BytesPerPair +
+                        lists * sizeof(std::pair<int32_t, int32_t>));
+}
+
 // Merging at midpoint which is not ideal. May be a good idea to merge
-// based on ratio capacitive load.
-inline TreeNode NodePair::simpleMerge(int32_t resIdx) const {
+// based on ratio capacitive load. The load includes the wire joining the
+// two nodes at `wireCap` per unit length.
+inline TreeNode NodePair::simpleMerge(int32_t resIdx, double wireCap) const {
+  auto wireLength = std::abs(A.x - B.x) + std::abs(A.y - B.y);
   return TreeNode{
       .Kind = TreeNode::INTERNAL,
       .Idx = resIdx,
       .x = (A.x + B.x) / 2,
       .y = (A.y + B.y) / 2,
-      .LdCap = A.LdCap + B.LdCap,
+      .LdCap = A.LdCap + B.LdCap + wireCap * wireLength,
   };
 }
 
@@ -115,44 +282,87 @@ struct TreeSynthesis {
 
   TopologyResult getTopology();
   outparams getSynthesisedTree();
+  const TopologyStats &stats() const { return stats_; }
+
+  // Same sinks and blockages under different settings. The design data
+  // and the blockage index are shared rather than copied or rebuilt, so
+  // copies are cheap and can synthesise concurrently.
+  TreeSynthesis withSettings(TreeSynthesisSettings sett) const;
 
 private:
   double pairCost(TreeNode a, TreeNode b);
   bool endPass(int32_t picked, int32_t total, double curCost, double minCost);
 
-  inparams inp_;
+  TopologyResult getMMMTopology();
+  TopologyResult getMatchingTopology();
+  std::vector<std::pair<int32_t, int32_t>>
+  matchLevel(const std::vector<TreeNode> &level);
+  TreeNode mmmSplit(std::vector<TreeNode> &sinks, int32_t lo, int32_t hi,
+                    TopologyResult &res, ThreadPool *pool);
+
+  // Immutable after construction, shared by `withSettings` copies.
+  std::shared_ptr<const inparams> inp_;
   TreeSynthesisSettings sett_;
-  std::map<int32_t, std::string> idxToTag_;
-  std::vector<TreeNode> sinks_;
+  std::shared_ptr<const std::map<int32_t, std::string>> idxToTag_;
+  std::shared_ptr<const std::vector<TreeNode>> sinks_;
   TreeNode source_;
-  BlockageManager bMgr_;
+  std::shared_ptr<const BlockageManager> bMgr_;
+  TopologyStats stats_;
+  // Unit capacitance of the lowest-cap wire, a lower bound on the wire
+  // load of a merge until embedding picks the wires, and the total sink
+  // load that DNNA's load term is relative to.
+  double wireCap_ = 0;
+  double sinkCap_ = 0;
 };
 
 inline TreeSynthesis::TreeSynthesis(inparams inp, TreeSynthesisSettings sett)
-    : inp_(inp), sett_(sett) {
-  std::for_each(inp_.sinks.begin(), inp_.sinks.end(), [&](auto &&sink) {
-    sinks_.push_back(TreeNode{
+    : inp_(std::make_shared<const inparams>(std::move(inp))), sett_(sett) {
+  std::vector<TreeNode> sinks;
+  std::map<int32_t, std::string> idxToTag;
+  std::for_each(inp_->sinks.begin(), inp_->sinks.end(), [&](auto &&sink) {
+    sinks.push_back(TreeNode{
         .Kind = TreeNode::SINK,
-        .Idx = static_cast<int32_t>(sinks_.size() + 1),
+        .Idx = static_cast<int32_t>(sinks.size() + 1),
         .x = sink.cord.x,
         .y = sink.cord.y,
         .LdCap = static_cast<double>(sink.cap),
     });
-    idxToTag_[sinks_.back().Idx] = sink.id;
+    idxToTag[sinks.back().Idx] = sink.id;
+    sinkCap_ += sink.cap;
   });
+  if (!inp_->wires.empty()) {
+    wireCap_ = std::min_element(inp_->wires.begin(), inp_->wires.end(),
+                                [](auto &&l, auto &&r) {
+                                  return l.cap < r.cap;
+                                })->cap;
+  }
 
   source_ = TreeNode{
       .Kind = TreeNode::SOURCE,
       .Idx = 0,
-      .x = inp_.src.pt.x,
-      .y = inp_.src.pt.y,
+      .x = inp_->src.pt.x,
+      .y = inp_->src.pt.y,
       .LdCap = 0,
   };
-  idxToTag_[0] = inp_.src.source_name;
+  idxToTag[0] = inp_->src.source_name;
+  sinks_ = std::make_shared<const std::vector<TreeNode>>(std::move(sinks));
+  idxToTag_ = std::make_shared<const std::map<int32_t, std::string>>(
+      std::move(idxToTag));
 
-  std::for_each(inp_.blockages.begin(), inp_.blockages.end(), [&](auto &&bkg) {
-    bMgr_.insertBlockage(bkg.x1, bkg.y1, bkg.x2, bkg.y2);
-  });
+  auto blockages = std::make_shared<BlockageManager>();
+  std::for_each(inp_->blockages.begin(), inp_->blockages.end(),
+                [&](auto &&bkg) {
+                  blockages->insertBlockage(bkg.x1, bkg.y1, bkg.x2, bkg.y2);
+                });
+  bMgr_ = std::move(blockages);
+}
+
+inline TreeSynthesis
+TreeSynthesis::withSettings(TreeSynthesisSettings sett) const {
+  auto copy = *this;
+  copy.sett_ = sett;
+  copy.stats_ = TopologyStats{};
+  return copy;
 }
 
 // Determines cost of merging two nodes. This is based on the
@@ -160,21 +370,29 @@ inline TreeSynthesis::TreeSynthesis(inparams inp, TreeSynthesisSettings sett)
 inline double TreeSynthesis::pairCost(TreeNode a, TreeNode b) {
   double ret = 0;
   switch (sett_.Algo) {
+  case TopologyAlgorithm::MMM:
+  case TopologyAlgorithm::MATCHING:
   case TopologyAlgorithm::NNA: {
     ret = abs(a.x - b.x) + abs(a.y - b.y);
     break;
   }
   case TopologyAlgorithm::DNNA: {
     auto nodeDistance = abs(a.x - b.x) + abs(a.y - b.y);
-    double blockageOverlap = (double)bMgr_.getOverlapPerimeter(
+    double blockageOverlap = (double)bMgr_->getOverlapPerimeter(
                                  std::min(a.x, b.x), std::min(a.y, b.y),
                                  std::max(a.x, b.x), std::max(a.y, b.y)) /
                              (2 * nodeDistance);
     double loadDistance = abs(a.LdCap - b.LdCap) / std::max(a.LdCap, b.LdCap);
-    double totalLoad = 0; // @TODO
+    // Merged load, wires included, relative to all sinks. Penalising
+    // heavy merges keeps subtree loads balanced and the tree shallow.
+    double totalLoad =
+        (a.LdCap + b.LdCap + wireCap_ * nodeDistance) / std::max(sinkCap_, 1.);
 
     ret = double(nodeDistance) * (1 + blockageOverlap / sett_.Alpha) *
-          (1 + loadDistance / sett_.Beta) * (1 + totalLoad / sett_.Gamma);
+          (1 + loadDistance / sett_.Beta);
+    if (sett_.Gamma > 0) {
+      ret *= 1 + totalLoad / sett_.Gamma;
+    }
   }
   }
   return ret;
@@ -185,6 +403,8 @@ inline double TreeSynthesis::pairCost(TreeNode a, TreeNode b) {
 inline bool TreeSynthesis::endPass(int32_t picked, int32_t total,
                                    double curCost, double minCost) {
   switch (sett_.Algo) {
+  case TopologyAlgorithm::MMM:
+  case TopologyAlgorithm::MATCHING:
   case TopologyAlgorithm::NNA: {
     return total * sett_.Delta < picked;
   }
@@ -196,71 +416,157 @@ inline bool TreeSynthesis::endPass(int32_t picked, int32_t total,
 }
 
 inline TopologyResult TreeSynthesis::getTopology() {
-  // NodePair < operator is overloaded so that priority
-  // queue has the lowest cost at the top.
-  std::priority_queue<NodePair> pq;
+  stats_ = TopologyStats{};
+  if (sett_.Algo == TopologyAlgorithm::MMM) {
+    return getMMMTopology();
+  }
+  if (sett_.Algo == TopologyAlgorithm::MATCHING) {
+    return getMatchingTopology();
+  }
+
+  // Scratch space of this run, released wholesale on return. A binary
+  // tree over n sinks has 2n - 1 nodes, so everything sized by the node
+  // count is reserved once up front; the initial block covers `nodeAt`
+  // and the tree nodes of `actv`.
+  auto numNodes = sinks_->size() * 2;
+  std::pmr::monotonic_buffer_resource arena(
+      std::max<size_t>(numNodes * (sizeof(TreeNode) + 64), 4096));
+
+  // Cheapest pair first. Only node indices are queued, `nodeAt` resolves
+  // them, which keeps the O(n^2) initial pairs small.
+  PairQueue pq(sett_.Algo == TopologyAlgorithm::NNA);
+  std::pmr::vector<TreeNode> nodeAt(numNodes, &arena);
 
   // Keeps track of unmerged nodes at a given point of time
   // during the execution.
-  std::set<TreeNode> actv;
+  std::pmr::set<TreeNode> actv(&arena);
 
   // Result to be returned.
   TopologyResult res;
+  res.Nodes.reserve(numNodes);
+  res.Edges.reserve(numNodes);
+
+  // Exhaustive seeding queues every pair, and each pass adds the pairs of
+  // its new nodes on top; about n^2 pairs over the run. Past the cap,
+  // only the k nearest neighbours of every node that fit are queued, and
+  // the queue is rebuilt from the active nodes after each pass. Morton
+  // seeding narrows its window, then its curves, to fit the cap.
+  auto numSinks = static_cast<int64_t>(sinks_->size());
+  stats_.PairBudget = std::max<int64_t>(sett_.MaxPairMem, 0);
+  auto morton = sett_.Seeding == PairSeeding::MORTON;
+  auto least = minPairMem(numSinks, sett_.Seeding);
+  auto fitting = numSinks > 0 && stats_.PairBudget > 0
+                     ? stats_.PairBudget / least
+                     : std::numeric_limits<int64_t>::max();
+  if (fitting < 1) {
+    throw std::runtime_error(
+        "Pair memory cap of " + std::to_string(stats_.PairBudget) +
+        " bytes cannot hold one merge candidate per sink, at least " +
+        std::to_string(least) + " bytes are needed.");
+  }
+  if (!morton && stats_.PairBudget > 0 &&
+      numSinks * numSinks * PairQueue::BytesPerPair > stats_.PairBudget) {
+    // more neighbours than this stopped changing the NNA result
+    constexpr int64_t maxCandidates = 16;
+    stats_.CandidatesPerNode = static_cast<int32_t>(
+        std::min({fitting, numSinks, maxCandidates}));
+    LogInfo("Bounded topology candidates: " +
+            std::to_string(stats_.CandidatesPerNode) + " per node within " +
+            std::to_string(stats_.PairBudget) + " bytes.");
+  }
+  auto window = std::max(sett_.MortonWindow, 1);
+  auto curves = std::max(sett_.MortonCurves, 1);
+  std::unique_ptr<ThreadPool> pool;
+  if (morton) {
+    if (static_cast<int64_t>(window) * curves > fitting) {
+      curves = static_cast<int32_t>(std::min<int64_t>(curves, fitting));
+      window = static_cast<int32_t>(
+          std::min<int64_t>(window, fitting / curves));
+      LogInfo("Morton seeding narrowed to window " + std::to_string(window) +
+              " on " + std::to_string(curves) + " curves within " +
+              std::to_string(stats_.PairBudget) + " bytes.");
+    }
+    stats_.CandidatesPerNode = window * curves;
+    if (sett_.Threads > 1) {
+      pool = std::make_unique<ThreadPool>(sett_.Threads);
+    }
+  }
+  auto bounded = stats_.CandidatesPerNode > 0;
+  auto seedNearest = [&] {
+    pq.clear();
+    std::vector<TreeNode> open(actv.begin(), actv.end());
+    auto pairs = morton ? mortonPairs(open, window, curves, pool.get())
+                        : nearestPairs(open, stats_.CandidatesPerNode);
+    for (const auto &[a, b] : pairs) {
+      pq.push(pairCost(open[a], open[b]), open[a].Idx, open[b].Idx);
+    }
+  };
 
   // As we continue to merge and move up, we keep track of the
-  // last node that was result of a merge as the root.
-  TreeNode root;
+  // last node that was result of a merge as the root. A single sink is
+  // the root itself.
+  TreeNode root = sinks_->empty() ? source_ : sinks_->front();
 
   // Insert all the pairs corresponding to all sinks. Mark them
   // all as unmerged by pushing to the `actv` set.
-  for (const auto &i : sinks_) {
+  for (const auto &i : *sinks_) {
     actv.insert(i);
+    nodeAt[i.Idx] = i;
     res.Nodes.push_back(i);
-    for (const auto &j : sinks_) {
-      if (i.Idx <= j.Idx) {
+    for (const auto &j : *sinks_) {
+      if (bounded || i.Idx <= j.Idx) {
         continue;
       }
-      pq.push(NodePair{.Cost = pairCost(i, j), .A = i, .B = j});
+      pq.push(pairCost(i, j), i.Idx, j.Idx);
     }
   }
+  if (bounded) {
+    seedNearest();
+  }
 
   // Any nodes that have already been merged or picked for merging in
   // the current pass are marked visited.
-  std::vector<bool> vis(sinks_.size() * 2, false);
+  std::pmr::vector<bool> vis(numNodes, false, &arena);
 
   // Use to assign node indices to newly created internal nodes.
-  int32_t nextIdx = sinks_.size() + 1;
+  int32_t nextIdx = sinks_->size() + 1;
+
+  // Per-pass lists, cleared instead of reallocated. A pass never picks
+  // more than half of the active nodes' worth of pairs.
+  std::pmr::vector<NodePair> pickedPairs(&arena);
+  std::pmr::vector<TreeNode> newNodes(&arena);
+  pickedPairs.reserve(sinks_->size() / 2 + 1);
+  newNodes.reserve(sinks_->size() / 2 + 1);
 
   while (!pq.empty()) {
-    // start a new pass
+    // start a new pass, the queue only shrinks during one
+    stats_.PeakPairs = std::max(stats_.PeakPairs, pq.size());
     double curCost = 0;
     double minCost = std::numeric_limits<double>::max();
-    std::vector<NodePair> pickedPairs;
+    pickedPairs.clear();
 
     // In a single pass pick node pairs until we exhaust all available
     // pairs or we meet the terminating condition.
     do {
-      auto top = pq.top();
-      pq.pop();
-      if (vis.size() <= std::max(top.A.Idx, top.B.Idx)) {
-        vis.resize(std::max(top.A.Idx, top.B.Idx) + 1);
-      }
-      if (vis[top.A.Idx] || vis[top.B.Idx]) {
+      auto [cost, a, b] = pq.pop();
+      if (vis[a] || vis[b]) {
         continue;
       }
-      vis[top.A.Idx] = vis[top.B.Idx] = true;
-      pickedPairs.push_back(top);
-      curCost = top.Cost;
+      vis[a] = vis[b] = true;
+      pickedPairs.push_back(
+          NodePair{.Cost = cost, .A = nodeAt[a], .B = nodeAt[b]});
+      curCost = cost;
       minCost = std::min(minCost, curCost); // this should only run once
     } while (!endPass(pickedPairs.size() * 2, actv.size(), curCost, minCost) &&
              !pq.empty());
 
     // Create new nodes by merging the pairs that have been picked
     // in this pass. Add edges to the result as well.
-    std::vector<TreeNode> newNodes;
+    newNodes.clear();
     for (const auto &pr : pickedPairs) {
-      auto merged = pr.simpleMerge(nextIdx++);
+      auto merged = pr.simpleMerge(nextIdx++, wireCap_);
       root = merged;
+      nodeAt[merged.Idx] = merged;
       res.Nodes.push_back(merged);
       res.Edges.push_back({merged.Idx, pr.A.Idx});
       res.Edges.push_back({merged.Idx, pr.B.Idx});
@@ -280,22 +586,442 @@ inline TopologyResult TreeSynthesis::getTopology() {
 
     // Generate node pairs for the newly created nodes and add to the
     // priority queue.
+    if (bounded) {
+      seedNearest();
+      continue;
+    }
     for (const auto &nNode : newNodes) {
       for (const auto &kNode : actv) {
         if (nNode.Idx == kNode.Idx) {
           continue;
         }
-        pq.push(
-            NodePair{.Cost = pairCost(nNode, kNode), .A = nNode, .B = kNode});
+        pq.push(pairCost(nNode, kNode), nNode.Idx, kNode.Idx);
       }
     }
   }
 
   // Connect source to the root.
   res.Nodes.push_back(source_);
-  res.Edges.push_back({source_.Idx, root.Idx});
-  res.Tags = idxToTag_;
+  if (!sinks_->empty()) {
+    res.Edges.push_back({source_.Idx, root.Idx});
+  }
+  res.Tags = *idxToTag_;
+
+  return res;
+}
+
+// Splits [lo, hi) at the load weighted median along the longer side of its
+// bounding box and returns the first index of the upper half. The binary
+// search over ranks only reorders the part that is still undecided, so the
+// split is linear in the size of the range.
+inline int32_t medianSplit(std::vector<TreeNode> &nodes, int32_t lo,
+                           int32_t hi) {
+  int64_t minX = std::numeric_limits<int64_t>::max(), minY = minX;
+  int64_t maxX = std::numeric_limits<int64_t>::min(), maxY = maxX;
+  double total = 0;
+  for (auto i = lo; i < hi; ++i) {
+    const auto &n = nodes[i];
+    minX = std::min(minX, n.x);
+    maxX = std::max(maxX, n.x);
+    minY = std::min(minY, n.y);
+    maxY = std::max(maxY, n.y);
+    total += std::max(n.LdCap, 0.);
+  }
 
+  // sinks without load fall back to an even split by count
+  auto weight = [total](const TreeNode &n) {
+    return total > 0 ? std::max(n.LdCap, 0.) : 1.;
+  };
+  auto half = (total > 0 ? total : hi - lo) / 2;
+
+  auto byX = maxX - minX >= maxY - minY;
+  auto select = [&](int32_t a, int32_t m, int32_t b) {
+    auto first = nodes.begin();
+    if (byX) {
+      std::nth_element(first + a, first + m, first + b, [](auto &&l, auto &&r) {
+        return std::tie(l.x, l.y, l.Idx) < std::tie(r.x, r.y, r.Idx);
+      });
+    } else {
+      std::nth_element(first + a, first + m, first + b, [](auto &&l, auto &&r) {
+        return std::tie(l.y, l.x, l.Idx) < std::tie(r.y, r.x, r.Idx);
+      });
+    }
+  };
+
+  // Looks for the element straddling half of the load. [lo, a) holds at
+  // most half of it and precedes [a, b), which precedes [b, hi). Equal
+  // loads hit on the first probe.
+  auto a = lo, b = hi, m = lo;
+  double below = 0;
+  while (a < b) {
+    m = a + (b - a) / 2;
+    select(a, m, b);
+    auto w = below;
+    for (auto i = a; i < m; ++i) {
+      w += weight(nodes[i]);
+    }
+    if (w > half) {
+      b = m;
+    } else if (w + weight(nodes[m]) <= half && m + 1 < b) {
+      below = w + weight(nodes[m]);
+      a = m + 1;
+    } else {
+      below = w;
+      break;
+    }
+  }
+
+  auto mid = half - below <= below + weight(nodes[m]) - half ? m : m + 1;
+  return std::clamp(mid, lo + 1, hi - 1);
+}
+
+// Builds the subtree over sinks [lo, hi). Its internal nodes take the
+// indices n + lo + 1 .. n + hi - 1, the root of the range sits at n + mid
+// between those of the halves, so no bookkeeping is shared between tasks.
+// Nodes and edges are written to fixed positions for the same reason.
+inline TreeNode TreeSynthesis::mmmSplit(std::vector<TreeNode> &sinks,
+                                        int32_t lo, int32_t hi,
+                                        TopologyResult &res,
+                                        ThreadPool *pool) {
+  // Below this many sinks a half is not worth a task of its own.
+  constexpr int32_t taskCutoff = 4096;
+
+  if (hi - lo == 1) {
+    res.Nodes[sinks[lo].Idx - 1] = sinks[lo];
+    return sinks[lo];
+  }
+
+  auto mid = medianSplit(sinks, lo, hi);
+  TreeNode lhs, rhs;
+  if (pool != nullptr && hi - lo > taskCutoff) {
+    TaskGroup group(*pool);
+    group.run([&] { lhs = mmmSplit(sinks, lo, mid, res, pool); });
+    rhs = mmmSplit(sinks, mid, hi, res, pool);
+    group.wait();
+  } else {
+    lhs = mmmSplit(sinks, lo, mid, res, pool);
+    rhs = mmmSplit(sinks, mid, hi, res, pool);
+  }
+
+  auto numSinks = static_cast<int32_t>(sinks.size());
+  auto merged = NodePair{.Cost = 0, .A = lhs, .B = rhs}.simpleMerge(numSinks +
+                                                                   mid);
+  res.Nodes[merged.Idx - 1] = merged;
+  res.Edges[2 * (mid - 1)] = {merged.Idx, lhs.Idx};
+  res.Edges[2 * (mid - 1) + 1] = {merged.Idx, rhs.Idx};
+  return merged;
+}
+
+inline TopologyResult TreeSynthesis::getMMMTopology() {
+  TopologyResult res;
+  auto numSinks = static_cast<int32_t>(sinks_->size());
+  // sinks take positions 1..n, internal nodes n + 1..2n - 1
+  res.Nodes.resize(std::max(2 * numSinks - 1, 0));
+  res.Edges.resize(std::max(2 * (numSinks - 1), 0));
+
+  std::unique_ptr<ThreadPool> pool;
+  if (sett_.Threads > 1) {
+    pool = std::make_unique<ThreadPool>(sett_.Threads);
+  }
+
+  if (numSinks > 0) {
+    auto sinks = *sinks_;
+    auto root = mmmSplit(sinks, 0, numSinks, res, pool.get());
+    res.Edges.push_back({source_.Idx, root.Idx});
+  }
+
+  res.Nodes.push_back(source_);
+  res.Tags = *idxToTag_;
+  return res;
+}
+
+// Pairs of nodes where one is among the `k` nearest (Manhattan) neighbours
+// of the other, as positions into `nodes` with first < second. Found on a
+// uniform grid with about two nodes per cell, which keeps the work per node
+// constant for reasonably spread inputs.
+inline std::vector<std::pair<int32_t, int32_t>>
+nearestPairs(const std::vector<TreeNode> &nodes, int32_t k) {
+  std::vector<std::pair<int32_t, int32_t>> res;
+  auto n = static_cast<int32_t>(nodes.size());
+  if (n < 2 || k < 1) {
+    return res;
+  }
+
+  int64_t minX = std::numeric_limits<int64_t>::max(), minY = minX;
+  int64_t maxX = std::numeric_limits<int64_t>::min(), maxY = maxX;
+  for (const auto &node : nodes) {
+    minX = std::min(minX, node.x);
+    maxX = std::max(maxX, node.x);
+    minY = std::min(minY, node.y);
+    maxY = std::max(maxY, node.y);
+  }
+  auto area = static_cast<double>(maxX - minX + 1) * (maxY - minY + 1);
+  auto cell = std::max<int64_t>(1, std::llround(std::sqrt(2 * area / n)));
+  // degenerate (e.g. collinear) inputs would get far too many cells
+  while (static_cast<double>((maxX - minX) / cell + 1) *
+             ((maxY - minY) / cell + 1) >
+         4. * n) {
+    cell *= 2;
+  }
+  auto cols = static_cast<int32_t>((maxX - minX) / cell + 1);
+  auto rows = static_cast<int32_t>((maxY - minY) / cell + 1);
+
+  // bucket the nodes by cell, CSR style
+  auto cellOf = [&](const TreeNode &node) {
+    return static_cast<int32_t>((node.y - minY) / cell) * cols +
+           static_cast<int32_t>((node.x - minX) / cell);
+  };
+  std::vector<int32_t> start(static_cast<size_t>(cols) * rows + 1, 0);
+  for (const auto &node : nodes) {
+    ++start[cellOf(node) + 1];
+  }
+  std::partial_sum(start.begin(), start.end(), start.begin());
+  std::vector<int32_t> order(n);
+  auto fill = start;
+  for (int32_t i = 0; i < n; ++i) {
+    order[fill[cellOf(nodes[i])]++] = i;
+  }
+
+  res.reserve(static_cast<size_t>(n) * k);
+  std::vector<std::pair<int64_t, int32_t>> best;
+  for (int32_t i = 0; i < n; ++i) {
+    const auto &node = nodes[i];
+    auto cx = static_cast<int32_t>((node.x - minX) / cell);
+    auto cy = static_cast<int32_t>((node.y - minY) / cell);
+    best.clear();
+
+    // keeps the k closest seen so far, sorted by distance
+    auto visit = [&](int32_t x, int32_t y) {
+      if (x < 0 || y < 0 || x >= cols || y >= rows) {
+        return;
+      }
+      auto c = y * cols + x;
+      for (auto p = start[c]; p < start[c + 1]; ++p) {
+        auto j = order[p];
+        if (j == i) {
+          continue;
+        }
+        auto d = std::abs(node.x - nodes[j].x) + std::abs(node.y - nodes[j].y);
+        if (static_cast<int32_t>(best.size()) == k && d >= best.back().first) {
+          continue;
+        }
+        if (static_cast<int32_t>(best.size()) == k) {
+          best.pop_back();
+        }
+        best.insert(std::upper_bound(best.begin(), best.end(),
+                                     std::pair{d, j}),
+                    {d, j});
+      }
+    };
+
+    // anything in ring r is more than (r - 1) * cell away
+    for (int32_t r = 0; r <= std::max(cols, rows); ++r) {
+      if (static_cast<int32_t>(best.size()) == k &&
+          best.back().first <= (r - 1) * cell) {
+        break;
+      }
+      if (r == 0) {
+        visit(cx, cy);
+        continue;
+      }
+      for (auto x = cx - r; x <= cx + r; ++x) {
+        visit(x, cy - r);
+        visit(x, cy + r);
+      }
+      for (auto y = cy - r + 1; y <= cy + r - 1; ++y) {
+        visit(cx - r, y);
+        visit(cx + r, y);
+      }
+    }
+
+    for (const auto &[d, j] : best) {
+      res.push_back({std::min(i, j), std::max(i, j)});
+    }
+  }
+
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+  return res;
+}
+
+// Z-order key, the bits of x and y interleaved with x lowest.
+inline uint64_t mortonKey(uint32_t x, uint32_t y) {
+  auto spread = [](uint64_t v) {
+    v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+    v = (v | (v << 2)) & 0x3333333333333333ull;
+    v = (v | (v << 1)) & 0x5555555555555555ull;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// Pairs of nodes at most `window` apart in Morton order, on `curves`
+// copies of the curve shifted along the diagonal by fractions of the
+// bounding box. Positions into `nodes` with first < second. Each curve is
+// one sort, the curves are sorted concurrently on `pool` if given.
+inline std::vector<std::pair<int32_t, int32_t>>
+mortonPairs(const std::vector<TreeNode> &nodes, int32_t window,
+            int32_t curves, ThreadPool *pool) {
+  std::vector<std::pair<int32_t, int32_t>> res;
+  auto n = static_cast<int32_t>(nodes.size());
+  window = std::max(window, 1);
+  curves = std::max(curves, 1);
+  if (n < 2) {
+    return res;
+  }
+
+  int64_t minX = std::numeric_limits<int64_t>::max(), minY = minX;
+  int64_t maxX = std::numeric_limits<int64_t>::min(), maxY = maxX;
+  for (const auto &node : nodes) {
+    minX = std::min(minX, node.x);
+    maxX = std::max(maxX, node.x);
+    minY = std::min(minY, node.y);
+    maxY = std::max(maxY, node.y);
+  }
+  // shifted offsets reach twice the span, scaled down to fit 32 bits
+  auto span = static_cast<uint64_t>(std::max(maxX - minX, maxY - minY));
+  auto shift = std::max<int32_t>(std::bit_width(2 * span) - 32, 0);
+
+  std::vector<std::vector<std::pair<int32_t, int32_t>>> perCurve(curves);
+  parallelFor(pool, curves, [&](int32_t c) {
+    auto offset = span * c / curves;
+    std::vector<std::pair<uint64_t, int32_t>> order(n);
+    for (int32_t i = 0; i < n; ++i) {
+      auto x = static_cast<uint64_t>(nodes[i].x - minX) + offset;
+      auto y = static_cast<uint64_t>(nodes[i].y - minY) + offset;
+      order[i] = {mortonKey(static_cast<uint32_t>(x >> shift),
+                            static_cast<uint32_t>(y >> shift)),
+                  i};
+    }
+    std::sort(order.begin(), order.end());
+    auto &pairs = perCurve[c];
+    pairs.reserve(static_cast<size_t>(n) * window);
+    for (int32_t i = 0; i < n; ++i) {
+      for (auto j = i + 1; j < std::min(n, i + 1 + window); ++j) {
+        auto a = order[i].second, b = order[j].second;
+        pairs.push_back({std::min(a, b), std::max(a, b)});
+      }
+    }
+  });
+
+  for (auto &pairs : perCurve) {
+    res.insert(res.end(), pairs.begin(), pairs.end());
+  }
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+  return res;
+}
+
+// Greedy matching over the k nearest neighbour graph: candidate pairs are
+// taken in order of cost while both ends are free. The cheapest pair among
+// the nodes left over is always a candidate, so repeating on the leftovers
+// matches everything but at most one node.
+inline std::vector<std::pair<int32_t, int32_t>>
+TreeSynthesis::matchLevel(const std::vector<TreeNode> &level) {
+  constexpr int32_t neighbours = 8;
+
+  std::vector<std::pair<int32_t, int32_t>> matching;
+  std::vector<int32_t> open(level.size());
+  std::iota(open.begin(), open.end(), 0);
+  std::vector<bool> used(level.size(), false);
+  std::vector<int32_t> mate(level.size(), -1);
+
+  while (open.size() > 1) {
+    std::vector<TreeNode> nodes;
+    for (auto pos : open) {
+      nodes.push_back(level[pos]);
+    }
+
+    std::vector<std::tuple<double, int32_t, int32_t>> cands;
+    for (const auto &[a, b] : nearestPairs(nodes, neighbours)) {
+      cands.push_back({pairCost(nodes[a], nodes[b]), open[a], open[b]});
+    }
+    std::sort(cands.begin(), cands.end());
+
+    auto before = matching.size();
+    for (const auto &[cost, a, b] : cands) {
+      if (!used[a] && !used[b]) {
+        used[a] = used[b] = true;
+        mate[a] = b;
+        mate[b] = a;
+        matching.push_back({a, b});
+      }
+    }
+    if (matching.size() == before) {
+      break;
+    }
+    std::erase_if(open, [&](auto pos) { return used[pos]; });
+  }
+
+  // Greedy leaves a tail of long pairs among the last nodes. Swapping
+  // partners along candidate edges, (a, b) (c, d) -> (a, c) (b, d), when
+  // that is cheaper repairs most of it.
+  auto cands = nearestPairs(level, neighbours);
+  for (int32_t round = 0; round < 4; ++round) {
+    bool improved = false;
+    for (const auto &[a, c] : cands) {
+      auto b = mate[a], d = mate[c];
+      if (b == -1 || d == -1 || b == c) {
+        continue;
+      }
+      auto now = pairCost(level[a], level[b]) + pairCost(level[c], level[d]);
+      if (pairCost(level[a], level[c]) + pairCost(level[b], level[d]) < now) {
+        mate[a] = c;
+        mate[c] = a;
+        mate[b] = d;
+        mate[d] = b;
+        improved = true;
+      }
+    }
+    if (!improved) {
+      break;
+    }
+  }
+
+  matching.clear();
+  for (int32_t pos = 0; pos < static_cast<int32_t>(level.size()); ++pos) {
+    if (mate[pos] > pos) {
+      matching.push_back({pos, mate[pos]});
+    }
+  }
+  return matching;
+}
+
+inline TopologyResult TreeSynthesis::getMatchingTopology() {
+  TopologyResult res;
+  res.Nodes = *sinks_;
+
+  int32_t nextIdx = sinks_->size() + 1;
+  auto level = *sinks_;
+  while (level.size() > 1) {
+    std::vector<bool> merged(level.size(), false);
+    std::vector<TreeNode> next;
+    for (const auto &[a, b] : matchLevel(level)) {
+      auto node = NodePair{.Cost = 0, .A = level[a], .B = level[b]}
+                      .simpleMerge(nextIdx++);
+      res.Nodes.push_back(node);
+      res.Edges.push_back({node.Idx, level[a].Idx});
+      res.Edges.push_back({node.Idx, level[b].Idx});
+      next.push_back(node);
+      merged[a] = merged[b] = true;
+    }
+    // an odd node out waits for the next level
+    for (size_t pos = 0; pos < level.size(); ++pos) {
+      if (!merged[pos]) {
+        next.push_back(level[pos]);
+      }
+    }
+    level = std::move(next);
+  }
+
+  // Connect source to the root.
+  res.Nodes.push_back(source_);
+  if (!level.empty()) {
+    res.Edges.push_back({source_.Idx, level.front().Idx});
+  }
+  res.Tags = *idxToTag_;
   return res;
 }
 
@@ -1,14 +1,53 @@
 #define CATCH_CONFIG_MAIN // This tells Catch to provide a main() - only do this
                           // in one cpp file
 #include <algorithm>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
 #include <vector>
 
+#include "anytime.hpp"
+#include "autotune.hpp"
+#include "cluster.hpp"
 #include "dme.hpp"
+#include "eco.hpp"
+#include "evaluate.hpp"
+#include "greedydme.hpp"
+#include "hierarchical.hpp"
+#include "htree.hpp"
+#include "localsearch.hpp"
+#include "radixheap.hpp"
+#include "router.hpp"
+#include "sinkorder.hpp"
+#include "sweep.hpp"
+#include "topofile.hpp"
 #include "topology.hpp"
 #include <utils/catch.hpp>
 
 using namespace clksyn;
 
+// Random test design: `n` sinks s0, s1, ... spread uniformly over
+// [0, span] x [0, span] with caps 5 + i % 10, the source "src" at the
+// origin and `wires` as the wire library.
+static inparams randomDesign(
+    uint32_t seed, int32_t n, int64_t span,
+    std::vector<wire> wires = {
+        wire{.type = "0", .cap = 0.0002, .resistance = 0.0001}}) {
+  inparams inp{};
+  inp.wires = std::move(wires);
+  inp.src.source_name = "src";
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int64_t> coord(0, span);
+  for (int32_t i = 0; i < n; ++i) {
+    inp.sinks.push_back(sink{.id = "s" + std::to_string(i),
+                             .cord = point{.x = coord(rng), .y = coord(rng)},
+                             .cap = 5 + i % 10});
+  }
+  return inp;
+}
+
 TEST_CASE("Topology::NodePair Comparison Test", "[nodepaircomp]") {
   NodePair lhs{.Cost = 20, .A = {}, .B = {}};
   NodePair rhs{.Cost = 30, .A = {}, .B = {}};
@@ -21,10 +60,7 @@ TEST_CASE("Topology::NodePair Comparison Test", "[nodepaircomp]") {
 
 TEST_CASE("DME::DMENode TRR Tests", "[dme]") {
 
-  auto core = dme::DMECore{
-      .Kind = dme::DMECore::POINT,
-      .Loc = dme::pt_t{.x = 10, .y = 50},
-  };
+  auto core = dme::makeCore(dme::pt_t{.x = 10, .y = 50});
 
   auto trr = dme::DMETiledRegion(core, 20);
 
@@ -49,74 +85,1409 @@ TEST_CASE("DME::closestOnSegment Test", "[dme]") {
   REQUIRE(res == expPt);
 }
 
+TEST_CASE("DME::closestOnSegment Axis Parallel And Point Cores", "[dme]") {
+  auto vertical = dme::makeCore({.x = 4, .y = 10}, {.x = 4, .y = 0});
+  REQUIRE(dme::closestOnSegment(dme::pt_t{.x = 0, .y = 3}, vertical) ==
+          dme::pt_t{.x = 4, .y = 3});
+  REQUIRE(dme::manhattanDistance(dme::pt_t{.x = 0, .y = 20}, vertical) == 14);
+
+  auto arc = dme::makeCore({.x = 0, .y = 10}, {.x = 10, .y = 0});
+  REQUIRE(dme::closestOnSegment(dme::pt_t{.x = 20, .y = -5}, arc) ==
+          dme::pt_t{.x = 10, .y = 0});
+
+  auto point = dme::makeCore(dme::pt_t{.x = 3, .y = 3});
+  REQUIRE(point.isPoint());
+  REQUIRE(dme::coreDistance(point, arc) == 4);
+
+  // arcs of opposite slope crossing between lattice points
+  auto rising = dme::makeCore({.x = 0, .y = 1}, {.x = 10, .y = 11});
+  REQUIRE(dme::coresCross(rising, arc));
+  REQUIRE(dme::coreDistance(rising, arc) == 1);
+  REQUIRE(dme::manhattanDistance(dme::closestToCore(rising, arc), arc) == 1);
+}
 
 TEST_CASE("DME::DMETiledRegion Intersection Test", "[dme]") {
-  auto core1 =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 0, .y = 0}, {.x = 5, .y = 5}}};
+  auto core1 = dme::makeCore({.x = 0, .y = 0}, {.x = 5, .y = 5});
 
   auto reg1 = dme::DMETiledRegion(core1, 2);
 
-  auto core2 =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 5, .y = 0}, {.x = 15, .y = 10}}};
+  auto core2 = dme::makeCore({.x = 5, .y = 0}, {.x = 15, .y = 10});
 
   auto reg2 = dme::DMETiledRegion(core2, 3);
 
   auto intersection = dme::getTRRIntersection(reg1, reg2);
   REQUIRE(intersection.has_value());
 
-  auto coreR =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 2, .y = 0}, {.x = 7, .y = 5}}};
+  auto coreR = dme::makeCore({.x = 2, .y = 0}, {.x = 7, .y = 5});
 
   REQUIRE(intersection.value() == coreR);
 }
 
 TEST_CASE("DME::DMETiledRegion Intersection Test 0 Radius Segment Core",
           "[dme]") {
-  auto core1 =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 0, .y = 0}, {.x = 5, .y = 5}}};
+  auto core1 = dme::makeCore({.x = 0, .y = 0}, {.x = 5, .y = 5});
 
   auto reg1 = dme::DMETiledRegion(core1, 0);
 
-  auto core2 =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 5, .y = 0}, {.x = 15, .y = 10}}};
+  auto core2 = dme::makeCore({.x = 5, .y = 0}, {.x = 15, .y = 10});
 
   auto reg2 = dme::DMETiledRegion(core2, 5);
 
   auto intersection = dme::getTRRIntersection(reg1, reg2);
   REQUIRE(intersection.has_value());
 
-  auto coreR =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 0, .y = 0}, {.x = 5, .y = 5}}};
+  auto coreR = dme::makeCore({.x = 0, .y = 0}, {.x = 5, .y = 5});
 
   REQUIRE(intersection.value() == coreR);
 }
 
 TEST_CASE("DME::DMETiledRegion Intersection Test 0 Radius Point Core",
           "[dme]") {
-  auto core1 = dme::DMECore{.Kind = dme::DMECore::POINT,
-                            .Loc = dme::pt_t{.x = 0, .y = 0}};
+  auto core1 = dme::makeCore(dme::pt_t{.x = 0, .y = 0});
 
   auto reg1 = dme::DMETiledRegion(core1, 0);
 
-  auto core2 =
-      dme::DMECore{.Kind = dme::DMECore::SEGMENT,
-                   .Loc = dme::seg_t{{.x = 5, .y = 0}, {.x = 15, .y = 10}}};
+  auto core2 = dme::makeCore({.x = 5, .y = 0}, {.x = 15, .y = 10});
 
   auto reg2 = dme::DMETiledRegion(core2, 5);
 
   auto intersection = dme::getTRRIntersection(reg1, reg2);
   REQUIRE(intersection.has_value());
 
-  auto coreR = dme::DMECore{
-      .Kind = dme::DMECore::POINT,
-      .Loc = dme::pt_t{.x = 0, .y = 0},
-  };
+  auto coreR = dme::makeCore(dme::pt_t{.x = 0, .y = 0});
 
   REQUIRE(intersection.value() == coreR);
 }
+
+TEST_CASE("DME::mergeBuffered Keeps Load In Budget", "[dme]") {
+  auto buf = buffer{.id = "0",
+                    .cktname = "clkinv0.subckt",
+                    .inverted = 1,
+                    .in_cap = 35,
+                    .out_cap = 80,
+                    .resistance = 61.2};
+  auto wr = wire{.type = "0", .cap = 0.0002, .resistance = 0.0001};
+
+  auto lhs = dme::DMENode{
+      .Core = dme::makeCore(dme::pt_t{.x = 0, .y = 0}),
+      .LdCap = 400,
+      .Delay = 1000,
+  };
+  auto rhs = dme::DMENode{
+      .Core = dme::makeCore(dme::pt_t{.x = 100, .y = 0}),
+      .LdCap = 100,
+      .Delay = 37000,
+  };
+
+  auto merged = dme::mergeBuffered(lhs, rhs, wr, buf, 300, {});
+
+  // only the heavier subtree needs a (non-inverting) stage
+  REQUIRE(lhs.Buffers == 2);
+  REQUIRE(rhs.Buffers == 0);
+  REQUIRE(lhs.LdCap == 35);
+  REQUIRE(lhs.Delay == Approx(1000 + 61.2 * (80 + 400) + 61.2 * (80 + 35)));
+  REQUIRE(merged.LdCap <= 300);
+}
+
+TEST_CASE("DME::insertBuffer Keeps Buffers Off Blockages", "[dme]") {
+  auto buf = buffer{.id = "0",
+                    .cktname = "clkinv0.subckt",
+                    .inverted = 1,
+                    .in_cap = 35,
+                    .out_cap = 80,
+                    .resistance = 61.2};
+  auto wr = wire{.type = "0", .cap = 0.0002, .resistance = 0.0001};
+  auto blockages = std::vector<Blockage>{
+      Blockage{.x1 = 0, .y1 = 0, .x2 = 100, .y2 = 100},
+      Blockage{.x1 = 150, .y1 = 150, .x2 = 300, .y2 = 300}};
+
+  // an arc through both blockages keeps the clear run at its middle
+  auto arc = dme::makeCore(dme::pt_t{.x = 0, .y = 0},
+                           dme::pt_t{.x = 300, .y = 300});
+  REQUIRE(dme::clearCore(arc, blockages) ==
+          dme::makeCore(dme::pt_t{.x = 101, .y = 101},
+                        dme::pt_t{.x = 149, .y = 149}));
+  auto node = dme::DMENode{.Core = arc, .LdCap = 400, .Delay = 1000};
+  auto onArc = dme::insertBuffer(node, buf, wr, blockages);
+  REQUIRE(onArc.Stub == 0);
+  REQUIRE(onArc.Delay == Approx(dme::insertBuffer(node, buf).Delay));
+  REQUIRE_FALSE(dme::onBlockage(onArc.Core.First, blockages));
+
+  // a blocked point gets a stub out past the nearest side
+  node.Core = dme::makeCore(dme::pt_t{.x = 90, .y = 50});
+  auto stubbed = dme::insertBuffer(node, buf, wr, blockages);
+  REQUIRE(stubbed.Core == dme::makeCore(dme::pt_t{.x = 101, .y = 50}));
+  REQUIRE(stubbed.Stub == 11);
+  REQUIRE(stubbed.Below == dme::pt_t{.x = 90, .y = 50});
+  auto wm = dme::makeWireModel(wr);
+  REQUIRE(stubbed.Delay ==
+          Approx(1000 + wm.delay(11, 400) + 61.2 * (80 + 400 + 11 * wr.cap) +
+                 61.2 * (80 + 35)));
+
+  // whole trees: no buffer on a blockage, still zero skew
+  auto inp = randomDesign(26, 300, 100000, {wr});
+  inp.buffers = {buf};
+  inp.smul.cap_limit = 5000;
+  inp.src.buf_name = "0";
+  inp.blockages = {
+      Blockage{.x1 = 20000, .y1 = 20000, .x2 = 60000, .y2 = 60000},
+      Blockage{.x1 = 70000, .y1 = 0, .x2 = 80000, .y2 = 100000}};
+  auto top = TreeSynthesis(inp, TreeSynthesisSettings{
+                                     .Algo = TopologyAlgorithm::NNA,
+                                     .Alpha = 0,
+                                     .Beta = 0,
+                                     .Gamma = 0,
+                                     .Delta = 0.5})
+                 .getTopology();
+  auto tree = dme::EmbeddingManager(
+                  inp, top,
+                  dme::EmbeddingSettings{.Buffered = true, .CapBudget = 0.02})
+                  .computeEmbedding();
+  int32_t stubs = 0;
+  for (const auto &edge : tree.Edges) {
+    stubs += edge.Stub > 0;
+  }
+  REQUIRE(stubs > 0);
+  auto out = tree.toOutParam(inp);
+  REQUIRE(!out.buffers.empty());
+  std::map<std::string, point> at;
+  for (const auto &node : out.nodes) {
+    at[node.name] = node.pt;
+  }
+  for (const auto &cell : out.buffers) {
+    const auto &pt = at.at(cell.from);
+    REQUIRE_FALSE(
+        dme::onBlockage(dme::pt_t{.x = pt.x, .y = pt.y}, inp.blockages));
+  }
+  auto eval = dme::evaluate(inp, tree);
+  REQUIRE(eval.Skew < 1e-3 * eval.MaxLatency);
+}
+
+TEST_CASE("DME::selectWire Trunk And Leaf Edges", "[dme]") {
+  auto table = dme::makeWireTable({
+      wire{.type = "0", .cap = 0.0002, .resistance = 0.0001},
+      wire{.type = "1", .cap = 0.00016, .resistance = 0.0003},
+  });
+
+  auto pointNode = [](int64_t x, double cap, double delay) {
+    return dme::DMENode{
+        .Core = dme::makeCore(dme::pt_t{.x = x, .y = 0}),
+        .LdCap = cap,
+        .Delay = delay,
+    };
+  };
+
+  // short edges between light sinks favour the low capacitance wire
+  REQUIRE(dme::selectWire(pointNode(0, 20, 0), pointNode(20000, 20, 0), table,
+                          1000) == 1);
+
+  // long edges between heavy subtrees favour the low resistance wire
+  REQUIRE(dme::selectWire(pointNode(0, 20000, 1e6),
+                          pointNode(2000000, 20000, 1e6), table, 1000) == 0);
+}
+
+TEST_CASE("DME::toOutParam Writes Library Codes", "[dme]") {
+  // named codes as in starter/s1.diff_names
+  auto inp = randomDesign(
+      27, 200, 2000000,
+      {wire{.type = "0_is_a_name", .cap = 0.0002, .resistance = 0.0001},
+       wire{.type = "wc1", .cap = 0.00016, .resistance = 0.0003}});
+  inp.buffers = {buffer{.id = "0_is_a_buf_name",
+                        .cktname = "clkinv0.subckt",
+                        .inverted = 1,
+                        .in_cap = 35,
+                        .out_cap = 80,
+                        .resistance = 61.2}};
+  inp.smul.cap_limit = 5000;
+  auto sett = dme::EmbeddingSettings{};
+  sett.Buffered = true;
+  sett.CapBudget = 0.1;
+  auto top = TreeSynthesis(inp, TreeSynthesisSettings{
+                                     .Algo = TopologyAlgorithm::NNA,
+                                     .Alpha = 0,
+                                     .Beta = 0,
+                                     .Gamma = 0,
+                                     .Delta = 0.5})
+                 .getTopology();
+  auto tree = dme::EmbeddingManager(inp, top, sett).computeEmbedding();
+
+  std::set<std::string> wireTypes, bufferTypes;
+  for (const auto &w : tree.toOutParam(inp).wires) {
+    wireTypes.insert(w.type);
+  }
+  for (const auto &b : tree.toOutParam(inp).buffers) {
+    bufferTypes.insert(b.type);
+  }
+  REQUIRE(wireTypes == std::set<std::string>{"0_is_a_name", "wc1"});
+  REQUIRE(bufferTypes == std::set<std::string>{"0_is_a_buf_name"});
+  for (const auto &w : top.toOutParam(inp).wires) {
+    REQUIRE(w.type == "0_is_a_name");
+  }
+}
+
+TEST_CASE("DME::splitMerge Snakes Unbalanced Subtrees", "[dme]") {
+  auto wm = dme::makeWireModel(
+      wire{.type = "0", .cap = 0.0002, .resistance = 0.0001});
+
+  auto fast = dme::DMENode{
+      .Core = dme::makeCore(dme::pt_t{.x = 0, .y = 0}),
+      .LdCap = 20,
+      .Delay = 0,
+  };
+  auto slow = dme::DMENode{
+      .Core = dme::makeCore(dme::pt_t{.x = 1000, .y = 0}),
+      .LdCap = 20,
+      .Delay = 1e5,
+  };
+
+  auto split = dme::splitMerge(fast, slow, 1000, wm);
+
+  // merge point sits on the slow subtree, the fast side is elongated
+  REQUIRE(split.LenB == 0);
+  REQUIRE(split.LenA > 1000);
+  REQUIRE(wm.delay(split.LenA, 20) == Approx(1e5).epsilon(1e-3));
+  REQUIRE(split.LdCap == Approx(40 + split.LenA * 0.0002));
+
+  auto merged = dme::merge(fast, slow, split);
+  REQUIRE(merged.Core == slow.Core);
+}
+
+TEST_CASE("DME::EmbeddingManager Deep Chain Topology", "[dme]") {
+  // caterpillar topology, every internal node merges the previous internal
+  // node with the next sink, deep enough to overflow a recursive walk
+  const int32_t numSinks = 200000;
+
+  inparams inp;
+  inp.wires = {wire{.type = "0", .cap = 0.0002, .resistance = 0.0001}};
+
+  TopologyResult top;
+  for (int32_t i = 1; i <= numSinks; ++i) {
+    top.Nodes.push_back(TreeNode{
+        .Kind = TreeNode::SINK, .Idx = i, .x = 10 * i, .y = 0, .LdCap = 1});
+  }
+  int32_t prev = 1;
+  for (int32_t i = 2; i <= numSinks; ++i) {
+    auto idx = numSinks + i - 1;
+    top.Nodes.push_back(TreeNode{
+        .Kind = TreeNode::INTERNAL, .Idx = idx, .x = 0, .y = 0, .LdCap = 0});
+    top.Edges.push_back({idx, prev});
+    top.Edges.push_back({idx, i});
+    prev = idx;
+  }
+  top.Nodes.push_back(TreeNode{
+      .Kind = TreeNode::SOURCE, .Idx = 0, .x = 0, .y = 0, .LdCap = 0});
+  top.Edges.push_back({0, prev});
+
+  auto em = dme::EmbeddingManager(inp, top, {.WireType = 0});
+  auto res = em.computeEmbedding();
+
+  REQUIRE(res.Topology.Nodes.size() == top.Nodes.size());
+  // the sink hooked in right below the root balances the whole chain
+  REQUIRE(res.Edges[numSinks].Length > res.Edges[1].Length);
+}
+
+TEST_CASE("DME::EmbeddingManager Parallel Matches Serial", "[dme]") {
+  auto inp = randomDesign(
+      7, 300, 200000,
+      {wire{.type = "0", .cap = 0.0002, .resistance = 0.0001},
+       wire{.type = "1", .cap = 0.00016, .resistance = 0.0003}});
+
+  auto top = TreeSynthesis(inp, TreeSynthesisSettings{
+                                    .Algo = TopologyAlgorithm::NNA,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0.5})
+                 .getTopology();
+
+  auto serial = dme::EmbeddingManager(inp, top).computeEmbedding();
+  auto parallel =
+      dme::EmbeddingManager(inp, top, {.Threads = 4, .TaskCutoff = 8})
+          .computeEmbedding();
+
+  REQUIRE(serial.Topology.Nodes == parallel.Topology.Nodes);
+  for (size_t i = 0; i < serial.Edges.size(); ++i) {
+    REQUIRE(serial.Edges[i].Wire == parallel.Edges[i].Wire);
+    REQUIRE(serial.Edges[i].Length == parallel.Edges[i].Length);
+  }
+}
+
+TEST_CASE("DME::GreedyDME Builds A Valid Embedding", "[dme]") {
+  auto inp = randomDesign(11, 300, 200000);
+
+  auto res = dme::GreedyDME(inp).computeEmbedding();
+  // sinks, internal nodes and the source
+  REQUIRE(res.Topology.Nodes.size() == 2 * inp.sinks.size());
+  REQUIRE(res.Topology.Edges.size() == 2 * inp.sinks.size() - 1);
+
+  std::map<int32_t, TreeNode> byIdx;
+  for (const auto &node : res.Topology.Nodes) {
+    byIdx[node.Idx] = node;
+  }
+  std::map<int32_t, int32_t> numKids;
+  for (const auto &[from, to] : res.Topology.Edges) {
+    ++numKids[from];
+    auto dist = std::abs(byIdx[from].x - byIdx[to].x) +
+                std::abs(byIdx[from].y - byIdx[to].y);
+    // wire is never shorter than the placed end points are apart
+    REQUIRE(res.Edges[to].Length >= dist);
+  }
+  for (const auto &[idx, kids] : numKids) {
+    REQUIRE(kids == (idx == 0 ? 1 : 2));
+  }
+
+  // merged at zero skew points, like the DME embedding
+  auto eval = dme::evaluate(inp, res);
+  REQUIRE(eval.Skew < 1e-3 * eval.MaxLatency);
+}
+
+TEST_CASE("Topology::MMM Balanced Bipartition", "[topology]") {
+  const int32_t numSinks = 20000;
+  auto inp = randomDesign(3, numSinks, 1000000);
+
+  auto sett = TreeSynthesisSettings{.Algo = TopologyAlgorithm::MMM,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0};
+  auto serial = TreeSynthesis(inp, sett).getTopology();
+  sett.Threads = 4;
+  auto parallel = TreeSynthesis(inp, sett).getTopology();
+
+  REQUIRE(serial.Nodes.size() == 2 * numSinks);
+  REQUIRE(serial.Edges.size() == 2 * numSinks - 1);
+  REQUIRE(serial.Nodes == parallel.Nodes);
+  REQUIRE(serial.Edges == parallel.Edges);
+
+  // equal loads split evenly, so the depth stays logarithmic
+  std::vector<int32_t> parentOf(2 * numSinks, -1);
+  for (const auto &[from, to] : serial.Edges) {
+    parentOf[to] = from;
+  }
+  int32_t maxDepth = 0;
+  for (int32_t idx = 1; idx <= numSinks; ++idx) {
+    int32_t d = 0;
+    for (auto cur = idx; cur != 0; cur = parentOf[cur]) {
+      ++d;
+    }
+    maxDepth = std::max(maxDepth, d);
+  }
+  REQUIRE(maxDepth <= 17);
+}
+
+TEST_CASE("Topology::RadixHeap Pops In Key Order", "[topology]") {
+  std::mt19937 rng(23);
+  std::uniform_int_distribution<uint64_t> key(0, 1 << 20);
+  clksyn::RadixHeap<int32_t> heap;
+  std::multiset<uint64_t> expected;
+
+  // interleaved like NNA passes: later pushes may undercut the last pop
+  int32_t pushed = 0;
+  for (int32_t round = 0; round < 50; ++round) {
+    for (int32_t i = 0; i < 200; ++i) {
+      auto k = key(rng);
+      heap.push(k, pushed++);
+      expected.insert(k);
+    }
+    for (int32_t i = 0; i < 150; ++i) {
+      REQUIRE(heap.size() == expected.size());
+      auto [k, value] = heap.pop();
+      REQUIRE(k == *expected.begin());
+      expected.erase(expected.begin());
+    }
+  }
+  while (!heap.empty()) {
+    auto [k, value] = heap.pop();
+    REQUIRE(k == *expected.begin());
+    expected.erase(expected.begin());
+  }
+  REQUIRE(expected.empty());
+}
+
+TEST_CASE("Topology::nearestPairs Matches Brute Force", "[topology]") {
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<int64_t> coord(0, 5000);
+  std::vector<TreeNode> nodes;
+  for (int32_t i = 0; i < 500; ++i) {
+    nodes.push_back(TreeNode{.Kind = TreeNode::SINK,
+                             .Idx = i + 1,
+                             .x = coord(rng),
+                             .y = coord(rng),
+                             .LdCap = 1});
+  }
+
+  auto pairs = nearestPairs(nodes, 3);
+  auto dist = [&](int32_t a, int32_t b) {
+    return std::abs(nodes[a].x - nodes[b].x) +
+           std::abs(nodes[a].y - nodes[b].y);
+  };
+  // every node is paired with something at its nearest distance
+  for (int32_t i = 0; i < 500; ++i) {
+    int64_t nearest = std::numeric_limits<int64_t>::max();
+    for (int32_t j = 0; j < 500; ++j) {
+      if (i != j) {
+        nearest = std::min(nearest, dist(i, j));
+      }
+    }
+    auto found = std::any_of(pairs.begin(), pairs.end(), [&](auto &&pr) {
+      return (pr.first == i || pr.second == i) &&
+             dist(pr.first, pr.second) == nearest;
+    });
+    REQUIRE(found);
+  }
+}
+
+TEST_CASE("Topology::NNA Bounded Pair Memory", "[topology]") {
+  const int32_t numSinks = 2000;
+  auto inp = randomDesign(29, numSinks, 1000000);
+
+  auto wirelength = [](const TopologyResult &res) {
+    std::map<int32_t, TreeNode> byIdx;
+    for (const auto &node : res.Nodes) {
+      byIdx[node.Idx] = node;
+    }
+    int64_t total = 0;
+    for (const auto &[from, to] : res.Edges) {
+      if (from != 0) {
+        total += std::abs(byIdx[from].x - byIdx[to].x) +
+                 std::abs(byIdx[from].y - byIdx[to].y);
+      }
+    }
+    return total;
+  };
+
+  auto sett = TreeSynthesisSettings{.Algo = TopologyAlgorithm::NNA,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0.5};
+  auto full = TreeSynthesis(inp, sett);
+  auto fullRes = full.getTopology();
+  REQUIRE(full.stats().CandidatesPerNode == 0);
+
+  // room for 8 candidates per node
+  sett.MaxPairMem = numSinks * 8 *
+                    (PairQueue::BytesPerPair +
+                     sizeof(std::pair<int32_t, int32_t>));
+  auto capped = TreeSynthesis(inp, sett);
+  auto res = capped.getTopology();
+  const auto &stats = capped.stats();
+  REQUIRE(stats.PairBudget == sett.MaxPairMem);
+  REQUIRE(stats.CandidatesPerNode == 8);
+  REQUIRE(static_cast<int64_t>(stats.PeakPairs) * PairQueue::BytesPerPair <=
+          sett.MaxPairMem);
+
+  REQUIRE(res.Nodes.size() == 2 * numSinks);
+  REQUIRE(res.Edges.size() == 2 * numSinks - 1);
+  std::map<int32_t, int32_t> numKids;
+  for (const auto &[from, to] : res.Edges) {
+    ++numKids[from];
+  }
+  for (const auto &[idx, kids] : numKids) {
+    REQUIRE(kids == (idx == 0 ? 1 : 2));
+  }
+  REQUIRE(wirelength(res) < 1.05 * wirelength(fullRes));
+
+  // not even one candidate per node fits
+  sett.MaxPairMem = numSinks * PairQueue::BytesPerPair / 2;
+  REQUIRE_THROWS_AS(TreeSynthesis(inp, sett).getTopology(),
+                    std::runtime_error);
+
+  // the smallest cap main accepts is enough for the other flows too, one
+  // byte less fails there as well
+  sett.MaxPairMem = minPairMem(numSinks, sett.Seeding);
+  auto sweep = dme::runSweep(
+      inp, {sett}, dme::SweepSettings{.Embedding = {}, .Threads = 2});
+  REQUIRE(sweep.Best.Topology.Edges.size() == 2 * numSinks - 1);
+  sett.MaxPairMem -= 1;
+  REQUIRE_THROWS_AS(
+      dme::runSweep(inp, {sett},
+                    dme::SweepSettings{.Embedding = {}, .Threads = 1}),
+      std::runtime_error);
+}
+
+TEST_CASE("Topology::Morton Seeding Stays Close To Exhaustive NNA",
+          "[topology]") {
+  // centred on the origin, the keys must handle negative coordinates
+  const int32_t numSinks = 2000;
+  auto inp = randomDesign(49, numSinks, 1000000);
+  for (auto &s : inp.sinks) {
+    s.cord = point{.x = s.cord.x - 500000, .y = s.cord.y - 500000};
+  }
+
+  // window neighbours on every curve, each pair once
+  std::vector<TreeNode> nodes;
+  for (int32_t i = 0; i < 100; ++i) {
+    nodes.push_back(TreeNode{.Kind = TreeNode::SINK,
+                             .Idx = i + 1,
+                             .x = inp.sinks[i].cord.x,
+                             .y = inp.sinks[i].cord.y,
+                             .LdCap = 1});
+  }
+  auto pairs = mortonPairs(nodes, 3, 2);
+  REQUIRE(std::is_sorted(pairs.begin(), pairs.end()));
+  REQUIRE(std::adjacent_find(pairs.begin(), pairs.end()) == pairs.end());
+  REQUIRE(pairs.size() >= 3 * 100 - 6);
+  REQUIRE(pairs.size() <= 2 * (3 * 100 - 6));
+  for (const auto &[a, b] : pairs) {
+    REQUIRE(a < b);
+  }
+  REQUIRE(mortonPairs(nodes, 3, 2) == pairs);
+
+  auto wirelength = [](const TopologyResult &res) {
+    std::map<int32_t, TreeNode> byIdx;
+    for (const auto &node : res.Nodes) {
+      byIdx[node.Idx] = node;
+    }
+    int64_t total = 0;
+    for (const auto &[from, to] : res.Edges) {
+      if (from != 0) {
+        total += std::abs(byIdx[from].x - byIdx[to].x) +
+                 std::abs(byIdx[from].y - byIdx[to].y);
+      }
+    }
+    return total;
+  };
+
+  auto sett = TreeSynthesisSettings{.Algo = TopologyAlgorithm::NNA,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0.5};
+  auto exact = TreeSynthesis(inp, sett).getTopology();
+  sett.Seeding = PairSeeding::MORTON;
+  auto synth = TreeSynthesis(inp, sett);
+  auto res = synth.getTopology();
+  REQUIRE(synth.stats().CandidatesPerNode == 16);
+  REQUIRE(synth.stats().PeakPairs < 16 * numSinks);
+  REQUIRE(res.Nodes.size() == 2 * numSinks);
+  REQUIRE(res.Edges.size() == 2 * numSinks - 1);
+  REQUIRE(wirelength(res) < 1.05 * wirelength(exact));
+
+  // the curves may be sorted concurrently
+  sett.Threads = 3;
+  REQUIRE(TreeSynthesis(inp, sett).getTopology().Edges == res.Edges);
+
+  // a memory cap narrows the window before dropping curves
+  auto perCandidate = static_cast<int64_t>(
+      PairQueue::BytesPerPair + 2 * sizeof(std::pair<int32_t, int32_t>));
+  sett.MaxPairMem = numSinks * 6 * perCandidate;
+  auto capped = TreeSynthesis(inp, sett);
+  auto cappedRes = capped.getTopology();
+  REQUIRE(capped.stats().CandidatesPerNode == 4);
+  REQUIRE(static_cast<int64_t>(capped.stats().PeakPairs) * perCandidate <=
+          sett.MaxPairMem);
+  REQUIRE(cappedRes.Edges.size() == 2 * numSinks - 1);
+  sett.MaxPairMem = numSinks * perCandidate / 2;
+  REQUIRE_THROWS_AS(TreeSynthesis(inp, sett).getTopology(),
+                    std::runtime_error);
+}
+
+TEST_CASE("Topology::DNNA Tracks Subtree Loads", "[topology]") {
+  const int32_t numSinks = 400;
+  auto inp = randomDesign(
+      31, numSinks, 200000,
+      {wire{.type = "0", .cap = 0.0002, .resistance = 0.0001},
+       wire{.type = "1", .cap = 0.0001, .resistance = 0.0003}});
+
+  auto res = TreeSynthesis(inp, TreeSynthesisSettings{
+                                    .Algo = TopologyAlgorithm::DNNA,
+                                    .Alpha = 0.2,
+                                    .Beta = 1.0,
+                                    .Gamma = 0.5,
+                                    .Delta = 2.5})
+                 .getTopology();
+
+  // every merge carries its kids' loads plus the joining wire at the
+  // lowest unit cap
+  std::map<int32_t, TreeNode> byIdx;
+  for (const auto &node : res.Nodes) {
+    byIdx[node.Idx] = node;
+  }
+  std::map<int32_t, std::vector<int32_t>> kids;
+  for (const auto &[from, to] : res.Edges) {
+    kids[from].push_back(to);
+  }
+  for (const auto &[idx, node] : byIdx) {
+    if (node.Kind != TreeNode::INTERNAL) {
+      continue;
+    }
+    REQUIRE(kids[idx].size() == 2);
+    const auto &a = byIdx[kids[idx][0]], &b = byIdx[kids[idx][1]];
+    auto wireLength = std::abs(a.x - b.x) + std::abs(a.y - b.y);
+    REQUIRE(node.LdCap ==
+            Approx(a.LdCap + b.LdCap + 0.0001 * wireLength));
+  }
+}
+
+TEST_CASE("Topology::MATCHING Halves Every Level", "[topology]") {
+  const int32_t numSinks = 5000;
+  auto inp = randomDesign(9, numSinks, 1000000);
+
+  auto top = TreeSynthesis(inp, TreeSynthesisSettings{
+                                    .Algo = TopologyAlgorithm::MATCHING,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0})
+                 .getTopology();
+  REQUIRE(top.Nodes.size() == 2 * numSinks);
+  REQUIRE(top.Edges.size() == 2 * numSinks - 1);
+
+  std::vector<int32_t> parentOf(2 * numSinks, -1);
+  for (const auto &[from, to] : top.Edges) {
+    REQUIRE(parentOf[to] == -1);
+    parentOf[to] = from;
+  }
+  // ceil(log2(5000)) levels plus the source edge
+  for (int32_t idx = 1; idx <= numSinks; ++idx) {
+    int32_t depth = 0;
+    for (auto cur = idx; cur != 0; cur = parentOf[cur]) {
+      ++depth;
+    }
+    REQUIRE(depth <= 14);
+  }
+}
+
+TEST_CASE("DME::HierarchicalSynthesis Stitches Clusters", "[dme]") {
+  const int32_t numSinks = 3000;
+  auto inp = randomDesign(13, numSinks, 500000);
+
+  auto res = dme::HierarchicalSynthesis(
+                 inp, dme::HierarchicalSettings{
+                          .Topology = {.Algo = TopologyAlgorithm::NNA,
+                                       .Alpha = 0,
+                                       .Beta = 0,
+                                       .Gamma = 0,
+                                       .Delta = 0.5},
+                          .Embedding = {},
+                          .ClusterSize = 400,
+                          .Threads = 2})
+                 .computeEmbedding();
+
+  const auto &top = res.Topology;
+  REQUIRE(top.Nodes.size() == 2 * numSinks);
+  REQUIRE(top.Edges.size() == 2 * numSinks - 1);
+
+  // every sink keeps its index and name, every other node has two kids
+  std::map<int32_t, TreeNode> byIdx;
+  for (const auto &node : top.Nodes) {
+    REQUIRE(byIdx.count(node.Idx) == 0);
+    byIdx[node.Idx] = node;
+  }
+  for (int32_t i = 0; i < numSinks; ++i) {
+    REQUIRE(byIdx[i + 1].Kind == TreeNode::SINK);
+    REQUIRE(byIdx[i + 1].x == inp.sinks[i].cord.x);
+    REQUIRE(res.Topology.Tags.at(i + 1) == inp.sinks[i].id);
+  }
+  std::map<int32_t, int32_t> numKids;
+  for (const auto &[from, to] : top.Edges) {
+    ++numKids[from];
+    auto dist = std::abs(byIdx[from].x - byIdx[to].x) +
+                std::abs(byIdx[from].y - byIdx[to].y);
+    REQUIRE(res.Edges[to].Length >= dist);
+  }
+  for (const auto &[idx, kids] : numKids) {
+    REQUIRE(kids == (idx == 0 ? 1 : 2));
+  }
+}
+
+TEST_CASE("DME::HTreeSynthesis Balances The Trunk", "[dme]") {
+  auto inp = randomDesign(17, 2400, 400000);
+  inp.smul.lower_left = point{.x = 0, .y = 0};
+  inp.smul.upper_right = point{.x = 400000, .y = 400000};
+
+  // the top right corner stays empty, its branch of the trunk is pruned
+  std::erase_if(inp.sinks, [](const sink &s) {
+    return s.cord.x > 300000 && s.cord.y > 300000;
+  });
+  const int32_t numSinks = 2000;
+  REQUIRE(inp.sinks.size() >= static_cast<size_t>(numSinks));
+  inp.sinks.resize(numSinks);
+
+  auto res = dme::HTreeSynthesis(
+                 inp, dme::HTreeSettings{
+                          .Topology = {.Algo = TopologyAlgorithm::NNA,
+                                       .Alpha = 0,
+                                       .Beta = 0,
+                                       .Gamma = 0,
+                                       .Delta = 0.5},
+                          .Embedding = {},
+                          .Depth = 4,
+                          .Threads = 2})
+                 .computeEmbedding();
+
+  const auto &top = res.Topology;
+  std::map<int32_t, TreeNode> byIdx;
+  for (const auto &node : top.Nodes) {
+    REQUIRE(byIdx.count(node.Idx) == 0);
+    byIdx[node.Idx] = node;
+  }
+  for (int32_t i = 0; i < numSinks; ++i) {
+    REQUIRE(byIdx[i + 1].Kind == TreeNode::SINK);
+    REQUIRE(res.Topology.Tags.at(i + 1) == inp.sinks[i].id);
+  }
+  REQUIRE(top.Edges.size() == top.Nodes.size() - 1);
+
+  std::map<int32_t, std::vector<int32_t>> kids;
+  for (const auto &[from, to] : top.Edges) {
+    kids[from].push_back(to);
+    auto dist = std::abs(byIdx[from].x - byIdx[to].x) +
+                std::abs(byIdx[from].y - byIdx[to].y);
+    REQUIRE(res.Edges[to].Length >= dist);
+  }
+  REQUIRE(kids[0].size() == 1);
+  REQUIRE(byIdx[kids[0][0]].x == 200000);
+  REQUIRE(byIdx[kids[0][0]].y == 200000);
+
+  // Elmore delay to every sink, the trunk has to absorb any imbalance
+  // between the leaf regions
+  const auto &wr = inp.wires[0];
+  std::map<int32_t, double> load;
+  auto downstream = [&](auto &&self, int32_t idx) -> double {
+    double cap = byIdx[idx].Kind == TreeNode::SINK
+                     ? inp.sinks[idx - 1].cap
+                     : 0;
+    for (auto kid : kids[idx]) {
+      cap += self(self, kid) + wr.cap * res.Edges[kid].Length;
+    }
+    return load[idx] = cap;
+  };
+  downstream(downstream, 0);
+  double minDelay = std::numeric_limits<double>::max(), maxDelay = 0;
+  auto elmore = [&](auto &&self, int32_t idx, double delay) -> void {
+    if (byIdx[idx].Kind == TreeNode::SINK) {
+      minDelay = std::min(minDelay, delay);
+      maxDelay = std::max(maxDelay, delay);
+    }
+    for (auto kid : kids[idx]) {
+      double len = res.Edges[kid].Length;
+      self(self, kid,
+           delay + wr.resistance * len * (wr.cap * len / 2 + load[kid]));
+    }
+  };
+  elmore(elmore, 0, 0);
+  REQUIRE(maxDelay - minDelay < 1e-3 * maxDelay);
+}
+
+TEST_CASE("DME::evaluate Hand Computed Elmore", "[dme]") {
+  inparams inp;
+  inp.wires = {wire{.type = "0", .cap = 1, .resistance = 2}};
+  inp.buffers = {buffer{.id = "0",
+                        .cktname = "inv",
+                        .inverted = 0,
+                        .in_cap = 4,
+                        .out_cap = 1,
+                        .resistance = 3}};
+  inp.sinks = {sink{.id = "a", .cord = point{.x = 10, .y = 5}, .cap = 10},
+               sink{.id = "b", .cord = point{.x = 20, .y = 0}, .cap = 20}};
+
+  // src -> 3 -> {1, buffered 2}
+  dme::EmbeddingResult res;
+  res.Topology.Nodes = {
+      TreeNode{.Kind = TreeNode::SINK, .Idx = 1, .x = 10, .y = 5, .LdCap = 10},
+      TreeNode{.Kind = TreeNode::SINK, .Idx = 2, .x = 20, .y = 0, .LdCap = 20},
+      TreeNode{.Kind = TreeNode::INTERNAL, .Idx = 3, .x = 10, .y = 0,
+               .LdCap = 0},
+      TreeNode{.Kind = TreeNode::SOURCE, .Idx = 0, .x = 0, .y = 0,
+               .LdCap = 0}};
+  res.Topology.Edges = {{0, 3}, {3, 1}, {3, 2}};
+  res.Edges = {{},
+               {.Wire = 0, .Length = 5},
+               {.Wire = 0, .Length = 10, .Buffers = 1},
+               {.Wire = 0, .Length = 10}};
+
+  auto eval = dme::evaluate(inp, res);
+  // load at 3: wires 5 + 10, sink a 10, buffer input 4
+  // t3 = 10 * (2 * 29 + 1 * 10) = 680
+  // ta = 680 + 5 * (2 * 10 + 5) = 805
+  // tb = 680 + 10 * (2 * 4 + 10) + 3 * (1 + 20) = 923
+  REQUIRE(eval.MaxLatency == Approx(923));
+  REQUIRE(eval.MinLatency == Approx(805));
+  REQUIRE(eval.Skew == Approx(118));
+  REQUIRE(eval.WireCap == Approx(25));
+  REQUIRE(eval.TotalCap == Approx(59));
+}
+
+TEST_CASE("DME::runSweep Ranks Points Deterministically", "[dme]") {
+  auto inp = randomDesign(37, 150, 100000);
+  inp.blockages = {Blockage{.x1 = 20000, .y1 = 20000, .x2 = 40000,
+                            .y2 = 60000}};
+
+  auto base = TreeSynthesisSettings{.Algo = TopologyAlgorithm::DNNA,
+                                    .Alpha = 0.2,
+                                    .Beta = 1.0,
+                                    .Gamma = 0.5,
+                                    .Delta = 2.5};
+  auto grid = dme::parseSweepGrid(
+      "algo=dnna,nna;alpha=0.1,0.4;gamma=0,0.5;delta=0.5,2.5", base);
+  REQUIRE(grid.size() == 16);
+  REQUIRE_THROWS(dme::parseSweepGrid("theta=1", base));
+  REQUIRE_THROWS(dme::parseSweepGrid("algo=xyz", base));
+
+  auto serial = dme::runSweep(
+      inp, grid, dme::SweepSettings{.Embedding = {}, .Threads = 1});
+  auto parallel = dme::runSweep(
+      inp, grid, dme::SweepSettings{.Embedding = {}, .Threads = 3});
+  REQUIRE(serial.Points.size() == grid.size());
+  for (size_t i = 0; i < grid.size(); ++i) {
+    REQUIRE(serial.Points[i].Objective == parallel.Points[i].Objective);
+    REQUIRE(serial.Points[i].Settings.Alpha ==
+            parallel.Points[i].Settings.Alpha);
+    if (i > 0) {
+      REQUIRE(serial.Points[i - 1].Objective <= serial.Points[i].Objective);
+    }
+  }
+  // the kept tree is the top ranked one
+  auto best = dme::evaluate(inp, parallel.Best);
+  REQUIRE(best.TotalCap == Approx(parallel.Points[0].Score.TotalCap));
+}
+
+TEST_CASE("DME::autotune Never Loses To The Base Settings", "[dme]") {
+  auto inp = randomDesign(41, 600, 100000);
+
+  auto base = TreeSynthesisSettings{.Algo = TopologyAlgorithm::DNNA,
+                                    .Alpha = 0.2,
+                                    .Beta = 1.0,
+                                    .Gamma = 0.5,
+                                    .Delta = 2.5};
+  auto sett = dme::AutotuneSettings{.Base = base,
+                                    .Sweep = {.Embedding = {}, .Threads = 2},
+                                    .Candidates = 8,
+                                    .MinSample = 64,
+                                    .TimeBudget = 600,
+                                    .Brackets = 2,
+                                    .OnImprove = {}};
+  auto res = dme::autotune(inp, sett);
+  auto baseScore = dme::scorePoint(TreeSynthesis(inp, base), inp, base,
+                                   sett.Sweep);
+  REQUIRE_FALSE(res.TimedOut);
+  REQUIRE(res.Best.Objective <= baseScore.Objective);
+  // the second bracket starts from the incumbent, already scored
+  REQUIRE(res.CacheHits >= 1);
+  auto tree = dme::evaluate(inp, res.Tree);
+  REQUIRE(tree.TotalCap == Approx(res.Best.Score.TotalCap));
+
+  // no budget at all still returns the base tree
+  sett.TimeBudget = 0;
+  auto none = dme::autotune(inp, sett);
+  REQUIRE(none.TimedOut);
+  REQUIRE(none.Evaluations == 1);
+  REQUIRE(none.Best.Objective == Approx(baseScore.Objective));
+}
+
+TEST_CASE("DME::anytimeSynthesis Checkpoints Only Improvements", "[dme]") {
+  auto inp = randomDesign(43, 400, 100000);
+
+  auto sett = dme::AnytimeSettings{.Topology = {.Algo = TopologyAlgorithm::DNNA,
+                                                .Alpha = 0.2,
+                                                .Beta = 1.0,
+                                                .Gamma = 0.5,
+                                                .Delta = 2.5},
+                                   .Sweep = {},
+                                   .TimeBudget = 0,
+                                   .Candidates = 8};
+  std::vector<std::string> stages;
+  std::vector<double> objectives;
+  auto record = [&](const dme::AnytimeResult &best) {
+    stages.push_back(best.Stage);
+    objectives.push_back(best.Best.Objective);
+    REQUIRE(dme::evaluate(inp, best.Tree).TotalCap ==
+            Approx(best.Best.Score.TotalCap));
+  };
+
+  // out of time before the first tree, which is produced regardless
+  auto first = dme::anytimeSynthesis(inp, sett, record);
+  REQUIRE(stages == std::vector<std::string>{"mmm"});
+  REQUIRE(first.Improvements == 1);
+
+  stages.clear();
+  objectives.clear();
+  sett.TimeBudget = 1;
+  auto res = dme::anytimeSynthesis(inp, sett, record);
+  REQUIRE(stages.front() == "mmm");
+  REQUIRE(res.Improvements == static_cast<int32_t>(stages.size()));
+  for (size_t i = 1; i < objectives.size(); ++i) {
+    REQUIRE(objectives[i] < objectives[i - 1]);
+  }
+  REQUIRE(res.Best.Objective == objectives.back());
+
+  auto dir = std::filesystem::temp_directory_path() / "anytime_checkpoint";
+  std::filesystem::create_directories(dir);
+  auto out = (dir / "tree.out").string();
+  REQUIRE(dme::writeTreeAtomically(inp, out, res.Tree));
+  REQUIRE(std::filesystem::file_size(out) > 0);
+  REQUIRE(std::filesystem::file_size(out + ".embedding") > 0);
+  REQUIRE_FALSE(std::filesystem::exists(out + ".tmp"));
+  REQUIRE_FALSE(std::filesystem::exists(out + ".embedding.tmp"));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("DME::EcoSession Matches A Full Re-embedding", "[dme]") {
+  auto inp = randomDesign(
+      47, 1500, 100000,
+      {wire{.type = "0", .cap = 0.0002, .resistance = 0.0001},
+       wire{.type = "1", .cap = 0.0001, .resistance = 0.0003}});
+  auto topology = TreeSynthesis(inp, TreeSynthesisSettings{
+                                         .Algo = TopologyAlgorithm::NNA,
+                                         .Alpha = 0,
+                                         .Beta = 0,
+                                         .Gamma = 0,
+                                         .Delta = 0.5})
+                      .getTopology();
+
+  auto full = [](const inparams &in, const dme::EmbeddingResult &tree) {
+    return dme::EmbeddingManager(in, tree.Topology).computeEmbedding();
+  };
+  // internal nodes may be numbered differently
+  auto sameTree = [](const dme::EmbeddingResult &a,
+                     const dme::EmbeddingResult &b) {
+    auto shape = [](const dme::EmbeddingResult &tree) {
+      std::vector<std::tuple<int32_t, int64_t, int64_t, int64_t, int32_t>>
+          nodes;
+      for (const auto &node : tree.Topology.Nodes) {
+        const auto &edge = tree.Edges[node.Idx];
+        nodes.emplace_back(node.Kind, node.x, node.y, edge.Length, edge.Wire);
+      }
+      std::sort(nodes.begin(), nodes.end());
+      return nodes;
+    };
+    REQUIRE(shape(a) == shape(b));
+  };
+
+  // loading the tree alone reproduces its embedding
+  auto session = dme::EcoSession(inp, topology);
+  auto start = session.result();
+  sameTree(start.Tree, dme::EmbeddingManager(inp, topology).computeEmbedding());
+  auto reloaded = dme::EcoSession(
+      inp, dme::topologyFromOutput(inp, start.Tree.toOutParam(inp)));
+  sameTree(reloaded.result().Tree, start.Tree);
+
+  std::istringstream text("# placement ECO\n"
+                          "remove s3\n"
+                          "move s10 50000 50000\n"
+                          "add n0 99000 1000 7\n"
+                          "\n"
+                          "move n0 98000 2000 # twice in one batch\n"
+                          "remove s11\n"
+                          "add s3 20000 80000 9\n");
+  auto changes = dme::parseEcoChanges(text);
+  REQUIRE(changes.size() == 6);
+  session.apply(changes);
+  REQUIRE(session.stats().Merges < 300);
+
+  auto res = session.result();
+  REQUIRE(res.Input.sinks.size() == 1500);
+  REQUIRE(res.Input.sinks.back().id == "s3");
+  REQUIRE(res.Input.sinks[res.Input.sinks.size() - 2].id == "n0");
+  REQUIRE(res.Input.sinks[res.Input.sinks.size() - 2].cord.x == 98000);
+  sameTree(res.Tree, full(res.Input, res.Tree));
+  auto eval = dme::evaluate(res.Input, res.Tree);
+  REQUIRE(eval.Skew < 1e-3 * eval.MaxLatency);
+
+  // rejected batches change nothing
+  std::istringstream bad("add s5 0 0 1\n");
+  REQUIRE_THROWS(session.apply(dme::parseEcoChanges(bad)));
+  std::istringstream typo("mvoe s5 0 0\n");
+  REQUIRE_THROWS(dme::parseEcoChanges(typo));
+  sameTree(session.result().Tree, res.Tree);
+
+  // down to a single sink and back
+  std::vector<dme::EcoChange> strip;
+  for (const auto &s : res.Input.sinks) {
+    if (s.id != "s0") {
+      strip.push_back(dme::EcoChange{.Kind = dme::EcoChange::REMOVE,
+                                     .Id = s.id});
+    }
+  }
+  session.apply(strip);
+  REQUIRE(session.result().Input.sinks.size() == 1);
+  session.apply({dme::EcoChange{.Kind = dme::EcoChange::ADD,
+                                .Id = "t",
+                                .Cord = point{.x = 10, .y = 10},
+                                .Cap = 3}});
+  auto pair = session.result();
+  REQUIRE(pair.Input.sinks.size() == 2);
+  sameTree(pair.Tree, full(pair.Input, pair.Tree));
+}
+
+TEST_CASE("Topology::saveTopology Round Trips", "[topology]") {
+  auto inp = randomDesign(53, 300, 100000);
+  auto top = TreeSynthesis(inp, TreeSynthesisSettings{
+                                    .Algo = TopologyAlgorithm::DNNA,
+                                    .Alpha = 0.2,
+                                    .Beta = 1.0,
+                                    .Gamma = 0.5,
+                                    .Delta = 2.5})
+                 .getTopology();
+
+  auto dir = std::filesystem::temp_directory_path() / "topology_checkpoint";
+  std::filesystem::create_directories(dir);
+  auto path = (dir / "tree.top").string();
+  saveTopology(path, top, inp);
+  auto loaded = loadTopology(path, inp);
+  REQUIRE(loaded.Nodes == top.Nodes);
+  REQUIRE(loaded.Edges == top.Edges);
+  REQUIRE(loaded.Tags == top.Tags);
+
+  // same embedding from the checkpoint
+  auto a = dme::EmbeddingManager(inp, top).computeEmbedding();
+  auto b = dme::EmbeddingManager(inp, loaded).computeEmbedding();
+  REQUIRE(a.Topology.Nodes == b.Topology.Nodes);
+
+  // other designs and damaged files are rejected
+  auto moved = inp;
+  moved.sinks[7].cord.x += 1;
+  REQUIRE_THROWS(loadTopology(path, moved));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+  REQUIRE_THROWS(loadTopology(path, inp));
+  REQUIRE_THROWS(loadTopology((dir / "missing.top").string(), inp));
+
+  // a tag length past the end of the file is rejected before allocating
+  saveTopology(path, top, inp);
+  {
+    auto last = top.Tags.rbegin()->second.size();
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(std::filesystem::file_size(path) - last - 4);
+    file.write("\xf0\xff\xff\xff", 4);
+  }
+  REQUIRE_THROWS_AS(loadTopology(path, inp), std::runtime_error);
+
+  // well formed files that do not hold a tree over the sinks
+  auto rejects = [&](auto damage) {
+    auto bad = top;
+    damage(bad);
+    saveTopology(path, bad, inp);
+    REQUIRE_THROWS_AS(loadTopology(path, inp), std::runtime_error);
+  };
+  rejects([](TopologyResult &t) { t.Nodes[5].Idx = 601; });
+  rejects([](TopologyResult &t) { t.Nodes[5].Idx = t.Nodes[6].Idx; });
+  rejects([](TopologyResult &t) { t.Nodes[5].Kind = TreeNode::INTERNAL; });
+  rejects([](TopologyResult &t) { t.Edges[3].second = -1; });
+  rejects([](TopologyResult &t) { t.Edges[3].second = t.Edges[4].second; });
+  rejects([](TopologyResult &t) { t.Edges.pop_back(); });
+  rejects([](TopologyResult &t) { t.Tags[9000] = "x"; });
+  // internal node A, its internal child B and a child D of B: B becomes
+  // the parent of A and the old parent of A takes D, a cycle with every
+  // child count unchanged
+  rejects([](TopologyResult &t) {
+    std::map<int32_t, size_t> edgeInto;
+    for (size_t e = 0; e < t.Edges.size(); ++e) {
+      edgeInto[t.Edges[e].second] = e;
+    }
+    for (auto [a, b] : t.Edges) {
+      if (a > 300 && b > 300) {
+        auto up = edgeInto[a];
+        auto down = std::find_if(t.Edges.begin(), t.Edges.end(),
+                                 [b](auto &e) { return e.first == b; });
+        down->first = t.Edges[up].first;
+        t.Edges[up].first = b;
+        return;
+      }
+    }
+  });
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("DME::optimizeTopology Improves And Stays Deterministic", "[dme]") {
+  auto inp = randomDesign(
+      46, 1000, 100000,
+      {wire{.type = "0", .cap = 0.0002, .resistance = 0.0001},
+       wire{.type = "1", .cap = 0.0001, .resistance = 0.0003}});
+  auto topology = TreeSynthesis(inp, TreeSynthesisSettings{
+                                         .Algo = TopologyAlgorithm::NNA,
+                                         .Alpha = 0,
+                                         .Beta = 0,
+                                         .Gamma = 0,
+                                         .Delta = 0.5})
+                      .getTopology();
+
+  dme::LocalSearchStats stats;
+  auto serial = dme::optimizeTopology(
+      inp, topology,
+      dme::LocalSearchSettings{.Embedding = {}, .TaskCutoff = 64}, &stats);
+  REQUIRE(stats.Committed > 0);
+  REQUIRE(stats.CapAfter < stats.CapBefore);
+  REQUIRE(serial.Nodes.size() == topology.Nodes.size());
+  REQUIRE(serial.Edges.size() == topology.Edges.size());
+
+  // the returned tree is what the embedding sees, still zero skew
+  auto before = dme::evaluate(
+      inp, dme::EmbeddingManager(inp, topology).computeEmbedding());
+  auto after =
+      dme::evaluate(inp, dme::EmbeddingManager(inp, serial).computeEmbedding());
+  REQUIRE(after.TotalCap < before.TotalCap);
+  REQUIRE(after.Skew < 1e-3 * after.MaxLatency);
+
+  auto parallel = dme::optimizeTopology(
+      inp, topology,
+      dme::LocalSearchSettings{
+          .Embedding = {}, .Threads = 3, .TaskCutoff = 64});
+  REQUIRE(parallel.Edges == serial.Edges);
+
+  // a node with three children is not a binary tree
+  auto wide = topology;
+  auto root = wide.Edges.front().first;
+  for (auto &[from, to] : wide.Edges) {
+    if (from != root) {
+      from = root;
+      break;
+    }
+  }
+  REQUIRE_THROWS_AS(
+      dme::optimizeTopology(inp, wide, dme::LocalSearchSettings{}),
+      std::invalid_argument);
+}
+
+TEST_CASE("Topology::clusterSinks Groups Near Sinks", "[topology]") {
+  // the first 100 sinks get three close neighbours each
+  auto inp = randomDesign(47, 300, 100000);
+  std::mt19937 rng(47);
+  std::uniform_int_distribution<int64_t> near(-100, 100);
+  for (int32_t c = 0; c < 100; ++c) {
+    auto at = inp.sinks[c].cord;
+    for (int32_t k = 1; k < 4; ++k) {
+      inp.sinks.push_back(
+          sink{.id = "s" + std::to_string(inp.sinks.size()),
+               .cord = point{.x = at.x + near(rng), .y = at.y + near(rng)},
+               .cap = 5 + k});
+    }
+  }
+  auto numSinks = static_cast<int32_t>(inp.sinks.size());
+  auto sett = TreeSynthesisSettings{.Algo = TopologyAlgorithm::NNA,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0.5};
+  auto sorted = [](auto edges) {
+    std::sort(edges.begin(), edges.end());
+    return edges;
+  };
+
+  // without a radius nothing changes
+  auto plain = TreeSynthesis(inp, sett).getTopology();
+  auto same = clusteredTopology(inp, sett, SinkClusterSettings{});
+  REQUIRE(sorted(same.Edges) == sorted(plain.Edges));
+
+  SinkClusters clusters;
+  auto top = clusteredTopology(
+      inp, sett, SinkClusterSettings{.Radius = 400, .MaxGroupSize = 3},
+      &clusters);
+  auto numGroups = static_cast<int32_t>(clusters.Groups.size());
+  REQUIRE(numGroups < numSinks - 150);
+  REQUIRE(clusters.Reduced.sinks.size() == clusters.Groups.size());
+  std::vector<int32_t> seen(numSinks, 0);
+  for (const auto &group : clusters.Groups) {
+    REQUIRE(group.size() <= 3);
+    const auto &seed = inp.sinks[group.front()].cord;
+    for (auto pos : group) {
+      const auto &pt = inp.sinks[pos].cord;
+      REQUIRE(std::abs(pt.x - seed.x) + std::abs(pt.y - seed.y) <= 400);
+      ++seen[pos];
+    }
+  }
+  REQUIRE(std::count(seen.begin(), seen.end(), 1) == numSinks);
+
+  // a binary tree over every sink, embedded zero skew
+  REQUIRE(top.Nodes.size() == 2 * inp.sinks.size());
+  REQUIRE(top.Edges.size() == 2 * inp.sinks.size() - 1);
+  std::map<int32_t, int32_t> kids;
+  for (const auto &[from, to] : top.Edges) {
+    ++kids[from];
+  }
+  for (const auto &node : top.Nodes) {
+    REQUIRE(kids[node.Idx] == (node.Kind == TreeNode::SINK       ? 0
+                               : node.Kind == TreeNode::INTERNAL ? 2
+                                                                 : 1));
+  }
+  REQUIRE(top.Tags.at(1) == "s0");
+  auto eval =
+      dme::evaluate(inp, dme::EmbeddingManager(inp, top).computeEmbedding());
+  REQUIRE(eval.Skew < 1e-3 * eval.MaxLatency);
+}
+
+TEST_CASE("DME::sinkOrder Follows The Curve And Restores Numbering", "[dme]") {
+  REQUIRE(mortonKey(1, 0) == 1);
+  REQUIRE(mortonKey(0, 1) == 2);
+  REQUIRE(mortonKey(3, 3) == 15);
+
+  // consecutive cells of the Hilbert curve are neighbours
+  inparams grid;
+  for (int64_t x = 0; x < 8; ++x) {
+    for (int64_t y = 0; y < 8; ++y) {
+      grid.sinks.push_back(
+          sink{.id = "", .cord = point{.x = 8 - x, .y = y}, .cap = 1});
+    }
+  }
+  auto curve = dme::sinkOrder(grid, dme::SinkOrder::HILBERT);
+  for (size_t i = 1; i < curve.size(); ++i) {
+    const auto &a = grid.sinks[curve[i - 1]].cord;
+    const auto &b = grid.sinks[curve[i]].cord;
+    REQUIRE(std::abs(a.x - b.x) + std::abs(a.y - b.y) == 1);
+  }
+
+  auto inp = randomDesign(48, 500, 100000);
+  for (auto &s : inp.sinks) {
+    s.cord = point{.x = s.cord.x - 50000, .y = s.cord.y - 50000};
+  }
+  for (auto kind : {dme::SinkOrder::HILBERT, dme::SinkOrder::MORTON}) {
+    auto order = dme::sinkOrder(inp, kind);
+    auto sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    REQUIRE(sorted == dme::sinkOrder(inp, dme::SinkOrder::INPUT));
+    REQUIRE(dme::inverseOrder(order)[order[7]] == 7);
+
+    // a tree of the reordered design is the same tree of the input design
+    auto reordered = dme::reorderSinks(inp, order);
+    auto sett = TreeSynthesisSettings{.Algo = TopologyAlgorithm::MMM,
+                                      .Alpha = 0,
+                                      .Beta = 0,
+                                      .Gamma = 0,
+                                      .Delta = 0};
+    auto tree = dme::EmbeddingManager(
+                    reordered, TreeSynthesis(reordered, sett).getTopology())
+                    .computeEmbedding();
+    auto expected = dme::evaluate(reordered, tree);
+    dme::renumberSinks(tree, order);
+    auto restored = dme::evaluate(inp, tree);
+    REQUIRE(restored.TotalCap == Approx(expected.TotalCap));
+    REQUIRE(restored.MaxLatency == Approx(expected.MaxLatency));
+    REQUIRE(restored.Skew < 1e-3 * restored.MaxLatency);
+    for (int32_t i = 0; i < 500; ++i) {
+      REQUIRE(tree.Topology.Tags.at(i + 1) == inp.sinks[i].id);
+    }
+
+    dme::renumberSinks(tree.Topology, dme::inverseOrder(order));
+    REQUIRE(tree.Topology.Tags.at(1) == reordered.sinks[0].id);
+  }
+}
+
+TEST_CASE("DME::routeEdges Avoids Blockages And Keeps Zero Skew", "[dme]") {
+  // a U open to the top: from inside it the way out is over the rim
+  dme::BlockageGrid cup({Blockage{.x1 = 0, .y1 = 0, .x2 = 10, .y2 = 100},
+                         Blockage{.x1 = 10, .y1 = 0, .x2 = 90, .y2 = 10},
+                         Blockage{.x1 = 90, .y1 = 0, .x2 = 100, .y2 = 100}});
+  REQUIRE(cup.inside(dme::pt_t{.x = 5, .y = 50}));
+  REQUIRE_FALSE(cup.inside(dme::pt_t{.x = 10, .y = 50}));
+  REQUIRE(cup.escape(dme::pt_t{.x = 50, .y = 4}) ==
+          std::vector<dme::pt_t>{dme::pt_t{.x = 50, .y = 0}});
+  dme::RouteContext ctx;
+  auto a = dme::pt_t{.x = 50, .y = 50}, b = dme::pt_t{.x = 50, .y = -50};
+  auto path = dme::searchRoute(cup, a, b, ctx);
+  REQUIRE(path);
+  REQUIRE(path->Length == 50 + 50 + 150 + 50);
+  auto prev = a;
+  for (auto pt : path->Bends) {
+    REQUIRE((pt.x == prev.x || pt.y == prev.y));
+    REQUIRE_FALSE(cup.crosses(prev, pt));
+    prev = pt;
+  }
+  REQUIRE_FALSE(cup.crosses(prev, b));
+  auto back = dme::searchRoute(cup, b, a, ctx);
+  REQUIRE(ctx.Cache.size() == 1);
+  REQUIRE(back->Length == path->Length);
+  REQUIRE(back->Bends.front() == path->Bends.back());
+
+  auto inp = randomDesign(50, 400, 100000);
+  inp.blockages = {
+      Blockage{.x1 = 20000, .y1 = 10000, .x2 = 30000, .y2 = 90000},
+      Blockage{.x1 = 60000, .y1 = 40000, .x2 = 90000, .y2 = 60000},
+      Blockage{.x1 = 40000, .y1 = 70000, .x2 = 50000, .y2 = 100000}};
+  dme::BlockageGrid grid(inp.blockages);
+  std::erase_if(inp.sinks, [&](const sink &s) {
+    return grid.inside(dme::pt_t{.x = s.cord.x, .y = s.cord.y});
+  });
+  auto sett = TreeSynthesisSettings{.Algo = TopologyAlgorithm::NNA,
+                                    .Alpha = 0,
+                                    .Beta = 0,
+                                    .Gamma = 0,
+                                    .Delta = 0};
+  auto tree =
+      dme::EmbeddingManager(inp, TreeSynthesis(inp, sett).getTopology())
+          .computeEmbedding();
+  auto before = dme::evaluate(inp, tree);
+  auto threaded = tree;
+  auto stats = dme::routeEdges(inp, tree, dme::RouterSettings{});
+  REQUIRE(stats.Searched > 0);
+  REQUIRE(stats.Detour > 0);
+
+  REQUIRE(stats.Snaked > 0);
+  REQUIRE(stats.Unsnaked == 0);
+
+  // every wire as written runs clear of the blockages, as does one of the
+  // two L shapes of a wire with a bend, and no buffer sits on one
+  auto written = [&](const dme::EmbeddingResult &routed) {
+    auto out = routed.toOutParam(inp);
+    std::map<std::string, dme::pt_t> at;
+    for (const auto &node : routed.Topology.Nodes) {
+      at[std::to_string(node.Idx)] = dme::pt_t{.x = node.x, .y = node.y};
+    }
+    for (const auto &node : out.nodes) {
+      at[node.name] = dme::pt_t{.x = node.pt.x, .y = node.pt.y};
+    }
+    for (const auto &w : out.wires) {
+      auto a = at.at(w.from), b = at.at(w.to);
+      auto viaX = dme::pt_t{.x = b.x, .y = a.y};
+      auto viaY = dme::pt_t{.x = a.x, .y = b.y};
+      REQUIRE(((!grid.crosses(a, viaX) && !grid.crosses(viaX, b)) ||
+               (!grid.crosses(a, viaY) && !grid.crosses(viaY, b))));
+    }
+    for (const auto &cell : out.buffers) {
+      REQUIRE_FALSE(dme::onBlockage(at.at(cell.from), inp.blockages));
+    }
+  };
+  written(tree);
+
+  auto after = dme::evaluate(inp, tree);
+  REQUIRE(after.TotalCap > before.TotalCap);
+  REQUIRE(after.Skew < 1e-3 * after.MaxLatency);
+
+  dme::routeEdges(inp, threaded, dme::RouterSettings{.Threads = 3});
+  REQUIRE(threaded.Routes == tree.Routes);
+  for (size_t i = 0; i < tree.Edges.size(); ++i) {
+    REQUIRE(threaded.Edges[i].Length == tree.Edges[i].Length);
+  }
+
+  // buffered: stubs fold onto their cells, which stay where they were
+  inp.buffers = {buffer{.id = "0",
+                        .cktname = "clkinv0.subckt",
+                        .inverted = 1,
+                        .in_cap = 35,
+                        .out_cap = 80,
+                        .resistance = 61.2}};
+  inp.smul.cap_limit = 5000;
+  inp.src.buf_name = "0";
+  auto bufSett = dme::EmbeddingSettings{};
+  bufSett.Buffered = true;
+  bufSett.CapBudget = 0.05;
+  auto buffered =
+      dme::EmbeddingManager(inp, TreeSynthesis(inp, sett).getTopology(),
+                            bufSett)
+          .computeEmbedding();
+  stats = dme::routeEdges(inp, buffered, dme::RouterSettings{});
+  REQUIRE(stats.Unsnaked == 0);
+  written(buffered);
+  auto eval = dme::evaluate(inp, buffered);
+  REQUIRE(eval.Skew < 1e-3 * eval.MaxLatency);
+
+  // the merge point of two sinks inside the blockage between them moves
+  // out of it before routing
+  inp.buffers.clear();
+  inp.sinks = {sink{.id = "a", .cord = point{.x = 0, .y = 50000}, .cap = 10},
+               sink{.id = "b", .cord = point{.x = 100000, .y = 50000},
+                    .cap = 10}};
+  inp.blockages = {
+      Blockage{.x1 = 40000, .y1 = 40000, .x2 = 60000, .y2 = 60000}};
+  grid = dme::BlockageGrid(inp.blockages);
+  auto pair =
+      dme::EmbeddingManager(inp, TreeSynthesis(inp, sett).getTopology())
+          .computeEmbedding();
+  stats = dme::routeEdges(inp, pair, dme::RouterSettings{});
+  REQUIRE(stats.Moved == 1);
+  for (const auto &node : pair.Topology.Nodes) {
+    REQUIRE_FALSE(grid.inside(dme::pt_t{.x = node.x, .y = node.y}));
+  }
+  written(pair);
+  eval = dme::evaluate(inp, pair);
+  REQUIRE(eval.Skew < 1e-3 * eval.MaxLatency);
+}